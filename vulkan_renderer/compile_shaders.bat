@@ -1,2 +1,3 @@
 glslangValidator -V -H shader.vert > vert.spv.txt
-glslangValidator -V -H shader.frag > frag.spv.txt
\ No newline at end of file
+glslangValidator -V -H shader.frag > frag.spv.txt
+glslangValidator -V -H shader_packed.vert -o vert_packed.spv > vert_packed.spv.txt
\ No newline at end of file
@@ -1,3 +1,13 @@
 #pragma once
 
-#define USE_VULKAN_DEBUG_LAYERS 0
\ No newline at end of file
+#define USE_VULKAN_DEBUG_LAYERS 0
+
+// Runs the Multitasker microbenchmarks (thread/benchmark.h) instead of the renderer
+#define RUN_MULTITASKER_BENCHMARKS 0
+
+// Times Assimp imports of data/nanosuit.obj (serial and parallel conversion) against its mesh cache, instead of the renderer
+#define RUN_MESH_CACHE_BENCHMARK 0
+
+// Loads the models with model::vertex_format::packed, drawn by vert_packed.spv : not checked in yet, generate it (and
+// vert_packed.spv.txt) with compile_shaders.bat before turning this on
+#define USE_PACKED_VERTICES 0
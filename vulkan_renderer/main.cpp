@@ -4,7 +4,9 @@
 #include "texture.h"
 #include "pipeline.h"
 #include "render_pass.h"
+#include "config_defines.h"
 
+#include <thread/benchmark.h>
 #include <thread/multitasker.h>
 #include <thread/thread.h>
 
@@ -55,8 +57,56 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 	}
 }
 
+// Cold : Assimp import, converted serially then on the tasker. Warm : mapped mesh cache.
+// Textures are shared between loads, only the geometry is timed.
+static void run_mesh_cache_benchmark(renderer& renderer, kth::Multitasker& tasker, const std::string& path, float scale)
+{
+	const uint32_t iterations = 10;
+
+	// Writes the cache and creates the textures
+	model{ path, renderer, scale };
+
+	double cold_ms = 0.0;
+	double cold_parallel_ms = 0.0;
+	double warm_ms = 0.0;
+	for (uint32_t i = 0; i < iterations; ++i)
+	{
+		cold_ms += model{ path, renderer, scale, model::load_options(false) }.report().load_ms;
+		cold_parallel_ms += model{ path, renderer, scale, model::load_options(false, &tasker) }.report().load_ms;
+
+		model warm{ path, renderer, scale };
+		if (!warm.report().from_cache)
+			printf("%s : mesh cache not used\n", path.c_str());
+		warm_ms += warm.report().load_ms;
+	}
+
+	printf("%s : cold %.3f ms, cold on %u workers %.3f ms, warm %.3f ms (x%.1f)\n", path.c_str(), cold_ms / iterations,
+		tasker.worker_count(), cold_parallel_ms / iterations, warm_ms / iterations, cold_ms / warm_ms);
+}
+
+static void print_geometry_memory(const char* name, const model::load_report& report)
+{
+	printf("%s : %llu vertices, %u bytes per vertex, %.2f MB (%.2f MB saved), indices %.2f MB\n", name, (unsigned long long)report.vertex_count,
+		report.vertex_stride, report.vertex_bytes / (1024.0 * 1024.0), report.vertex_bytes_saved() / (1024.0 * 1024.0), report.index_bytes / (1024.0 * 1024.0));
+}
+
+static void print_vertex_cache(const char* name, const model::load_report& report)
+{
+	for (size_t i = 0; i < report.vertex_cache.size(); ++i)
+	{
+		const auto& mesh = report.vertex_cache[i];
+		printf("%s mesh %zu : %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", name, i, mesh.triangle_count,
+			mesh.acmr_before, mesh.acmr_after, mesh.atvr_before, mesh.atvr_after);
+	}
+}
+
 int main()
 {
+#if RUN_MULTITASKER_BENCHMARKS
+	// Does not return : the benchmark taskers are leaked with their workers running
+	kth::run_multitasker_benchmarks_and_exit(kth::BenchmarkOptions());
+#endif
+
 	std::vector<const char*> instance_layers;
 	std::vector<const char*> device_layers;
 	std::vector<const char*> instance_extensions;
@@ -69,12 +119,20 @@ int main()
 	
 	renderer renderer{ SCREEN_WIDTH, SCREEN_HEIGHT, 3, instance_layers , instance_extensions, device_layers, device_extensions };
 	
-	uint32_t processor_count = kth::get_processor_count();
-	kth::Multitasker tasker{ processor_count, 64, [&](int worker_index)
+	// One worker per physical core
+	uint32_t worker_count = kth::get_cpu_topology().core_count;
+	if (worker_count == 0)
+		worker_count = kth::get_processor_count();
+	kth::Multitasker tasker{ worker_count, kth::FiberPoolDesc(), [&](int worker_index)
 	{
 		
 	} };
 
+#if RUN_MESH_CACHE_BENCHMARK
+	run_mesh_cache_benchmark(renderer, tasker, "data/nanosuit.obj", 3.0f);
+	return 0;
+#endif
+
 	
 
 	vk::Device device = renderer.device();
@@ -96,9 +154,16 @@ int main()
 	render_pass.push_subpass({}, { 0 }, { {2, vk::ImageLayout::eColorAttachmentOptimal} }, 1, {});
 	render_pass.finalize_render_pass();
 
+#if USE_PACKED_VERTICES
+	const model::vertex_format vertex_format = model::vertex_format::packed;
+#else
+	const model::vertex_format vertex_format = model::vertex_format::full;
+#endif
+
 	pipeline::description pipeline_desc;
-	pipeline_desc.vertex_input_attributes = model::attribute_descriptions(0);
-	pipeline_desc.vertex_input_bindings = model::binding_description(0);
+	pipeline_desc.vertex_input_attributes = model::attribute_descriptions(0, vertex_format);
+	pipeline_desc.vertex_input_bindings = model::binding_description(0, vertex_format);
+	pipeline_desc.vertex_shader = model::vertex_shader(vertex_format);
 	pipeline_desc.viewport = vk::Viewport{ 0.0f, 0.0f, SCREEN_WIDTH, SCREEN_HEIGHT, 0.0f, 1.0f };
 	pipeline_desc.scissor = vk::Rect2D{ { 0,0 },{ SCREEN_WIDTH, SCREEN_HEIGHT } };
 
@@ -113,6 +178,8 @@ int main()
 	pipeline_desc.descriptor_sets_pool_sizes = { 1, 64, 128 };
 	pipeline_desc.samples = multisampling_count;
 	pipeline_desc.push_constants.push_back({ vk::ShaderStageFlagBits::eFragment, 0, sizeof(model::material::info) });
+	if (vertex_format == model::vertex_format::packed)
+		pipeline_desc.push_constants.push_back(model::dequantization_push_constant_range());
 
 	pipeline forward_rendering_pipeline{ renderer, render_pass, pipeline_desc };
 
@@ -141,22 +208,26 @@ int main()
 		framebuffers[i] = device.createFramebuffer(framebuffer_create_info);
 	}
 	
-	model nanosuit{ "data/nanosuit.obj", renderer, 3.0f };
-	model sponza{ "data/nanosuit.obj", renderer, 1.0f };
+	model nanosuit{ "data/nanosuit.obj", renderer, 3.0f, model::load_options(true, &tasker, vertex_format, true) };
+	model small_nanosuit{ "data/nanosuit.obj", renderer, 1.0f, model::load_options(true, &tasker, vertex_format, true) };
+	print_geometry_memory("nanosuit", nanosuit.report());
+	print_geometry_memory("small nanosuit", small_nanosuit.report());
+	print_vertex_cache("nanosuit", nanosuit.report());
+	print_vertex_cache("small nanosuit", small_nanosuit.report());
 	cam.attach(forward_rendering_pipeline, 0);
 		
 	nanosuit.attach_textures(forward_rendering_pipeline, 2);
-	sponza.attach_textures(forward_rendering_pipeline, 2);
+	small_nanosuit.attach_textures(forward_rendering_pipeline, 2);
 
 	auto nanosuit_descriptor = forward_rendering_pipeline.allocate(1);
-	auto sponza_descriptor = forward_rendering_pipeline.allocate(1);
+	auto small_nanosuit_descriptor = forward_rendering_pipeline.allocate(1);
 
 	auto descriptor_buffer_info_nanosuit = nanosuit.descriptor_buffer_info();
-	auto descriptor_buffer_info_sponza = sponza.descriptor_buffer_info();
+	auto descriptor_buffer_info_small_nanosuit = small_nanosuit.descriptor_buffer_info();
 
 	std::vector<vk::WriteDescriptorSet> descriptor_writes{ 
 		vk::WriteDescriptorSet{ *nanosuit_descriptor, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &descriptor_buffer_info_nanosuit, nullptr },
-		vk::WriteDescriptorSet{ *sponza_descriptor, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &descriptor_buffer_info_sponza, nullptr },
+		vk::WriteDescriptorSet{ *small_nanosuit_descriptor, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &descriptor_buffer_info_small_nanosuit, nullptr },
 	};
 
 	device.updateDescriptorSets(descriptor_writes, {});
@@ -199,9 +270,9 @@ int main()
 		nanosuit.draw(cmd, forward_rendering_pipeline, cam);
 
 
-		tobind = { *sponza_descriptor };
+		tobind = { *small_nanosuit_descriptor };
 		cmd.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, forward_rendering_pipeline.pipeline_layout(), 1, (uint32_t)tobind.size(), tobind.data(), 0, nullptr);
-		sponza.draw(cmd, forward_rendering_pipeline, cam);
+		small_nanosuit.draw(cmd, forward_rendering_pipeline, cam);
 
 
 		cmd.endRenderPass();
@@ -226,6 +297,8 @@ int main()
 		last_time = current_time;
 		cam.update(dt.count(), g_input_state);
 		nanosuit.update(dt.count());
+		if (kth::Tracer* tracer = tasker.tracer())
+			tracer->mark_frame();
 		auto render_time = renderer.render(render_fence);
 		if(render_time>0.0)
 		{
@@ -240,6 +313,9 @@ int main()
 	device.waitIdle();
 	device.destroyFence(render_fence);
 
+	if (kth::Tracer* tracer = tasker.tracer())
+		tracer->write_chrome_trace("kth_trace.json");
+
 
 	for (auto& view : views)
 		device.destroyImageView(view);
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Read only mapping of a whole file, released with the object
+class mapped_file
+{
+public:
+	mapped_file() = default;
+	~mapped_file() { close(); }
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	// False if the file does not exist, is empty or cannot be mapped
+	bool open(const std::string& path);
+	void close();
+
+	const char* data() const { return _data; }
+	size_t size() const { return _size; }
+	explicit operator bool() const { return _data != nullptr; }
+
+private:
+	const char* _data = nullptr;
+	size_t _size = 0;
+#ifdef _WIN32
+	void* _file = nullptr;
+	void* _mapping = nullptr;
+#endif
+};
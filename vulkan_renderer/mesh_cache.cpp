@@ -0,0 +1,231 @@
+#include "mesh_cache.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace
+{
+	struct layout
+	{
+		uint64_t meshes;
+		uint64_t materials;
+		uint64_t strings;
+		uint64_t geometry;
+		uint64_t size;
+	};
+
+	uint64_t align(uint64_t offset)
+	{
+		return (offset + 15) & ~uint64_t(15);
+	}
+
+	layout compute_layout(const mesh_cache::header& header)
+	{
+		layout result;
+		result.meshes = align(sizeof(mesh_cache::header));
+		result.materials = align(result.meshes + header.mesh_count * sizeof(mesh_cache::mesh));
+		result.strings = align(result.materials + header.material_count * sizeof(mesh_cache::material));
+		result.geometry = align(result.strings + header.strings_size);
+		result.size = result.geometry + mesh_cache::vertex_blob_offset(header.index_bytes) + header.vertex_bytes;
+		return result;
+	}
+
+	void write_padding(std::ofstream& file, uint64_t offset)
+	{
+		static const char zeros[16] = {};
+		file.write(zeros, (std::streamsize)(align(offset) - offset));
+	}
+
+	bool write_source_mtime(const std::string& path, int64_t mtime)
+	{
+		std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+		if (!file)
+			return false;
+		file.seekp((std::streamoff)(offsetof(mesh_cache::header, source) + offsetof(mesh_cache::source_info, mtime)));
+		file.write(reinterpret_cast<const char*>(&mtime), sizeof(mtime));
+		return (bool)file;
+	}
+}
+
+uint32_t mesh_cache::contents::add_string(const std::string& string)
+{
+	uint32_t offset = (uint32_t)strings.size();
+	strings.append(string.c_str(), string.size() + 1);
+	return offset;
+}
+
+bool mesh_cache::query_source(const std::string& source_path, source_info& info)
+{
+#ifdef _WIN32
+	struct _stat64 status;
+	if (_stat64(source_path.c_str(), &status) != 0)
+		return false;
+#else
+	struct stat status;
+	if (stat(source_path.c_str(), &status) != 0)
+		return false;
+#endif
+	info.size = (uint64_t)status.st_size;
+	info.mtime = (int64_t)status.st_mtime;
+	info.hash = 0;
+	return true;
+}
+
+// FNV-1a : only read when the size or mtime changed (checkouts, copies), or when the cache is written
+bool mesh_cache::hash_source(const std::string& source_path, uint64_t& hash)
+{
+	std::ifstream file(source_path, std::ios::binary);
+	if (!file)
+		return false;
+
+	hash = 14695981039346656037ull;
+	char buffer[64 * 1024];
+	while (file)
+	{
+		file.read(buffer, sizeof(buffer));
+		std::streamsize count = file.gcount();
+		for (std::streamsize i = 0; i < count; ++i)
+		{
+			hash ^= (uint8_t)buffer[i];
+			hash *= 1099511628211ull;
+		}
+	}
+	return true;
+}
+
+std::string mesh_cache::cache_path(const std::string& source_path, float scale, uint32_t vertex_format)
+{
+	// Scales that print the same share a file : the header's exact scale then tells them apart
+	char suffix[64];
+	snprintf(suffix, sizeof(suffix), ".s%g.f%u.kthmesh", scale, vertex_format);
+	return source_path + suffix;
+}
+
+std::unique_ptr<mesh_cache> mesh_cache::open(const std::string& source_path, float scale, uint32_t vertex_format, uint32_t vertex_stride)
+{
+	source_info source;
+	if (!query_source(source_path, source))
+		return nullptr;
+
+	bool hashed = false;
+	std::unique_ptr<mesh_cache> cache = load(source_path, source, hashed, scale, vertex_format, vertex_stride);
+	if (!cache || !hashed)
+		return cache;
+
+	// Same content under a new mtime (checkouts, copies) : stored so the next start skips the hash. Unmapped first,
+	// Windows does not share the mapped file for writing
+	cache.reset();
+	write_source_mtime(cache_path(source_path, scale, vertex_format), source.mtime);
+	return load(source_path, source, hashed, scale, vertex_format, vertex_stride);
+}
+
+std::unique_ptr<mesh_cache> mesh_cache::load(const std::string& source_path, source_info& source, bool& hashed, float scale, uint32_t vertex_format, uint32_t vertex_stride)
+{
+	std::unique_ptr<mesh_cache> cache(new mesh_cache());
+	if (!cache->_file.open(cache_path(source_path, scale, vertex_format)) || cache->_file.size() < sizeof(header))
+		return nullptr;
+
+	const header* file_header = reinterpret_cast<const header*>(cache->_file.data());
+	if (file_header->magic != magic || file_header->version != version || file_header->scale != scale
+		|| file_header->vertex_format != vertex_format || file_header->vertex_stride != vertex_stride)
+		return nullptr;
+
+	layout file_layout = compute_layout(*file_header);
+	if (file_layout.size != cache->_file.size())
+		return nullptr;
+
+	if (file_header->source.size != source.size || file_header->source.mtime != source.mtime)
+	{
+		// Hashed once : the second load after the mtime refresh reuses it
+		if (file_header->source.size != source.size || (!hashed && !hash_source(source_path, source.hash)) || file_header->source.hash != source.hash)
+			return nullptr;
+		hashed = true;
+	}
+
+	const char* data = cache->_file.data();
+	cache->_header = file_header;
+	cache->_meshes = reinterpret_cast<const mesh*>(data + file_layout.meshes);
+	cache->_materials = reinterpret_cast<const material*>(data + file_layout.materials);
+	cache->_strings = data + file_layout.strings;
+	cache->_geometry = data + file_layout.geometry;
+
+	// Offsets are trusted past this point
+	for (uint32_t i = 0; i < file_header->mesh_count; ++i)
+	{
+		const mesh& m = cache->_meshes[i];
+		if ((m.index_size != sizeof(uint16_t) && m.index_size != sizeof(uint32_t)) || m.index_offset % m.index_size != 0
+			|| m.index_offset + (uint64_t)m.index_count * m.index_size > file_header->index_bytes
+			|| m.vertex_offset + (uint64_t)m.vertex_count * file_header->vertex_stride > file_header->vertex_bytes
+			|| m.material_index >= file_header->material_count)
+			return nullptr;
+	}
+	for (uint32_t i = 0; i < file_header->material_count; ++i)
+	{
+		const material& m = cache->_materials[i];
+		if (m.diffuse_path >= file_header->strings_size || m.normal_path >= file_header->strings_size || m.specular_path >= file_header->strings_size)
+			return nullptr;
+	}
+	if (file_header->strings_size > 0 && cache->_strings[file_header->strings_size - 1] != '\0')
+		return nullptr;
+
+	return cache;
+}
+
+bool mesh_cache::write(const std::string& source_path, float scale, const contents& contents)
+{
+	header file_header;
+	memset(&file_header, 0, sizeof(file_header));
+	file_header.magic = magic;
+	file_header.version = version;
+	file_header.scale = scale;
+	file_header.vertex_stride = contents.vertex_stride;
+	file_header.vertex_format = contents.vertex_format;
+	file_header.optimized = contents.optimized ? 1 : 0;
+	if (!query_source(source_path, file_header.source) || !hash_source(source_path, file_header.source.hash))
+		return false;
+	file_header.mesh_count = (uint32_t)contents.meshes.size();
+	file_header.material_count = (uint32_t)contents.materials.size();
+	file_header.strings_size = contents.strings.size();
+	file_header.index_bytes = contents.index_bytes;
+	file_header.vertex_bytes = contents.vertex_bytes;
+
+	std::string path = cache_path(source_path, scale, contents.vertex_format);
+	std::string temporary_path = path + ".tmp";
+	{
+		std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+		if (!file)
+			return false;
+
+		file.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+		write_padding(file, sizeof(file_header));
+		file.write(reinterpret_cast<const char*>(contents.meshes.data()), (std::streamsize)(contents.meshes.size() * sizeof(mesh)));
+		write_padding(file, contents.meshes.size() * sizeof(mesh));
+		file.write(reinterpret_cast<const char*>(contents.materials.data()), (std::streamsize)(contents.materials.size() * sizeof(material)));
+		write_padding(file, contents.materials.size() * sizeof(material));
+		file.write(contents.strings.data(), (std::streamsize)contents.strings.size());
+		write_padding(file, contents.strings.size());
+		file.write(static_cast<const char*>(contents.index_data), (std::streamsize)contents.index_bytes);
+		write_padding(file, contents.index_bytes);
+		file.write(static_cast<const char*>(contents.vertex_data), (std::streamsize)contents.vertex_bytes);
+
+		if (!file)
+		{
+			file.close();
+			std::remove(temporary_path.c_str());
+			return false;
+		}
+	}
+
+	// rename does not replace an existing file on Windows
+	std::remove(path.c_str());
+	if (std::rename(temporary_path.c_str(), path.c_str()) != 0)
+	{
+		std::remove(temporary_path.c_str());
+		return false;
+	}
+	return true;
+}
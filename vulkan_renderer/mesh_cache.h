@@ -0,0 +1,138 @@
+#pragma once
+#include "math_include.h"
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+Binary mesh cache : what model::load_model keeps from an Assimp import, written next to the source file after the
+first import and mapped on the next loads. One cache per source, import scale and vertex format (all three are in its
+file name) : models loading the same source differently do not replace each other's cache.
+
+	header | mesh table | material table | strings | index blob | vertex blob
+
+Sections are 16 byte aligned. The index and vertex blobs are laid out exactly like the start of the model's buffer :
+both are copied to it with a single memcpy. The cache is rejected if its version, the import scale or the vertex format
+changed, or if the source file did (size and mtime first, its content hash when they differ). A cache whose hash
+still matches gets the new mtime, so the next start does not hash again.
+*/
+
+class mesh_cache
+{
+public:
+	static const uint32_t magic = 0x4D48544B; // KTHM
+	static const uint32_t version = 4;
+
+	struct source_info
+	{
+		uint64_t size;
+		int64_t mtime;
+		uint64_t hash;
+	};
+
+	struct header
+	{
+		uint32_t magic;
+		uint32_t version;
+		float scale;
+		uint32_t vertex_stride;
+		uint32_t vertex_format;
+		// Triangles and vertices reordered by mesh_optimizer
+		uint32_t optimized;
+		source_info source;
+		uint32_t mesh_count;
+		uint32_t material_count;
+		uint64_t strings_size;
+		uint64_t index_bytes;
+		uint64_t vertex_bytes;
+	};
+
+	struct mesh
+	{
+		// In bytes, from the start of the index and vertex blobs. index_offset is a multiple of index_size.
+		uint64_t index_offset;
+		uint64_t vertex_offset;
+		uint32_t index_count;
+		uint32_t vertex_count;
+		uint32_t material_index;
+		// 2 or 4 bytes
+		uint32_t index_size;
+		glm::vec3 bbox_min;
+		glm::vec3 bbox_max;
+		glm::vec4 bounding_sphere;
+		// Post transform vertex cache in file order then once optimized, zero when the mesh was not
+		float acmr_before;
+		float atvr_before;
+		float acmr_after;
+		float atvr_after;
+	};
+
+	struct material
+	{
+		// Offsets in the strings, textures already resolved (missing ones included)
+		uint32_t diffuse_path;
+		uint32_t normal_path;
+		uint32_t specular_path;
+		uint32_t padding;
+		glm::vec4 ambient_color;
+		glm::vec4 diffuse_color;
+		glm::vec4 specular_color;
+		float specular_intensity;
+		float normal_map_intensity;
+		float padding_2[2];
+	};
+
+	// Everything load_model produces, to write
+	struct contents
+	{
+		uint32_t vertex_stride = 0;
+		uint32_t vertex_format = 0;
+		bool optimized = false;
+		std::vector<mesh> meshes;
+		std::vector<material> materials;
+		std::string strings;
+		const void* index_data = nullptr;
+		uint64_t index_bytes = 0;
+		const void* vertex_data = nullptr;
+		uint64_t vertex_bytes = 0;
+
+		uint32_t add_string(const std::string& string);
+	};
+
+	// data/nanosuit.obj at scale 3 in vertex format 1 : data/nanosuit.obj.s3.f1.kthmesh
+	static std::string cache_path(const std::string& source_path, float scale, uint32_t vertex_format);
+
+	// Null if there is no valid cache for this source, scale and vertex format
+	static std::unique_ptr<mesh_cache> open(const std::string& source_path, float scale, uint32_t vertex_format, uint32_t vertex_stride);
+	// Written to a temporary file first, a crash never leaves a truncated cache behind
+	static bool write(const std::string& source_path, float scale, const contents& contents);
+
+	// Where the vertex blob starts, relative to the index blob
+	static uint64_t vertex_blob_offset(uint64_t index_bytes) { return (index_bytes + 15) & ~uint64_t(15); }
+
+	const header& info() const { return *_header; }
+	const mesh* meshes() const { return _meshes; }
+	const material* materials() const { return _materials; }
+	const char* string(uint32_t offset) const { return _strings + offset; }
+	// Index blob then vertex blob, vertex_blob_offset(info().index_bytes) apart
+	const char* geometry() const { return _geometry; }
+	uint64_t geometry_size() const { return vertex_blob_offset(_header->index_bytes) + _header->vertex_bytes; }
+
+private:
+	mesh_cache() = default;
+
+	static bool query_source(const std::string& source_path, source_info& info);
+	static bool hash_source(const std::string& source_path, uint64_t& hash);
+	// Sets hashed when the mtime differed and the content hash matched
+	static std::unique_ptr<mesh_cache> load(const std::string& source_path, source_info& source, bool& hashed, float scale, uint32_t vertex_format, uint32_t vertex_stride);
+
+	mapped_file _file;
+	const header* _header = nullptr;
+	const mesh* _meshes = nullptr;
+	const material* _materials = nullptr;
+	const char* _strings = nullptr;
+	const char* _geometry = nullptr;
+};
@@ -0,0 +1,286 @@
+#include "mesh_optimizer.h"
+#include "math_include.h"
+
+#include <algorithm>
+
+namespace
+{
+	const uint32_t no_vertex = ~0u;
+
+	// Triangles using each vertex : those of vertex v are triangles[offsets[v], offsets[v + 1])
+	struct adjacency
+	{
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+	};
+
+	void build_adjacency(adjacency& result, const uint32_t* indices, size_t index_count, uint32_t vertex_count)
+	{
+		result.offsets.assign(vertex_count + 1, 0);
+		for (size_t i = 0; i < index_count; ++i)
+			++result.offsets[indices[i] + 1];
+		for (uint32_t v = 0; v < vertex_count; ++v)
+			result.offsets[v + 1] += result.offsets[v];
+
+		result.triangles.resize(index_count);
+		std::vector<uint32_t> fill(result.offsets.begin(), result.offsets.end() - 1);
+		for (size_t i = 0; i < index_count; ++i)
+			result.triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+	}
+
+	// A vertex stays cached until cache_size other vertices entered the cache after it
+	class fifo_cache
+	{
+	public:
+		fifo_cache(uint32_t vertex_count, uint32_t cache_size) : _timestamps(vertex_count, 0), _time(cache_size + 1), _cache_size(cache_size) {}
+
+		// Misses of the triangle's vertices
+		uint32_t access(const uint32_t* triangle)
+		{
+			uint32_t misses = 0;
+			for (int c = 0; c < 3; ++c)
+			{
+				uint32_t v = triangle[c];
+				if (_time - _timestamps[v] > _cache_size)
+				{
+					_timestamps[v] = _time++;
+					++misses;
+				}
+			}
+			return misses;
+		}
+
+		void flush() { _time += _cache_size + 1; }
+
+	private:
+		std::vector<uint32_t> _timestamps;
+		uint32_t _time;
+		uint32_t _cache_size;
+	};
+
+	// Tipsify's fallback when no candidate has live triangles : the most recently used live vertex, the first live one
+	// in index order otherwise
+	uint32_t skip_dead_end(std::vector<uint32_t>& dead_end, const std::vector<uint32_t>& live_triangles, uint32_t& cursor)
+	{
+		while (!dead_end.empty())
+		{
+			uint32_t v = dead_end.back();
+			dead_end.pop_back();
+			if (live_triangles[v] > 0)
+				return v;
+		}
+		for (; cursor < (uint32_t)live_triangles.size(); ++cursor)
+		{
+			if (live_triangles[cursor] > 0)
+				return cursor;
+		}
+		return no_vertex;
+	}
+}
+
+vertex_cache_statistics analyze_vertex_cache(const uint32_t* indices, size_t index_count, uint32_t vertex_count, uint32_t cache_size)
+{
+	fifo_cache cache(vertex_count, cache_size);
+	uint64_t misses = 0;
+	for (size_t i = 0; i + 3 <= index_count; i += 3)
+		misses += cache.access(indices + i);
+
+	vertex_cache_statistics result;
+	result.acmr = index_count >= 3 ? (float)misses / (float)(index_count / 3) : 0.0f;
+	result.atvr = vertex_count > 0 ? (float)misses / (float)vertex_count : 0.0f;
+	return result;
+}
+
+void optimize_vertex_cache(uint32_t* destination, const uint32_t* indices, size_t index_count, uint32_t vertex_count, std::vector<uint32_t>& clusters, uint32_t cache_size)
+{
+	clusters.clear();
+	size_t triangle_count = index_count / 3;
+	if (triangle_count == 0)
+		return;
+
+	adjacency adjacent;
+	build_adjacency(adjacent, indices, index_count, vertex_count);
+
+	std::vector<uint32_t> live_triangles(vertex_count);
+	for (uint32_t v = 0; v < vertex_count; ++v)
+		live_triangles[v] = adjacent.offsets[v + 1] - adjacent.offsets[v];
+
+	std::vector<uint32_t> cache_time(vertex_count, 0);
+	std::vector<uint8_t> emitted(triangle_count, 0);
+	std::vector<uint32_t> dead_end;
+	std::vector<uint32_t> candidates;
+
+	uint32_t time = cache_size + 1;
+	uint32_t cursor = 0;
+	size_t output = 0;
+
+	clusters.push_back(0);
+	uint32_t fanning = indices[0];
+	while (fanning != no_vertex)
+	{
+		// Every live triangle around the fanning vertex
+		candidates.clear();
+		for (uint32_t a = adjacent.offsets[fanning]; a < adjacent.offsets[fanning + 1]; ++a)
+		{
+			uint32_t t = adjacent.triangles[a];
+			if (emitted[t])
+				continue;
+			emitted[t] = 1;
+
+			for (int c = 0; c < 3; ++c)
+			{
+				uint32_t v = indices[t * 3 + c];
+				destination[output++] = v;
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				--live_triangles[v];
+				if (time - cache_time[v] > cache_size)
+					cache_time[v] = time++;
+			}
+		}
+
+		// The candidate entered in the cache first among those that stay in it while their live triangles are emitted
+		// (two new vertices each at most), any candidate with live triangles otherwise
+		uint32_t next = no_vertex;
+		uint32_t best_priority = 0;
+		for (uint32_t v : candidates)
+		{
+			if (live_triangles[v] == 0)
+				continue;
+
+			uint32_t priority = 0;
+			if (time - cache_time[v] + 2 * live_triangles[v] <= cache_size)
+				priority = time - cache_time[v];
+			if (next == no_vertex || priority > best_priority)
+			{
+				next = v;
+				best_priority = priority;
+			}
+		}
+
+		if (next == no_vertex)
+		{
+			next = skip_dead_end(dead_end, live_triangles, cursor);
+			if (next != no_vertex)
+				clusters.push_back((uint32_t)(output / 3));
+		}
+		fanning = next;
+	}
+}
+
+void optimize_overdraw(uint32_t* destination, const uint32_t* indices, size_t index_count, const float* positions, uint32_t vertex_count, const std::vector<uint32_t>& clusters, float threshold, uint32_t cache_size)
+{
+	uint32_t triangle_count = (uint32_t)(index_count / 3);
+	if (triangle_count == 0)
+		return;
+
+	// Soft boundaries : each cluster is cut as soon as its first triangles reach its ACMR, give or take the threshold
+	std::vector<uint32_t> splits;
+	fifo_cache cache(vertex_count, cache_size);
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		uint32_t begin = clusters[c];
+		uint32_t end = c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+
+		cache.flush();
+		uint32_t cluster_misses = 0;
+		for (uint32_t t = begin; t < end; ++t)
+			cluster_misses += cache.access(indices + t * 3);
+		float cluster_threshold = threshold * (float)cluster_misses / (float)(end - begin);
+
+		cache.flush();
+		splits.push_back(begin);
+		uint32_t misses = 0;
+		uint32_t start = begin;
+		for (uint32_t t = begin; t + 1 < end; ++t)
+		{
+			misses += cache.access(indices + t * 3);
+			if ((float)misses <= cluster_threshold * (float)(t + 1 - start))
+			{
+				splits.push_back(t + 1);
+				start = t + 1;
+				misses = 0;
+				cache.flush();
+			}
+		}
+	}
+
+	// Clusters facing away from the mesh's center occlude the others : drawn first
+	uint32_t split_count = (uint32_t)splits.size();
+	std::vector<glm::vec3> centroids(split_count, glm::vec3(0.0f));
+	std::vector<glm::vec3> normals(split_count, glm::vec3(0.0f));
+	glm::vec3 mesh_centroid(0.0f);
+	for (uint32_t s = 0; s < split_count; ++s)
+	{
+		uint32_t end = s + 1 < split_count ? splits[s + 1] : triangle_count;
+		for (uint32_t t = splits[s]; t < end; ++t)
+		{
+			const float* p0 = positions + indices[t * 3 + 0] * 3;
+			const float* p1 = positions + indices[t * 3 + 1] * 3;
+			const float* p2 = positions + indices[t * 3 + 2] * 3;
+			glm::vec3 v0(p0[0], p0[1], p0[2]);
+			glm::vec3 v1(p1[0], p1[1], p1[2]);
+			glm::vec3 v2(p2[0], p2[1], p2[2]);
+			centroids[s] += v0 + v1 + v2;
+			// Area weighted
+			normals[s] += glm::cross(v1 - v0, v2 - v0);
+		}
+		mesh_centroid += centroids[s];
+		centroids[s] /= (float)((end - splits[s]) * 3);
+	}
+	mesh_centroid /= (float)(triangle_count * 3);
+
+	std::vector<float> keys(split_count, 0.0f);
+	for (uint32_t s = 0; s < split_count; ++s)
+	{
+		float length = glm::length(normals[s]);
+		if (length > 0.0f)
+			keys[s] = glm::dot(centroids[s] - mesh_centroid, normals[s] / length);
+	}
+
+	std::vector<uint32_t> order(split_count);
+	for (uint32_t s = 0; s < split_count; ++s)
+		order[s] = s;
+	std::stable_sort(order.begin(), order.end(), [&keys](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+	size_t output = 0;
+	for (uint32_t s : order)
+	{
+		uint32_t end = s + 1 < split_count ? splits[s + 1] : triangle_count;
+		for (uint32_t i = splits[s] * 3; i < end * 3; ++i)
+			destination[output++] = indices[i];
+	}
+}
+
+void optimize_vertex_fetch(uint32_t* indices, size_t index_count, uint32_t vertex_count, std::vector<uint32_t>& remap)
+{
+	remap.assign(vertex_count, no_vertex);
+	uint32_t next = 0;
+	for (size_t i = 0; i < index_count; ++i)
+	{
+		uint32_t& v = remap[indices[i]];
+		if (v == no_vertex)
+			v = next++;
+		indices[i] = v;
+	}
+	for (uint32_t& v : remap)
+	{
+		if (v == no_vertex)
+			v = next++;
+	}
+}
+
+mesh_optimization optimize_mesh(std::vector<uint32_t>& indices, const float* positions, uint32_t vertex_count, std::vector<uint32_t>& remap)
+{
+	mesh_optimization result;
+	result.before = analyze_vertex_cache(indices.data(), indices.size(), vertex_count);
+
+	std::vector<uint32_t> cache_order(indices.size());
+	std::vector<uint32_t> clusters;
+	optimize_vertex_cache(cache_order.data(), indices.data(), indices.size(), vertex_count, clusters);
+	optimize_overdraw(indices.data(), cache_order.data(), cache_order.size(), positions, vertex_count, clusters);
+	optimize_vertex_fetch(indices.data(), indices.size(), vertex_count, remap);
+
+	result.after = analyze_vertex_cache(indices.data(), indices.size(), vertex_count);
+	return result;
+}
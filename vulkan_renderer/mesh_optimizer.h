@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+Load time reordering of indexed triangle lists, run by model::import_model before the conversion (optimize_mesh) :
+
+	optimize_vertex_cache	Tipsify (Sander, Nehab, Barczak 2007) : triangles fanned around the vertices still in a
+							FIFO post transform cache, in linear time.
+	optimize_overdraw		Tipsify's clusters, split further while they keep their cache efficiency, then sorted
+							outward facing first so they occlude the rest of the mesh.
+	optimize_vertex_fetch	vertices renumbered in the order the triangles first use them.
+
+Both cache statistics assume a FIFO cache of vertex_cache_size entries. ACMR : vertices transformed per triangle
+(0.5 at best on large regular meshes, 3 at worst). ATVR : vertices transformed per vertex (1 at best).
+*/
+
+const uint32_t vertex_cache_size = 16;
+
+struct vertex_cache_statistics
+{
+	float acmr;
+	float atvr;
+};
+
+vertex_cache_statistics analyze_vertex_cache(const uint32_t* indices, size_t index_count, uint32_t vertex_count, uint32_t cache_size = vertex_cache_size);
+
+// destination and indices must not overlap. The first triangle of every cluster (where Tipsify reached a dead end)
+// is written to clusters, 0 first.
+void optimize_vertex_cache(uint32_t* destination, const uint32_t* indices, size_t index_count, uint32_t vertex_count, std::vector<uint32_t>& clusters, uint32_t cache_size = vertex_cache_size);
+
+// positions : 3 floats per vertex. A cluster is split where its ACMR so far drops under threshold times the ACMR of
+// the whole cluster : 1 keeps the hard boundaries only, higher values trade vertex cache hits for less overdraw.
+void optimize_overdraw(uint32_t* destination, const uint32_t* indices, size_t index_count, const float* positions, uint32_t vertex_count, const std::vector<uint32_t>& clusters, float threshold = 1.05f, uint32_t cache_size = vertex_cache_size);
+
+// Rewrites the indices in place. Vertex k moves to remap[k], unused vertices go last in their original order.
+void optimize_vertex_fetch(uint32_t* indices, size_t index_count, uint32_t vertex_count, std::vector<uint32_t>& remap);
+
+struct mesh_optimization
+{
+	vertex_cache_statistics before;
+	vertex_cache_statistics after;
+};
+
+// optimize_vertex_cache, optimize_overdraw then optimize_vertex_fetch on indices, rewritten in place
+mesh_optimization optimize_mesh(std::vector<uint32_t>& indices, const float* positions, uint32_t vertex_count, std::vector<uint32_t>& remap);
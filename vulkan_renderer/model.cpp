@@ -5,15 +5,123 @@
 #include "renderer.h"
 #include "pipeline.h"
 #include "camera.h"
+#include "mesh_optimizer.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>           // Output data structure
 #include <assimp/postprocess.h>     // Post processing flags
 
+#include <thread/parallel.h>
 
-model::model(const std::string& filepath, renderer& renderer, float scale) : _renderer(renderer)
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <xmmintrin.h>
+
+namespace
+{
+	// Vertices or faces [begin, end) of one mesh
+	struct conversion_job
+	{
+		uint32_t mesh;
+		uint32_t begin;
+		uint32_t end;
+		bool faces;
+	};
+	const uint32_t conversion_job_size = 16 * 1024;
+
+	// Bounding box of the positions added, 4 wide
+	class bounds
+	{
+	public:
+		bounds() : _min(_mm_set1_ps(FLT_MAX)), _max(_mm_set1_ps(-FLT_MAX)) {}
+
+		void add(__m128 position)
+		{
+			_min = _mm_min_ps(_min, position);
+			_max = _mm_max_ps(_max, position);
+		}
+		void add(const bounds& other)
+		{
+			_min = _mm_min_ps(_min, other._min);
+			_max = _mm_max_ps(_max, other._max);
+		}
+
+		glm::vec3 minimum() const { return to_vec3(_min); }
+		glm::vec3 maximum() const { return to_vec3(_max); }
+
+	private:
+		static glm::vec3 to_vec3(__m128 value)
+		{
+			float xyzw[4];
+			_mm_storeu_ps(xyzw, value);
+			return glm::vec3(xyzw[0], xyzw[1], xyzw[2]);
+		}
+
+		__m128 _min;
+		__m128 _max;
+	};
+
+	// Faces [begin, end) of a triangulated mesh, from its optimized indices when there are
+	template<typename Index>
+	void copy_faces(const aiMesh& source, const uint32_t* optimized, uint32_t begin, uint32_t end, Index* out)
+	{
+		if (optimized)
+		{
+			for (uint32_t i = begin * 3; i < end * 3; ++i)
+				out[i] = (Index)optimized[i];
+			return;
+		}
+		for (uint32_t k = begin; k < end; ++k)
+		{
+			const aiFace& face = source.mFaces[k];
+			out[k * 3 + 0] = (Index)face.mIndices[0];
+			out[k * 3 + 1] = (Index)face.mIndices[1];
+			out[k * 3 + 2] = (Index)face.mIndices[2];
+		}
+	}
+
+	// Unit vector to [-1, 1]^2 : the upper hemisphere projected on the xy diamond, the lower one folded over its corners
+	glm::vec2 octahedral_encode(const glm::vec3& v)
+	{
+		float length = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+		if (length == 0.0f)
+			return glm::vec2(0.0f, 0.0f);
+
+		glm::vec3 n = v / length;
+		if (n.z >= 0.0f)
+			return glm::vec2(n.x, n.y);
+		return glm::vec2((1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+	}
+
+	// Degenerate UVs leave zero (or NaN) tangents : any unit vector orthogonal to the normal then
+	glm::vec3 unit_tangent(const glm::vec3& tangent, const glm::vec3& normal)
+	{
+		float length = glm::length(tangent);
+		if (std::isfinite(length) && length > 1e-6f)
+			return tangent / length;
+
+		glm::vec3 axis = std::abs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+		glm::vec3 orthogonal = glm::cross(normal, axis);
+		float orthogonal_length = glm::length(orthogonal);
+		return orthogonal_length > 0.0f ? orthogonal / orthogonal_length : glm::vec3(1.0f, 0.0f, 0.0f);
+	}
+
+	uint16_t unorm16(float value)
+	{
+		return (uint16_t)std::lround(glm::clamp(value, 0.0f, 1.0f) * 65535.0f);
+	}
+
+	int16_t snorm16(float value)
+	{
+		return (int16_t)std::lround(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+	}
+}
+
+
+model::model(const std::string& filepath, renderer& renderer, float scale, const load_options& options) : _renderer(renderer)
 {
-	load_model(filepath, scale);
+	load_model(filepath, scale, options);
 }
 
 model::~model()
@@ -35,7 +143,32 @@ void model::update(double dt)
 	device.unmapMemory(_memory);
 }
 
-void model::load_model(const std::string& filepath, float scale)
+void model::load_model(const std::string& filepath, float scale, const load_options& options)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	auto model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.0f));
+	_uniform_object.model_matrix = model;
+
+	_format = options.format;
+
+	std::unique_ptr<mesh_cache> cache;
+	if (options.use_mesh_cache)
+		cache = mesh_cache::open(filepath, scale, (uint32_t)_format, vertex_stride(_format));
+	if (cache && options.optimize_meshes && !cache->info().optimized)
+		cache.reset();
+
+	if (cache)
+		load_from_cache(*cache);
+	else
+		import_model(filepath, scale, options.use_mesh_cache, options.optimize_meshes, options.tasker);
+
+	std::sort(_meshes.begin(), _meshes.end(), [](const mesh& m1, const mesh& m2) { return m1.material_index < m2.material_index; });
+
+	_report.load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void model::import_model(const std::string& filepath, float scale, bool write_cache, bool optimize, kth::Multitasker* tasker)
 {
 	Assimp::Importer importer;
 
@@ -45,13 +178,9 @@ void model::load_model(const std::string& filepath, float scale)
 	if (!scene)
 		throw renderer_exception("Cannot load mesh from file : " + filepath);
 
-	auto model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 0.0f));
-	_uniform_object.model_matrix = model;
-
-	std::vector<vertex> vertices;
-	std::vector<uint32_t> indices;
-
-	std::vector<int32_t> material_assoc(scene->mNumMaterials, -1);
+	// Embedded textures only live in the Assimp scene : such models are always imported
+	if (scene->mNumTextures > 0)
+		write_cache = false;
 
 	for (uint32_t i = 0; i < scene->mNumTextures; ++i)
 	{
@@ -61,6 +190,13 @@ void model::load_model(const std::string& filepath, float scale)
 			_renderer.tex_manager().create_texture_from_rgba_buffer(filepath + "*" + std::to_string(i), scene->mTextures[i]->pcData, scene->mTextures[i]->mWidth, scene->mTextures[i]->mHeight);
 	}
 
+	const uint32_t stride = vertex_stride(_format);
+
+	mesh_cache::contents contents;
+	contents.vertex_stride = stride;
+	contents.vertex_format = (uint32_t)_format;
+	contents.optimized = optimize;
+
 	for (uint32_t i = 0; i < scene->mNumMaterials; ++i)
 	{
 		aiMaterial* mat = scene->mMaterials[i];
@@ -68,152 +204,340 @@ void model::load_model(const std::string& filepath, float scale)
 		aiString spec_path;
 		aiString normal_path;
 
-		int success = 3;
-
-		material_assoc[i] = _materials.size();
-
-		_materials.emplace_back();
-
-		auto& material = _materials.back();
-		material.mat_info.normal_map_intensity = -1.0f;
-		material.mat_info.specular_intensity = -1.0f;
+		mesh_cache::material material = {};
+		material.normal_map_intensity = -1.0f;
+		material.specular_intensity = -1.0f;
 
 		if (mat->GetTexture(aiTextureType_DIFFUSE, 0, &diffuse_path) == AI_SUCCESS)
 		{
 			const char* path = diffuse_path.C_Str();
-			material.diffuse_texture = _renderer.tex_manager().create_texture_from_file(path[0] == '*' ? filepath + path : path);
-			material.mat_info.diffuse_color.a = 1.0f;
+			material.diffuse_path = contents.add_string(path[0] == '*' ? filepath + path : path);
+			material.diffuse_color.a = 1.0f;
 		}
 		else
 		{
-			material.diffuse_texture = _renderer.tex_manager().create_texture_from_file("missing_texture.png");
-			material.mat_info.diffuse_color.a = -1.0f;
+			material.diffuse_path = contents.add_string("missing_texture.png");
+			material.diffuse_color.a = -1.0f;
 		}
 		if (mat->GetTexture(aiTextureType_NORMALS, 0, &normal_path) == AI_SUCCESS)
 		{
 			const char* path = normal_path.C_Str();
-			material.normal_texture = _renderer.tex_manager().create_texture_from_file(path[0] == '*' ? filepath + path : path);
-			material.mat_info.normal_map_intensity = 1.0f;
+			material.normal_path = contents.add_string(path[0] == '*' ? filepath + path : path);
+			material.normal_map_intensity = 1.0f;
 		}
 		else
 		{
-			material.normal_texture = _renderer.tex_manager().create_texture_from_file("missing_texture.png");
+			material.normal_path = contents.add_string("missing_texture.png");
 		}
 		if (mat->GetTexture(aiTextureType_SPECULAR, 0, &spec_path) == AI_SUCCESS)
 		{
 			const char* path = spec_path.C_Str();
-			material.specular_texture = _renderer.tex_manager().create_texture_from_file(path[0] == '*' ? filepath + path : path);
-			mat->Get(AI_MATKEY_SHININESS, material.mat_info.specular_intensity);
+			material.specular_path = contents.add_string(path[0] == '*' ? filepath + path : path);
+			mat->Get(AI_MATKEY_SHININESS, material.specular_intensity);
 		}
 		else
 		{
-			material.specular_texture = _renderer.tex_manager().create_texture_from_file("missing_texture.png");
+			material.specular_path = contents.add_string("missing_texture.png");
 		}
 
 		aiColor3D color(1.0f,1.0f,1.0f);
 		if(mat->Get(AI_MATKEY_COLOR_AMBIENT, color) == AI_SUCCESS)
 		{
-			material.mat_info.ambient_color.r = color.r;
-			material.mat_info.ambient_color.g = color.g;
-			material.mat_info.ambient_color.b = color.b;
+			material.ambient_color.r = color.r;
+			material.ambient_color.g = color.g;
+			material.ambient_color.b = color.b;
 		}
 		
 		color = { 1.0f, 1.0f, 1.0f };
 		if (mat->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS)
 		{
-			material.mat_info.diffuse_color.r = color.r;
-			material.mat_info.diffuse_color.g = color.g;
-			material.mat_info.diffuse_color.b = color.b;
+			material.diffuse_color.r = color.r;
+			material.diffuse_color.g = color.g;
+			material.diffuse_color.b = color.b;
 		}
 
 		color = { 1.0f, 1.0f, 1.0f };
 		if (mat->Get(AI_MATKEY_COLOR_SPECULAR, color) == AI_SUCCESS)
 		{
-			material.mat_info.specular_color.r = color.r;
-			material.mat_info.specular_color.g = color.g;
-			material.mat_info.specular_color.b = color.b;
-			material.mat_info.specular_color.a = 1.0f;
+			material.specular_color.r = color.r;
+			material.specular_color.g = color.g;
+			material.specular_color.b = color.b;
+			material.specular_color.a = 1.0f;
 		}
 
+		contents.materials.push_back(material);
+		add_material(material, contents.strings.c_str());
 	}
 	
 
+	// First pass : every mesh's place in the final blobs, the conversion then never reallocates
+	std::vector<const aiMesh*> sources;
+	uint64_t index_bytes = 0;
+	uint64_t vertex_count = 0;
 	for (uint32_t i = 0; i < scene->mNumMeshes; ++i)
 	{
-		aiMesh* i_mesh = scene->mMeshes[i];
+		const aiMesh* i_mesh = scene->mMeshes[i];
 		
 		if ((i_mesh->mPrimitiveTypes & aiPrimitiveType_TRIANGLE) == 0) continue;
 
+		mesh_cache::mesh record = {};
+		record.index_size = i_mesh->mNumVertices <= 65536 ? sizeof(uint16_t) : sizeof(uint32_t);
+		// bindIndexBuffer offsets must be a multiple of the index size
+		record.index_offset = (index_bytes + record.index_size - 1) & ~uint64_t(record.index_size - 1);
+		record.vertex_offset = vertex_count * stride;
+		record.index_count = i_mesh->mNumFaces * 3;
+		record.vertex_count = i_mesh->mNumVertices;
+		record.material_index = i_mesh->mMaterialIndex;
+		contents.meshes.push_back(record);
+		sources.push_back(i_mesh);
+
+		index_bytes = record.index_offset + (uint64_t)record.index_count * record.index_size;
+		vertex_count += record.vertex_count;
+	}
 
-		const float fmax = std::numeric_limits<float>::max();
-		const float fmin = std::numeric_limits<float>::min();
+	contents.index_bytes = index_bytes;
+	contents.vertex_bytes = vertex_count * stride;
+	vk::DeviceSize vertex_blob_offset = mesh_cache::vertex_blob_offset(contents.index_bytes);
+	vk::DeviceSize geometry_size = vertex_blob_offset + contents.vertex_bytes;
+
+	// Converted straight into the mapped buffer, or into a copy of its layout when the cache is written from it too
+	// (reading back host visible memory can be uncached)
+	char* mapped = create_buffer(geometry_size);
+	std::unique_ptr<char[]> staging;
+	if (write_cache)
+		staging.reset(new char[geometry_size]);
+	char* geometry = write_cache ? staging.get() : mapped;
+	char* indices = geometry;
+	char* vertices = geometry + vertex_blob_offset;
+
+	// Second pass : meshes split in jobs small enough to balance a scene of one big mesh
+	std::vector<conversion_job> jobs;
+	for (uint32_t m = 0; m < (uint32_t)sources.size(); ++m)
+	{
+		for (uint32_t begin = 0; begin < sources[m]->mNumVertices; begin += conversion_job_size)
+			jobs.push_back({ m, begin, std::min(begin + conversion_job_size, sources[m]->mNumVertices), false });
+		for (uint32_t begin = 0; begin < sources[m]->mNumFaces; begin += conversion_job_size)
+			jobs.push_back({ m, begin, std::min(begin + conversion_job_size, sources[m]->mNumFaces), true });
+	}
 
-		std::pair<glm::vec3, glm::vec3> bbox(glm::vec3(fmax, fmax, fmax), glm::vec3(fmin, fmin, fmin));
-		
-		uint32_t current_mesh_vertex_offset = vertices.size();
-		for (uint32_t k = 0; k < i_mesh->mNumVertices; ++k)
+	auto run_jobs = [&](uint32_t count, auto&& run)
+	{
+		if (tasker)
+		{
+			kth::parallel_for(*tasker, 0, count, run, 1);
+		}
+		else
 		{
-			vertex vert;
-			memcpy(&vert.position, &i_mesh->mVertices[k], sizeof(glm::vec3));
-			vert.position *= scale;
+			for (uint32_t j = 0; j < count; ++j)
+				run(j);
+		}
+	};
+
+	// Whole meshes : the conversion then writes the faces in their optimized order and each vertex where its remap sends it
+	std::vector<std::vector<uint32_t>> optimized_indices(contents.meshes.size());
+	std::vector<std::vector<uint32_t>> remaps(contents.meshes.size());
+	if (optimize)
+	{
+		static_assert(sizeof(aiVector3D) == 3 * sizeof(float), "aiVector3D is not 3 floats");
 
-			bbox.first = glm::min(vert.position, bbox.first);
-			bbox.second = glm::max(vert.position, bbox.second);
+		run_jobs((uint32_t)contents.meshes.size(), [&](uint32_t m)
+		{
+			const aiMesh* source = sources[m];
+			mesh_cache::mesh& record = contents.meshes[m];
+
+			std::vector<uint32_t>& optimized = optimized_indices[m];
+			optimized.resize(record.index_count);
+			copy_faces(*source, nullptr, 0, source->mNumFaces, optimized.data());
+			mesh_optimization statistics = optimize_mesh(optimized, reinterpret_cast<const float*>(source->mVertices), record.vertex_count, remaps[m]);
+
+			record.acmr_before = statistics.before.acmr;
+			record.atvr_before = statistics.before.atvr;
+			record.acmr_after = statistics.after.acmr;
+			record.atvr_after = statistics.after.atvr;
+		});
+	}
 
-			memcpy(&vert.normal, &i_mesh->mNormals[k], sizeof(glm::vec3));
-			memcpy(&vert.tangent, &i_mesh->mTangents[k], sizeof(glm::vec3));
-			memcpy(&vert.uv, &i_mesh->mTextureCoords[0][k], sizeof(glm::vec2));
-			vertices.push_back(vert);
+	// Bounds first : packed positions are quantized in them
+	std::vector<bounds> job_bounds(jobs.size());
+	run_jobs((uint32_t)jobs.size(), [&](uint32_t job_index)
+	{
+		const conversion_job& job = jobs[job_index];
+		if (job.faces)
+			return;
+
+		const aiMesh* source = sources[job.mesh];
+		bounds job_bbox;
+		const __m128 scale4 = _mm_set1_ps(scale);
+		for (uint32_t k = job.begin; k < job.end; ++k)
+		{
+			const aiVector3D& position = source->mVertices[k];
+			job_bbox.add(_mm_mul_ps(_mm_setr_ps(position.x, position.y, position.z, 0.0f), scale4));
 		}
+		job_bounds[job_index] = job_bbox;
+	});
+
+	std::vector<bounds> mesh_bounds(contents.meshes.size());
+	for (uint32_t j = 0; j < (uint32_t)jobs.size(); ++j)
+	{
+		if (!jobs[j].faces)
+			mesh_bounds[jobs[j].mesh].add(job_bounds[j]);
+	}
+	std::vector<dequantization> quantizations(contents.meshes.size());
+	for (uint32_t m = 0; m < (uint32_t)contents.meshes.size(); ++m)
+	{
+		mesh_cache::mesh& record = contents.meshes[m];
+		record.bbox_min = mesh_bounds[m].minimum();
+		record.bbox_max = mesh_bounds[m].maximum();
+		record.bounding_sphere = glm::vec4((record.bbox_min + record.bbox_max)*0.5f, glm::distance(record.bbox_min, record.bbox_max)/2);
+		quantizations[m] = bounding_box_dequantization(record.bbox_min, record.bbox_max);
+	}
+
+	run_jobs((uint32_t)jobs.size(), [&](uint32_t job_index)
+	{
+		const conversion_job& job = jobs[job_index];
+		const aiMesh* source = sources[job.mesh];
+		const mesh_cache::mesh& record = contents.meshes[job.mesh];
 
-		uint32_t current_mesh_index_offset = indices.size();
-		for (uint32_t k = 0; k < i_mesh->mNumFaces; ++k)
+		if (job.faces)
 		{
-			indices.push_back(i_mesh->mFaces[k].mIndices[0]);
-			indices.push_back(i_mesh->mFaces[k].mIndices[1]);
-			indices.push_back(i_mesh->mFaces[k].mIndices[2]);
-
-			/* 
-			// Manual calc of tangents
-			vertex& v0 = vertices[current_mesh_vertex_offset + i_mesh->mFaces[k].mIndices[0]];
-			vertex& v1 = vertices[current_mesh_vertex_offset + i_mesh->mFaces[k].mIndices[1]];
-			vertex& v2 = vertices[current_mesh_vertex_offset + i_mesh->mFaces[k].mIndices[2]];
-			glm::vec3 edge_1 = v1.position - v0.position;
-			glm::vec3 edge_2 = v2.position - v0.position;
-
-			float delta_u1 = v1.uv.x - v0.uv.x;
-			float delta_v1 = v1.uv.y - v0.uv.y;
-			float delta_u2 = v2.uv.x - v0.uv.x;
-			float delta_v2 = v2.uv.y - v0.uv.y;
-
-			float f = 1.0f / (delta_u1*delta_v2 - delta_u2*delta_v1);
-
-			glm::vec3 tangent;
-			tangent.x = f*(delta_v2*edge_1.x - delta_v1*edge_2.x);
-			tangent.y = f*(delta_v2*edge_1.y - delta_v1*edge_2.y);
-			tangent.z = f*(delta_v2*edge_1.z - delta_v1*edge_2.z);
-
-			v0.tangent += tangent;
-			v1.tangent += tangent;
-			v2.tangent += tangent;
-			*/
+			const uint32_t* optimized = optimize ? optimized_indices[job.mesh].data() : nullptr;
+			if (record.index_size == sizeof(uint16_t))
+				copy_faces(*source, optimized, job.begin, job.end, reinterpret_cast<uint16_t*>(indices + record.index_offset));
+			else
+				copy_faces(*source, optimized, job.begin, job.end, reinterpret_cast<uint32_t*>(indices + record.index_offset));
+			return;
+		}
 
+		char* out = vertices + record.vertex_offset;
+		const glm::vec3 quantization_offset(quantizations[job.mesh].offset);
+		const glm::vec3 quantization_factor = 1.0f / glm::vec3(quantizations[job.mesh].scale);
+		const uint32_t* remap = optimize ? remaps[job.mesh].data() : nullptr;
+		for (uint32_t k = job.begin; k < job.end; ++k)
+		{
+			size_t target = remap ? remap[k] : k;
+			glm::vec3 position;
+			glm::vec3 normal;
+			glm::vec3 tangent(1.0f, 0.0f, 0.0f);
+			glm::vec2 uv(0.0f, 0.0f);
+			memcpy(&position, &source->mVertices[k], sizeof(glm::vec3));
+			position *= scale;
+			memcpy(&normal, &source->mNormals[k], sizeof(glm::vec3));
+			if (source->HasTangentsAndBitangents())
+			{
+				memcpy(&tangent, &source->mTangents[k], sizeof(glm::vec3));
+				tangent = unit_tangent(tangent, normal);
+			}
+			if (source->HasTextureCoords(0))
+				memcpy(&uv, &source->mTextureCoords[0][k], sizeof(glm::vec2));
+
+			if (_format == vertex_format::full)
+			{
+				vertex vert{ position, normal, tangent, uv };
+				memcpy(out + target * sizeof(vertex), &vert, sizeof(vertex));
+				continue;
+			}
+
+			glm::vec3 unit_position = (position - quantization_offset) * quantization_factor;
+			glm::vec2 octahedral_normal = octahedral_encode(normal);
+			glm::vec2 octahedral_tangent = octahedral_encode(tangent);
+			uint32_t half_uv = glm::packHalf2x16(uv);
+
+			packed_vertex vert;
+			vert.position[0] = unorm16(unit_position.x);
+			vert.position[1] = unorm16(unit_position.y);
+			vert.position[2] = unorm16(unit_position.z);
+			vert.position[3] = 0;
+			vert.normal_tangent[0] = snorm16(octahedral_normal.x);
+			vert.normal_tangent[1] = snorm16(octahedral_normal.y);
+			vert.normal_tangent[2] = snorm16(octahedral_tangent.x);
+			vert.normal_tangent[3] = snorm16(octahedral_tangent.y);
+			vert.uv[0] = (uint16_t)(half_uv & 0xFFFF);
+			vert.uv[1] = (uint16_t)(half_uv >> 16);
+			memcpy(out + target * sizeof(packed_vertex), &vert, sizeof(packed_vertex));
 		}
-		
-		std::pair<glm::vec3, float> bsphere((bbox.first + bbox.second)*0.5f, glm::distance(bbox.first, bbox.second)/2 );
-		_meshes.emplace_back(current_mesh_vertex_offset*sizeof(vertex), current_mesh_index_offset*sizeof(uint32_t), i_mesh->mNumFaces * 3, material_assoc[i_mesh->mMaterialIndex], bsphere, bbox);
+	});
+
+	for (const mesh_cache::mesh& record : contents.meshes)
+	{
+		add_mesh(record, vertex_blob_offset);
+		if (optimize)
+			_report.vertex_cache.push_back({ record.index_count / 3, record.acmr_before, record.atvr_before, record.acmr_after, record.atvr_after });
 	}
 
-	for (auto& vert : vertices)
+	contents.index_data = geometry;
+	contents.vertex_data = geometry + vertex_blob_offset;
+
+	if (write_cache)
+		memcpy(mapped, geometry, geometry_size);
+	finish_buffer(mapped);
+
+	_report.from_cache = false;
+	_report.index_bytes = contents.index_bytes;
+	_report.vertex_bytes = contents.vertex_bytes;
+	_report.vertex_count = vertex_count;
+	_report.vertex_stride = stride;
+
+	if (write_cache && !mesh_cache::write(filepath, scale, contents))
+		printf("Cannot write the mesh cache of %s\n", filepath.c_str());
+}
+
+void model::load_from_cache(const mesh_cache& cache)
+{
+	const mesh_cache::header& header = cache.info();
+
+	for (uint32_t i = 0; i < header.material_count; ++i)
+		add_material(cache.materials()[i], cache.string(0));
+
+	vk::DeviceSize vertex_blob_offset = mesh_cache::vertex_blob_offset(header.index_bytes);
+	for (uint32_t i = 0; i < header.mesh_count; ++i)
 	{
-		vert.tangent = glm::normalize(vert.tangent);
+		const mesh_cache::mesh& record = cache.meshes()[i];
+		add_mesh(record, vertex_blob_offset);
+		if (header.optimized)
+			_report.vertex_cache.push_back({ record.index_count / 3, record.acmr_before, record.atvr_before, record.acmr_after, record.atvr_after });
 	}
 
+	// Straight from the mapped file to the mapped buffer
+	char* dst = create_buffer(cache.geometry_size());
+	memcpy(dst, cache.geometry(), cache.geometry_size());
+	finish_buffer(dst);
+
+	_report.from_cache = true;
+	_report.index_bytes = header.index_bytes;
+	_report.vertex_bytes = header.vertex_bytes;
+	_report.vertex_count = header.vertex_bytes / header.vertex_stride;
+	_report.vertex_stride = header.vertex_stride;
+}
+
+void model::add_material(const mesh_cache::material& record, const char* strings)
+{
+	_materials.emplace_back();
+
+	auto& material = _materials.back();
+	material.diffuse_texture = _renderer.tex_manager().create_texture_from_file(strings + record.diffuse_path);
+	material.normal_texture = _renderer.tex_manager().create_texture_from_file(strings + record.normal_path);
+	material.specular_texture = _renderer.tex_manager().create_texture_from_file(strings + record.specular_path);
+
+	material.mat_info.ambient_color = record.ambient_color;
+	material.mat_info.diffuse_color = record.diffuse_color;
+	material.mat_info.specular_color = record.specular_color;
+	material.mat_info.specular_intensity = record.specular_intensity;
+	material.mat_info.normal_map_intensity = record.normal_map_intensity;
+}
+
+void model::add_mesh(const mesh_cache::mesh& record, vk::DeviceSize vertex_blob_offset)
+{
+	std::pair<glm::vec3, float> bsphere(glm::vec3(record.bounding_sphere), record.bounding_sphere.w);
+	std::pair<glm::vec3, glm::vec3> bbox(record.bbox_min, record.bbox_max);
+	vk::IndexType index_type = record.index_size == sizeof(uint16_t) ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+	_meshes.emplace_back(vertex_blob_offset + record.vertex_offset, record.index_offset, record.index_count, index_type, record.material_index, bsphere, bbox);
+}
+
+char* model::create_buffer(vk::DeviceSize geometry_size)
+{
 	vk::Device device = _renderer.device();
 	
-	vk::DeviceSize size = vertices.size()*sizeof(vertex) + indices.size()*sizeof(uint32_t);
-	
-	size = _renderer.ubo_aligned_size(size);
+	vk::DeviceSize size = _renderer.ubo_aligned_size(geometry_size);
 	
 	_uniform_buffer_offset = size;
 	
@@ -227,38 +551,40 @@ void model::load_model(const std::string& filepath, float scale)
 	vk::MemoryAllocateInfo mem_allocate_info{ _memory_reqs.size(), _renderer.find_adequate_memory(_memory_reqs, vk::MemoryPropertyFlagBits::eHostVisible) };
 	_memory = device.allocateMemory(mem_allocate_info);
 
+	return (char*)device.mapMemory(_memory, 0, _memory_reqs.size(), {});
+}
 
-	char* dst = (char*)device.mapMemory(_memory, 0, _memory_reqs.size(), {});
-
-	
-	
-	uint32_t index_count = indices.size();
-	uint32_t vertex_buffer_global_offset = index_count*sizeof(uint32_t);
-
-	for (auto& m : _meshes)
-		m.vertex_buffer_offset += vertex_buffer_global_offset;
+void model::finish_buffer(char* mapped)
+{
+	vk::Device device = _renderer.device();
 
-	// Indices
-	memcpy(dst, indices.data(), index_count*sizeof(uint32_t));
-	// Vertices
-	memcpy(dst + vertex_buffer_global_offset, vertices.data(), vertices.size()*sizeof(vertex));
 	// Uniform
-	memcpy(dst + _uniform_buffer_offset, &_uniform_object, sizeof(uniform_object));
+	memcpy(mapped + _uniform_buffer_offset, &_uniform_object, sizeof(uniform_object));
 
 	device.unmapMemory(_memory);
 
 	device.bindBufferMemory(_buffer, _memory, 0);
-
-	std::sort(_meshes.begin(), _meshes.end(), [](const mesh& m1, const mesh& m2) { return m1.material_index < m2.material_index; });
 }
 
-vk::VertexInputBindingDescription model::binding_description(uint32_t bind_id)
+vk::VertexInputBindingDescription model::binding_description(uint32_t bind_id, vertex_format format)
 {
-	return { bind_id, sizeof(vertex), vk::VertexInputRate::eVertex };
+	return { bind_id, vertex_stride(format), vk::VertexInputRate::eVertex };
 }
 
-std::vector<vk::VertexInputAttributeDescription> model::attribute_descriptions(uint32_t bind_id)
+std::vector<vk::VertexInputAttributeDescription> model::attribute_descriptions(uint32_t bind_id, vertex_format format)
 {
+	if (format == vertex_format::packed)
+	{
+		return {
+			// Position, w is padding
+			vk::VertexInputAttributeDescription{ 0, bind_id, vk::Format::eR16G16B16A16Unorm, offsetof(packed_vertex, position) },
+			// Octahedral normal and tangent
+			vk::VertexInputAttributeDescription{ 1, bind_id, vk::Format::eR16G16B16A16Snorm, offsetof(packed_vertex, normal_tangent) },
+			// UV
+			vk::VertexInputAttributeDescription{ 2, bind_id, vk::Format::eR16G16Sfloat, offsetof(packed_vertex, uv) }
+		};
+	}
+
 	std::vector<vk::VertexInputAttributeDescription> attribute_description = {
 		// Position
 		vk::VertexInputAttributeDescription{ 0, bind_id, vk::Format::eR32G32B32Sfloat, offsetof(vertex, position) },
@@ -272,6 +598,24 @@ std::vector<vk::VertexInputAttributeDescription> model::attribute_descriptions(u
 	return attribute_description;
 }
 
+vk::PushConstantRange model::dequantization_push_constant_range()
+{
+	static_assert(dequantization_offset >= sizeof(material::info), "dequantization overlaps the material push constant");
+	return { vk::ShaderStageFlagBits::eVertex, dequantization_offset, sizeof(dequantization) };
+}
+
+model::dequantization model::bounding_box_dequantization(const glm::vec3& bbox_min, const glm::vec3& bbox_max)
+{
+	// Flat boxes keep a non zero scale, their vertices all quantize to 0 on that axis
+	glm::vec3 extent = bbox_max - bbox_min;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (!(extent[axis] > 0.0f))
+			extent[axis] = 1.0f;
+	}
+	return { glm::vec4(bbox_min, 0.0f), glm::vec4(extent, 0.0f) };
+}
+
 void model::draw(const vk::CommandBuffer& cmd, pipeline& pipeline, const camera& camera, uint32_t bind_id) const
 {
 	int last_m_index = -1;
@@ -287,8 +631,11 @@ void model::draw(const vk::CommandBuffer& cmd, pipeline& pipeline, const camera&
 			last_m_index = m.material_index;
 		}
 
+		if (_format == vertex_format::packed)
+			cmd.pushConstant(pipeline.pipeline_layout(), vk::ShaderStageFlagBits::eVertex, dequantization_offset, m.position_dequantization);
+
 		cmd.bindVertexBuffer(bind_id, _buffer, m.vertex_buffer_offset);
-		cmd.bindIndexBuffer(_buffer, m.index_buffer_offset, vk::IndexType::eUint32);
+		cmd.bindIndexBuffer(_buffer, m.index_buffer_offset, m.index_type);
 		cmd.drawIndexed(m.index_count, 1, 0, 0, 0);
 	}
 }
@@ -3,10 +3,16 @@
 #include "math_include.h"
 #include "texture.h"
 #include "ubo.h"
+#include "mesh_cache.h"
 
 #include <memory>
 #include <chrono>
 
+namespace kth
+{
+	class Multitasker;
+}
+
 class camera;
 class pipeline;
 class renderer;
@@ -15,12 +21,65 @@ class managed_descriptor_set;
 class model
 {
 public:
-	explicit model(const std::string& filepath, renderer& renderer, float scale = 1.0f);
+	// full : 44 bytes of floats. packed : 20 bytes, positions quantized in the mesh's bounding box (dequantized by
+	// vert_packed.spv from a vertex stage push constant), octahedral normal and tangent, half float uv.
+	enum class vertex_format : uint32_t
+	{
+		full,
+		packed
+	};
+
+	struct load_options
+	{
+		load_options(bool use_mesh_cache = true, kth::Multitasker* tasker = nullptr, vertex_format format = vertex_format::full, bool optimize_meshes = false)
+			: use_mesh_cache(use_mesh_cache), tasker(tasker), format(format), optimize_meshes(optimize_meshes) {}
+
+		// Loads from the source's mesh cache when it is up to date, writes it after an import otherwise
+		bool use_mesh_cache;
+		// Converts the meshes of an import in parallel, serially if null. Waits on the calling fiber.
+		kth::Multitasker* tasker;
+		// The pipeline drawing the model must be created for the same format
+		vertex_format format;
+		// Reorders each mesh's triangles for the vertex cache then for overdraw, and its vertices in their order of use
+		// (mesh_optimizer.h). A cache written without it is imported again.
+		bool optimize_meshes;
+	};
+
+	struct load_report
+	{
+		double load_ms = 0.0;
+		bool from_cache = false;
+		uint64_t vertex_bytes = 0;
+		uint64_t index_bytes = 0;
+		uint64_t vertex_count = 0;
+		uint32_t vertex_stride = 0;
+
+		struct mesh_vertex_cache
+		{
+			uint32_t triangle_count;
+			float acmr_before;
+			float atvr_before;
+			float acmr_after;
+			float atvr_after;
+		};
+		// In file order, empty when the meshes were not optimized
+		std::vector<mesh_vertex_cache> vertex_cache;
+
+		// Against the same vertices in the full format
+		uint64_t vertex_bytes_saved() const { return vertex_count * sizeof(vertex) - vertex_bytes; }
+	};
+
+	explicit model(const std::string& filepath, renderer& renderer, float scale = 1.0f, const load_options& options = load_options());
 	~model();
 
-	static vk::VertexInputBindingDescription binding_description(uint32_t bind_id);
-	static std::vector<vk::VertexInputAttributeDescription> attribute_descriptions(uint32_t bind_id = 0);
-	static uint32_t vertex_stride() { return sizeof(vertex); }
+	const load_report& report() const { return _report; }
+
+	static vk::VertexInputBindingDescription binding_description(uint32_t bind_id, vertex_format format = vertex_format::full);
+	static std::vector<vk::VertexInputAttributeDescription> attribute_descriptions(uint32_t bind_id = 0, vertex_format format = vertex_format::full);
+	static uint32_t vertex_stride(vertex_format format = vertex_format::full) { return format == vertex_format::packed ? sizeof(packed_vertex) : sizeof(vertex); }
+	static const char* vertex_shader(vertex_format format) { return format == vertex_format::packed ? "vert_packed.spv" : "vert.spv"; }
+	// Vertex stage range of the packed format's dequantization, after the fragment stage's material::info
+	static vk::PushConstantRange dequantization_push_constant_range();
 
 	vk::DescriptorBufferInfo descriptor_buffer_info() const { return vk::DescriptorBufferInfo{ _buffer, _uniform_buffer_offset, sizeof(uniform_object) }; }
 
@@ -56,9 +115,27 @@ private:
 	};
 	static_assert(sizeof(vertex) == 11 * sizeof(float), "vertex is not packed");
 
-	
+	struct packed_vertex
+	{
+		// xyz : unorm in the mesh's bounding box. w : padding, 0. No handedness : shader.frag derives the bitangent
+		// from the normal and tangent for both formats.
+		uint16_t position[4];
+		// Octahedral normal xy then octahedral tangent xy, snorm
+		int16_t normal_tangent[4];
+		// Half floats
+		uint16_t uv[2];
+	};
+	static_assert(sizeof(packed_vertex) == 20, "packed_vertex is not packed");
+
+	// position = offset + unorm position * scale
+	struct dequantization
+	{
+		glm::vec4 offset;
+		glm::vec4 scale;
+	};
+	static const uint32_t dequantization_offset = 64;
+	static dequantization bounding_box_dequantization(const glm::vec3& bbox_min, const glm::vec3& bbox_max);
 
-	
 
 	std::vector<material> _materials;
 
@@ -67,22 +144,28 @@ private:
 	public:
 		
 
-		mesh(vk::DeviceSize vertex_buffer_offset, vk::DeviceSize index_buffer_offset, vk::DeviceSize index_count, uint32_t material_index, const std::pair<glm::vec3, float>& bounding_sphere, const std::pair<glm::vec3, glm::vec3>& bounding_box)
+		mesh(vk::DeviceSize vertex_buffer_offset, vk::DeviceSize index_buffer_offset, vk::DeviceSize index_count, vk::IndexType index_type, uint32_t material_index, const std::pair<glm::vec3, float>& bounding_sphere, const std::pair<glm::vec3, glm::vec3>& bounding_box)
 			: vertex_buffer_offset(vertex_buffer_offset),
 			  index_buffer_offset(index_buffer_offset),
 			  index_count(index_count),
+			  index_type(index_type),
 			  material_index(material_index),
 			  bounding_sphere(bounding_sphere),
-			  bounding_box(bounding_box)
+			  bounding_box(bounding_box),
+			  position_dequantization(bounding_box_dequantization(bounding_box.first, bounding_box.second))
 		{
 		}
 		vk::DeviceSize vertex_buffer_offset;
 		vk::DeviceSize index_buffer_offset;
 		vk::DeviceSize index_count;
+		// 16 bits when the mesh has at most 65536 vertices
+		vk::IndexType index_type;
 		uint32_t material_index;
 
 		std::pair<glm::vec3, float> bounding_sphere;
 		std::pair<glm::vec3, glm::vec3> bounding_box;
+		// Only read for packed vertices
+		dequantization position_dequantization;
 	};
 
 	struct uniform_object
@@ -91,7 +174,14 @@ private:
 	} _uniform_object;
 
 
-	void load_model(const std::string& filepath, float scale = 1.0f);
+	void load_model(const std::string& filepath, float scale, const load_options& options);
+	void import_model(const std::string& filepath, float scale, bool write_cache, bool optimize, kth::Multitasker* tasker);
+	void load_from_cache(const mesh_cache& cache);
+	void add_material(const mesh_cache::material& material, const char* strings);
+	void add_mesh(const mesh_cache::mesh& mesh, vk::DeviceSize vertex_blob_offset);
+	// The geometry goes first in the buffer, then the uniform object. Returns the mapped geometry, unmapped by finish_buffer.
+	char* create_buffer(vk::DeviceSize geometry_size);
+	void finish_buffer(char* mapped);
 
 	std::vector<mesh> _meshes;
 
@@ -101,5 +191,8 @@ private:
 
 	vk::DeviceSize _uniform_buffer_offset;
 
+	vertex_format _format;
+	load_report _report;
+
 	renderer& _renderer;
 };
@@ -9,8 +9,8 @@
 
 pipeline::pipeline(renderer& renderer, vk::RenderPass render_pass, const description& description) : _renderer(renderer), _render_pass(render_pass)
 {
-	vk::ShaderModule vertex_shader_module = _renderer.load_shader("vert.spv");
-	vk::ShaderModule fragment_shader_module = _renderer.load_shader("frag.spv");
+	vk::ShaderModule vertex_shader_module = _renderer.load_shader(description.vertex_shader);
+	vk::ShaderModule fragment_shader_module = _renderer.load_shader(description.fragment_shader);
 
 	std::vector<vk::PipelineShaderStageCreateInfo> shader_stages_ci{
 		vk::PipelineShaderStageCreateInfo{ {}, vk::ShaderStageFlagBits::eVertex, vertex_shader_module, "main", nullptr },
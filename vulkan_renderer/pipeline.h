@@ -3,6 +3,7 @@
 #include "texture.h"
 
 #include <memory>
+#include <string>
 
 class renderer;
 class managed_descriptor_set;
@@ -21,6 +22,9 @@ public:
 		std::vector<uint32_t> descriptor_sets_pool_sizes;
 		vk::SampleCountFlagBits samples;
 		std::vector<vk::PushConstantRange> push_constants;
+		// SPIR-V files
+		std::string vertex_shader = "vert.spv";
+		std::string fragment_shader = "frag.spv";
 	};
 
 	pipeline(renderer& renderer, vk::RenderPass render_pass, const description& description);
@@ -0,0 +1,50 @@
+#version 450
+
+// model::packed_vertex, position.w is padding
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec4 normal_tangent;
+layout(location = 2) in vec2 uv;
+
+
+layout(set = 0, binding = 0) uniform UBO_view
+{
+	mat4 mat;
+} ubo_view;
+
+layout(set = 1, binding = 0) uniform UBO_model
+{
+	mat4 mat;
+} ubo_model;
+
+// model::dequantization, after the fragment stage's material (member offsets need GLSL 440)
+layout(push_constant) uniform mesh_dequantization
+{
+	layout(offset = 64) vec4 offset;
+	vec4 scale;
+} dequantization;
+
+layout (location = 0) out vec2 out_uv;
+layout (location = 1) out vec3 out_normal;
+layout (location = 2) out vec3 out_frag_pos;
+layout (location = 3) out vec3 out_tangent;
+
+vec3 octahedral_decode(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
+void main() 
+{
+	vec3 normal = octahedral_decode(normal_tangent.xy);
+	vec3 tangent = octahedral_decode(normal_tangent.zw);
+
+	out_uv = uv;
+	out_normal = (ubo_model.mat * vec4(normal, 0.0)).xyz;
+	out_tangent = (ubo_model.mat * vec4(tangent, 0.0)).xyz;
+	vec4 world_pos = ubo_model.mat * vec4(dequantization.offset.xyz + position.xyz * dequantization.scale.xyz, 1.0);
+	out_frag_pos = vec3(world_pos);
+	gl_Position = ubo_view.mat * world_pos;
+}
@@ -0,0 +1,302 @@
+#include <tests/test.h>
+#include <thread/fiber_sync.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Two workers : while the main fiber polls instead of waiting, worker 1 alone runs the tasks, so the fibers a primitive
+resumes run in the order it resumed them.
+*/
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const uint32_t worker_count = 2;
+
+	template<typename Condition>
+	bool poll(const Condition& condition)
+	{
+		Clock::time_point give_up = Clock::now() + std::chrono::seconds(5);
+		while (!condition())
+		{
+			if (Clock::now() > give_up)
+				return false;
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		return true;
+	}
+
+	TASK_FUNC(busy_task)
+	{
+		volatile int sum = 0;
+		for (int i = 0; i < 1000; ++i)
+			sum = sum + i;
+	}
+
+	void wait_and_release(kth::Multitasker& tasker, kth::CounterHandle counter)
+	{
+		tasker.wait_for(counter, 0);
+		kth::Multitasker::release_counter(counter);
+	}
+
+	// Holders park inside the critical section (a wait on other tasks) : the next tasks contend
+	void test_mutex_exclusion(kth::Multitasker& tasker)
+	{
+		const int task_count = 512;
+		kth::fiber_mutex mutex(tasker, "exclusion");
+		std::atomic<bool> inside(false);
+		std::atomic<int> overlaps(0);
+		int count = 0;
+
+		kth::CounterHandle counter = kth::Multitasker::acquire_counter(0);
+		for (int i = 0; i < task_count; ++i)
+		{
+			tasker.enqueue([&, i]
+			{
+				mutex.lock();
+				if (inside.exchange(true))
+					++overlaps;
+				if (i % 8 == 0)
+				{
+					// Low priority : the worker runs queued contenders first
+					static int args[4];
+					wait_and_release(tasker, tasker.enqueue(busy_task, args, 4, kth::TaskDesc(kth::TaskPriority::low)));
+				}
+				++count;
+				inside = false;
+				mutex.unlock();
+			}, counter);
+		}
+		wait_and_release(tasker, counter);
+
+		CHECK(overlaps.load() == 0);
+		CHECK(count == task_count);
+		kth::SyncStats stats = mutex.stats();
+		CHECK(stats.acquisitions == (uint64_t)task_count);
+		CHECK(stats.contentions > 0);
+		CHECK(stats.contentions <= (uint64_t)task_count);
+	}
+
+	// The main fiber holds the mutex while the contenders queue one by one : unlock hands it over in arrival order
+	void test_mutex_order(kth::Multitasker& tasker)
+	{
+		const uint32_t contender_count = 16;
+		kth::fiber_mutex mutex(tasker, "order");
+		std::vector<uint32_t> order;
+
+		mutex.lock();
+		kth::CounterHandle counter = kth::Multitasker::acquire_counter(0);
+		for (uint32_t i = 0; i < contender_count; ++i)
+		{
+			tasker.enqueue([&, i]
+			{
+				std::lock_guard<kth::fiber_mutex> lock(mutex);
+				order.push_back(i);
+			}, counter);
+			CHECK(poll([&] { return mutex.stats().peak_waiters == i + 1; }));
+		}
+		CHECK(order.empty());
+		CHECK(mutex.stats().contentions == contender_count);
+		mutex.unlock();
+		wait_and_release(tasker, counter);
+
+		CHECK(order.size() == contender_count);
+		for (uint32_t i = 0; i < order.size(); ++i)
+			CHECK(order[i] == i);
+		CHECK(mutex.stats().acquisitions == contender_count + 1);
+	}
+
+	// A holder waiting on other tasks keeps its worker running them : with more contenders than workers, a mutex that
+	// blocked its thread would leave nobody to run the holder's tasks
+	void test_holder_keeps_worker(kth::Multitasker& tasker)
+	{
+		const int contender_count = 8;
+		kth::fiber_mutex mutex(tasker, "holder");
+		std::atomic<int> acquired(0);
+		std::atomic<int> acquired_while_held(-1);
+		std::atomic<int> subtasks_run(0);
+
+		kth::CounterHandle holder = tasker.enqueue([&]
+		{
+			mutex.lock();
+			kth::CounterHandle contenders = kth::Multitasker::acquire_counter(0);
+			for (int i = 0; i < contender_count; ++i)
+			{
+				tasker.enqueue([&]
+				{
+					mutex.lock();
+					++acquired;
+					mutex.unlock();
+				}, contenders);
+			}
+
+			kth::CounterHandle subtasks = kth::Multitasker::acquire_counter(0);
+			for (int i = 0; i < 32; ++i)
+				tasker.enqueue([&] { ++subtasks_run; }, subtasks);
+			wait_and_release(tasker, subtasks);
+
+			acquired_while_held = acquired.load();
+			mutex.unlock();
+			wait_and_release(tasker, contenders);
+		});
+		wait_and_release(tasker, holder);
+
+		CHECK(subtasks_run.load() == 32);
+		CHECK(acquired_while_held.load() == 0);
+		CHECK(acquired.load() == contender_count);
+	}
+
+	void test_semaphore_units(kth::Multitasker& tasker)
+	{
+		const uint32_t unit_count = 3;
+		const int task_count = 256;
+		kth::fiber_semaphore semaphore(tasker, unit_count, "units");
+		std::atomic<uint32_t> holders(0);
+		std::atomic<uint32_t> peak_holders(0);
+
+		kth::CounterHandle counter = kth::Multitasker::acquire_counter(0);
+		for (int i = 0; i < task_count; ++i)
+		{
+			tasker.enqueue([&]
+			{
+				semaphore.acquire();
+				uint32_t now = ++holders;
+				uint32_t peak = peak_holders.load();
+				while (now > peak && !peak_holders.compare_exchange_weak(peak, now)) {}
+				// Low priority : the worker runs queued contenders first
+				static int args[4];
+				wait_and_release(tasker, tasker.enqueue(busy_task, args, 4, kth::TaskDesc(kth::TaskPriority::low)));
+				--holders;
+				semaphore.release();
+			}, counter);
+		}
+		wait_and_release(tasker, counter);
+
+		CHECK(peak_holders.load() <= unit_count);
+		CHECK(peak_holders.load() > 1);
+		kth::SyncStats stats = semaphore.stats();
+		CHECK(stats.acquisitions == (uint64_t)task_count);
+		CHECK(stats.contentions > 0);
+
+		// All units are back
+		for (uint32_t i = 0; i < unit_count; ++i)
+			CHECK(semaphore.try_acquire());
+		CHECK(!semaphore.try_acquire());
+		semaphore.release(unit_count);
+	}
+
+	// A batch release hands its units to the oldest waiters and resumes them in arrival order, the rest is counted
+	void test_semaphore_order(kth::Multitasker& tasker)
+	{
+		const uint32_t waiter_count = 12;
+		kth::fiber_semaphore semaphore(tasker, 0, "fifo");
+		std::vector<uint32_t> order;
+		std::atomic<uint32_t> resumed(0);
+
+		kth::CounterHandle counter = kth::Multitasker::acquire_counter(0);
+		for (uint32_t i = 0; i < waiter_count; ++i)
+		{
+			tasker.enqueue([&, i]
+			{
+				semaphore.acquire();
+				order.push_back(i);
+				++resumed;
+			}, counter);
+			CHECK(poll([&] { return semaphore.stats().peak_waiters == i + 1; }));
+		}
+
+		semaphore.release(waiter_count / 2);
+		CHECK(poll([&] { return resumed.load() == waiter_count / 2; }));
+		CHECK(order.size() == waiter_count / 2);
+		for (uint32_t i = 0; i < order.size(); ++i)
+			CHECK(order[i] == i);
+
+		semaphore.release(waiter_count / 2 + 2);
+		CHECK(poll([&] { return resumed.load() == waiter_count; }));
+		for (uint32_t i = 0; i < order.size(); ++i)
+			CHECK(order[i] == i);
+		wait_and_release(tasker, counter);
+
+		CHECK(semaphore.try_acquire());
+		CHECK(semaphore.try_acquire());
+		CHECK(!semaphore.try_acquire());
+		kth::SyncStats stats = semaphore.stats();
+		CHECK(stats.acquisitions == waiter_count + 2);
+		CHECK(stats.contentions == waiter_count);
+		CHECK(stats.peak_waiters == waiter_count);
+	}
+
+	// Participants check every other one arrived before they left each phase
+	void test_barrier_phases(kth::Multitasker& tasker)
+	{
+		const uint32_t participant_count = 3;
+		const uint32_t round_count = 200;
+		kth::fiber_barrier barrier(tasker, participant_count, "phases");
+		std::vector<std::atomic<uint32_t>> arrivals(round_count);
+		for (auto& arrival : arrivals)
+			arrival = 0;
+		std::atomic<int> early_departures(0);
+		std::atomic<int> wrong_phases(0);
+
+		kth::CounterHandle counter = kth::Multitasker::acquire_counter(0);
+		for (uint32_t p = 0; p < participant_count; ++p)
+		{
+			tasker.enqueue([&]
+			{
+				for (uint32_t round = 0; round < round_count; ++round)
+				{
+					++arrivals[round];
+					barrier.arrive_and_wait();
+					if (arrivals[round].load() != participant_count)
+						++early_departures;
+					if (barrier.phase() != round + 1)
+						++wrong_phases;
+				}
+			}, counter);
+		}
+		wait_and_release(tasker, counter);
+
+		CHECK(early_departures.load() == 0);
+		CHECK(wrong_phases.load() == 0);
+		CHECK(barrier.phase() == round_count);
+		kth::SyncStats stats = barrier.stats();
+		CHECK(stats.acquisitions == (uint64_t)participant_count * round_count);
+		CHECK(stats.contentions > 0);
+		CHECK(stats.contentions <= (uint64_t)(participant_count - 1) * round_count);
+	}
+
+	void test_named_stats(kth::Multitasker& tasker)
+	{
+		kth::fiber_mutex named(tasker, "named");
+		kth::fiber_mutex unnamed(tasker);
+		int found = 0;
+		for (const kth::SyncStats& stats : kth::sync_stats())
+		{
+			if (stats.name && std::string(stats.name) == "named")
+				++found;
+		}
+		CHECK(found == 1);
+	}
+}
+
+int main()
+{
+	kth::Multitasker tasker(worker_count, kth::FiberPoolDesc(), [](uint32_t) {});
+
+	test_mutex_exclusion(tasker);
+	test_mutex_order(tasker);
+	test_holder_keeps_worker(tasker);
+	test_semaphore_units(tasker);
+	test_semaphore_order(tasker);
+	test_barrier_phases(tasker);
+	test_named_stats(tasker);
+
+	tasker.stop();
+	TEST_EXIT();
+}
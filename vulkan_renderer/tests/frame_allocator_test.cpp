@@ -0,0 +1,80 @@
+#include <tests/test.h>
+#include <thread/frame_allocator.h>
+
+#include <stdexcept>
+
+namespace
+{
+	const uint32_t worker_count = 4;
+
+	kth::FrameAllocator* frame_allocator;
+
+	TASK_FUNC(allocating_task)
+	{
+		uint32_t count = 16 + bundle_index % 64;
+		uint32_t* values = frame_allocator->allocate_array<uint32_t>(count);
+		CHECK(((uintptr_t)values & (alignof(uint32_t) - 1)) == 0);
+		for (uint32_t i = 0; i < count; ++i)
+			values[i] = bundle_index;
+
+		void* line = frame_allocator->allocate(24, 64);
+		CHECK(((uintptr_t)line & 63) == 0);
+
+		volatile int sum = 0;
+		for (int i = 0; i < 200; ++i)
+			sum = sum + i;
+
+		// Nobody else wrote over them meanwhile
+		for (uint32_t i = 0; i < count; ++i)
+			CHECK(values[i] == bundle_index);
+	}
+}
+
+int main()
+{
+	kth::Multitasker tasker(worker_count, kth::FiberPoolDesc(), [](uint32_t) {});
+	kth::FrameAllocator allocator(tasker, 2, 16 * 1024, 64 * 1024);
+	frame_allocator = &allocator;
+
+	// Two frames in flight : frame n ends once frame n + 1 was enqueued
+	static int args[4096];
+	kth::CounterHandle previous;
+	uint32_t previous_frame = 0;
+	for (int f = 0; f < 300; ++f)
+	{
+		uint32_t frame = allocator.begin_frame();
+		// Some frames overflow the worker arenas
+		kth::CounterHandle counter = tasker.enqueue(allocating_task, args, f % 50 == 0 ? 4096 : 512);
+		if (previous)
+		{
+			tasker.wait_for(previous, 0, true);
+			kth::Multitasker::release_counter(previous);
+			allocator.end_frame(previous_frame);
+		}
+		previous = counter;
+		previous_frame = frame;
+	}
+	tasker.wait_for(previous, 0, true);
+	kth::Multitasker::release_counter(previous);
+	allocator.end_frame(previous_frame);
+
+	kth::FrameAllocatorStats stats = allocator.stats();
+	CHECK(stats.worker_high_water > 0 && stats.worker_high_water <= stats.worker_arena_size);
+	CHECK(stats.overflow_high_water > 0);
+
+	allocator.begin_frame();
+	allocator.begin_frame();
+	bool threw = false;
+	try
+	{
+		allocator.begin_frame();
+	}
+	catch (std::logic_error&)
+	{
+		threw = true;
+	}
+	CHECK(threw);
+
+	tasker.stop();
+	TEST_EXIT();
+}
@@ -0,0 +1,113 @@
+#include <tests/test.h>
+#include <thread/io_service.h>
+
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <string>
+
+namespace
+{
+	const uint32_t worker_count = 4;
+	const uint32_t file_count = 200;
+
+	kth::Multitasker* multitasker;
+	kth::IoService* io_service;
+	// A fresh directory in the test's working directory (the build directory under CTest), removed at the end
+	std::string data_directory;
+
+	std::string file_path(uint32_t file)
+	{
+		return data_directory + "/" + std::to_string(file);
+	}
+
+	size_t file_size(uint32_t file)
+	{
+		return (size_t)(file * 977) % 300000;
+	}
+
+	char byte_at(uint32_t file, size_t offset)
+	{
+		return (char)((offset * 31 + file) & 0xff);
+	}
+
+	bool write_files()
+	{
+		char directory[] = "io_service_test_XXXXXX";
+		if (!mkdtemp(directory)) return false;
+		data_directory = directory;
+		for (uint32_t file = 0; file < file_count; ++file)
+		{
+			FILE* output = std::fopen(file_path(file).c_str(), "wb");
+			for (size_t offset = 0; offset < file_size(file); ++offset)
+				std::fputc(byte_at(file, offset), output);
+			std::fclose(output);
+		}
+		return true;
+	}
+
+	void remove_files()
+	{
+		for (uint32_t file = 0; file < file_count; ++file)
+			std::remove(file_path(file).c_str());
+		rmdir(data_directory.c_str());
+	}
+
+	TASK_FUNC(reading_task)
+	{
+		uint32_t file = bundle_index;
+
+		kth::IoRead whole;
+		kth::CounterHandle counter = io_service->read_file(file_path(file), whole);
+		multitasker->wait_for(counter, 0);
+		kth::Multitasker::release_counter(counter);
+		CHECK(whole.error == 0);
+		CHECK(whole.data.size() == file_size(file));
+		for (size_t offset = 0; offset < whole.data.size(); offset += 97)
+			CHECK(whole.data[offset] == byte_at(file, offset));
+
+		// Past the end is a short read
+		kth::IoRead part;
+		counter = io_service->read(file_path(file), 10, 100, part);
+		multitasker->wait_for(counter, 0);
+		kth::Multitasker::release_counter(counter);
+		CHECK(part.error == 0);
+		CHECK(part.data.size() == (file_size(file) > 10 ? std::min<size_t>(100, file_size(file) - 10) : 0));
+		for (size_t offset = 0; offset < part.data.size(); ++offset)
+			CHECK(part.data[offset] == byte_at(file, offset + 10));
+	}
+}
+
+int main()
+{
+	bool written = write_files();
+	CHECK(written);
+	if (!written) TEST_EXIT();
+
+	kth::Multitasker tasker(worker_count, kth::FiberPoolDesc(), [](uint32_t) {});
+	multitasker = &tasker;
+	{
+		// A small ring : part of the reads go to the fallback threads
+		kth::IoService service(tasker, 8, 2);
+		io_service = &service;
+
+		static int args[file_count];
+		kth::CounterHandle counter = tasker.enqueue(reading_task, args, (int)file_count);
+		tasker.wait_for(counter, 0, true);
+		kth::Multitasker::release_counter(counter);
+
+		kth::IoRead missing;
+		counter = service.read_file(data_directory + "/missing", missing);
+		tasker.wait_for(counter, 0, true);
+		kth::Multitasker::release_counter(counter);
+		CHECK(missing.error == ENOENT);
+
+		kth::IoStats stats = service.stats();
+		CHECK(stats.uring_reads + stats.fallback_reads == 2 * file_count + 1);
+	}
+
+	tasker.stop();
+	remove_files();
+	TEST_EXIT();
+}
@@ -0,0 +1,128 @@
+#include <tests/test.h>
+#include "mesh_cache.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+	// In the test's working directory (the build directory under CTest)
+	const char* source_path = "mesh_cache_test_data/source.obj";
+
+	void write_source(const char* contents)
+	{
+		mkdir("mesh_cache_test_data", 0755);
+		std::ofstream file(source_path, std::ios::binary | std::ios::trunc);
+		file << contents;
+	}
+
+	// One mesh of 6 indices and 6 vertices, every vertex float set to value
+	bool write_cache(float scale, uint32_t vertex_format, uint32_t vertex_stride, float value)
+	{
+		std::vector<uint32_t> indices = { 0, 1, 2, 2, 1, 5 };
+		std::vector<float> vertices(6 * vertex_stride / sizeof(float), value);
+
+		mesh_cache::contents contents;
+		contents.vertex_stride = vertex_stride;
+		contents.vertex_format = vertex_format;
+
+		mesh_cache::mesh mesh = {};
+		mesh.index_count = 6;
+		mesh.vertex_count = 6;
+		mesh.index_size = sizeof(uint32_t);
+		contents.meshes.push_back(mesh);
+
+		mesh_cache::material material = {};
+		material.diffuse_path = contents.add_string("diffuse.png");
+		material.normal_path = contents.add_string("missing_texture.png");
+		material.specular_path = material.diffuse_path;
+		contents.materials.push_back(material);
+
+		contents.index_data = indices.data();
+		contents.index_bytes = indices.size() * sizeof(uint32_t);
+		contents.vertex_data = vertices.data();
+		contents.vertex_bytes = vertices.size() * sizeof(float);
+		return mesh_cache::write(source_path, scale, contents);
+	}
+
+	void remove_files()
+	{
+		std::remove(mesh_cache::cache_path(source_path, 3.0f, 0).c_str());
+		std::remove(mesh_cache::cache_path(source_path, 1.0f, 0).c_str());
+		std::remove(mesh_cache::cache_path(source_path, 3.0f, 1).c_str());
+		std::remove(source_path);
+	}
+
+	float first_vertex_float(const mesh_cache& cache)
+	{
+		const char* vertices = cache.geometry() + mesh_cache::vertex_blob_offset(cache.info().index_bytes);
+		return *reinterpret_cast<const float*>(vertices);
+	}
+}
+
+int main()
+{
+	remove_files();
+	write_source("v 1 2 3\n");
+
+	CHECK(mesh_cache::cache_path(source_path, 3.0f, 0) != mesh_cache::cache_path(source_path, 1.0f, 0));
+	CHECK(mesh_cache::cache_path(source_path, 3.0f, 0) != mesh_cache::cache_path(source_path, 3.0f, 1));
+
+	// The same source loaded at two scales and in two formats : every cache survives the others
+	CHECK(write_cache(3.0f, 0, 44, 3.0f));
+	CHECK(write_cache(1.0f, 0, 44, 1.0f));
+	CHECK(write_cache(3.0f, 1, 20, 5.0f));
+
+	std::unique_ptr<mesh_cache> large = mesh_cache::open(source_path, 3.0f, 0, 44);
+	std::unique_ptr<mesh_cache> small = mesh_cache::open(source_path, 1.0f, 0, 44);
+	std::unique_ptr<mesh_cache> packed = mesh_cache::open(source_path, 3.0f, 1, 20);
+	CHECK(large && first_vertex_float(*large) == 3.0f);
+	CHECK(small && first_vertex_float(*small) == 1.0f);
+	CHECK(packed && first_vertex_float(*packed) == 5.0f);
+	if (large)
+	{
+		CHECK(large->info().mesh_count == 1 && large->info().material_count == 1);
+		CHECK(std::string(large->string(large->materials()[0].normal_path)) == "missing_texture.png");
+	}
+	large.reset();
+	small.reset();
+	packed.reset();
+
+	CHECK(!mesh_cache::open(source_path, 2.0f, 0, 44));
+	CHECK(!mesh_cache::open(source_path, 3.0f, 0, 48));
+
+	// Same content, another mtime (a checkout) : accepted on its hash, and the new mtime is stored in the cache
+	struct utimbuf times = { 1000000000, 1000000000 };
+	CHECK(utime(source_path, &times) == 0);
+	large = mesh_cache::open(source_path, 3.0f, 0, 44);
+	CHECK(large && first_vertex_float(*large) == 3.0f);
+	CHECK(large && large->info().source.mtime == 1000000000);
+	large.reset();
+	large = mesh_cache::open(source_path, 3.0f, 0, 44);
+	CHECK(large && large->info().source.mtime == 1000000000);
+	large.reset();
+	// The other caches of the source are refreshed when they are opened
+	small = mesh_cache::open(source_path, 1.0f, 0, 44);
+	CHECK(small && small->info().source.mtime == 1000000000);
+	small.reset();
+
+	// Size and mtime first : a different size, mtime may not have ticked yet
+	write_source("v 1 2 30\n");
+	CHECK(!mesh_cache::open(source_path, 3.0f, 0, 44));
+
+	// Same size, another mtime and content : rejected on its hash, again on the next open
+	CHECK(write_cache(3.0f, 0, 44, 3.0f));
+	write_source("v 1 2 40\n");
+	times.modtime = 2000000000;
+	CHECK(utime(source_path, &times) == 0);
+	CHECK(!mesh_cache::open(source_path, 3.0f, 0, 44));
+	CHECK(!mesh_cache::open(source_path, 3.0f, 0, 44));
+
+	remove_files();
+	rmdir("mesh_cache_test_data");
+	TEST_EXIT();
+}
@@ -0,0 +1,101 @@
+#include <tests/test.h>
+#include "mesh_optimizer.h"
+#include <thread/parallel.h>
+
+#include <algorithm>
+#include <array>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const uint32_t worker_count = 4;
+
+	struct grid_mesh
+	{
+		std::vector<uint32_t> indices;
+		std::vector<float> positions;
+		uint32_t vertex_count;
+	};
+
+	// size x size quads, triangles in row order : the file order of a typical export
+	grid_mesh make_grid(uint32_t size)
+	{
+		grid_mesh mesh;
+		mesh.vertex_count = (size + 1) * (size + 1);
+		for (uint32_t y = 0; y <= size; ++y)
+		{
+			for (uint32_t x = 0; x <= size; ++x)
+			{
+				mesh.positions.push_back((float)x);
+				mesh.positions.push_back((float)y);
+				mesh.positions.push_back((float)((x * 7 + y * 3) % 5));
+			}
+		}
+		for (uint32_t y = 0; y < size; ++y)
+		{
+			for (uint32_t x = 0; x < size; ++x)
+			{
+				uint32_t v = y * (size + 1) + x;
+				mesh.indices.insert(mesh.indices.end(), { v, v + 1, v + size + 1, v + 1, v + size + 2, v + size + 1 });
+			}
+		}
+		return mesh;
+	}
+
+	std::vector<std::array<uint32_t, 3>> sorted_triangles(const std::vector<uint32_t>& indices)
+	{
+		std::vector<std::array<uint32_t, 3>> triangles;
+		for (size_t i = 0; i < indices.size(); i += 3)
+			triangles.push_back({ { indices[i], indices[i + 1], indices[i + 2] } });
+		std::sort(triangles.begin(), triangles.end());
+		return triangles;
+	}
+
+	// As model::import_model with load_options::optimize_meshes : one job per mesh, from the main fiber
+	void test_optimize_on_main_fiber(kth::Multitasker& tasker)
+	{
+		const std::thread::id main_thread = std::this_thread::get_id();
+
+		for (int round = 0; round < 10; ++round)
+		{
+			std::vector<grid_mesh> meshes;
+			for (uint32_t m = 0; m < 24; ++m)
+				meshes.push_back(make_grid(8 + (m * 13 + round) % 40));
+			std::vector<std::vector<uint32_t>> optimized(meshes.size());
+			std::vector<std::vector<uint32_t>> remaps(meshes.size());
+			std::vector<mesh_optimization> statistics(meshes.size());
+
+			kth::parallel_for(tasker, 0, (uint32_t)meshes.size(), [&](uint32_t m)
+			{
+				optimized[m] = meshes[m].indices;
+				statistics[m] = optimize_mesh(optimized[m], meshes[m].positions.data(), meshes[m].vertex_count, remaps[m]);
+			}, 1);
+			CHECK(std::this_thread::get_id() == main_thread);
+			CHECK(kth::Multitasker::get_current_thread_id() == 0);
+
+			for (size_t m = 0; m < meshes.size(); ++m)
+			{
+				// The same triangles once the vertices are renumbered back
+				std::vector<uint32_t> original(meshes[m].vertex_count);
+				for (uint32_t v = 0; v < meshes[m].vertex_count; ++v)
+					original[remaps[m][v]] = v;
+				std::vector<uint32_t> restored = optimized[m];
+				for (uint32_t& index : restored)
+					index = original[index];
+				CHECK(sorted_triangles(restored) == sorted_triangles(meshes[m].indices));
+				CHECK(statistics[m].after.acmr <= statistics[m].before.acmr);
+			}
+		}
+	}
+}
+
+int main()
+{
+	kth::Multitasker tasker(worker_count, kth::FiberPoolDesc(), [](uint32_t) {});
+
+	test_optimize_on_main_fiber(tasker);
+
+	tasker.stop();
+	TEST_EXIT();
+}
@@ -0,0 +1,16 @@
+#include <thread/benchmark.h>
+
+#include <cstdlib>
+
+// multitasker_benchmark [max_workers] [iteration_scale] : prints the results, writes them as JSON and CSV in the
+// working directory. Same as RUN_MULTITASKER_BENCHMARKS in the renderer.
+int main(int argc, char** argv)
+{
+	kth::BenchmarkOptions options;
+	if (argc > 1)
+		options.max_workers = (uint32_t)std::atoi(argv[1]);
+	if (argc > 2)
+		options.iteration_scale = std::atof(argv[2]);
+
+	kth::run_multitasker_benchmarks_and_exit(options);
+}
@@ -0,0 +1,256 @@
+#include <tests/test.h>
+#include <thread/parallel.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const uint32_t worker_count = 4;
+
+	TASK_FUNC(busy_task)
+	{
+		volatile int sum = 0;
+		for (int i = 0; i < 2000; ++i)
+			sum = sum + i;
+	}
+
+	// Deterministic values with repeats and negatives
+	std::vector<int32_t> make_values(uint32_t count, uint32_t seed)
+	{
+		std::vector<int32_t> values(count);
+		uint32_t state = seed * 2654435761u + 1;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			state = state * 1664525u + 1013904223u;
+			values[i] = (int32_t)(state >> 8) % 5000 - 2500;
+		}
+		return values;
+	}
+
+	// Sizes around the edges : empty, one element, under and over the radix threshold (4096)
+	const uint32_t sizes[] = { 0, 1, 2, 100, 4095, 4096, 4097, 100000 };
+
+	void test_reduce(kth::Multitasker& tasker)
+	{
+		for (uint32_t size : sizes)
+		{
+			std::vector<int32_t> values = make_values(size, size);
+			int64_t expected = std::accumulate(values.begin(), values.end(), int64_t(0));
+			int64_t sum = kth::parallel_reduce(tasker, 0, size, int64_t(0),
+				[&](uint32_t i) { return int64_t(values[i]); },
+				[](int64_t a, int64_t b) { return a + b; });
+			CHECK(sum == expected);
+
+			int32_t expected_max = size ? *std::max_element(values.begin(), values.end()) : INT32_MIN;
+			int32_t maximum = kth::parallel_reduce(tasker, 0, size, INT32_MIN,
+				[&](uint32_t i) { return values[i]; },
+				[](int32_t a, int32_t b) { return std::max(a, b); }, 7);
+			CHECK(maximum == expected_max);
+		}
+	}
+
+	void test_exclusive_scan(kth::Multitasker& tasker)
+	{
+		for (uint32_t size : sizes)
+		{
+			std::vector<int32_t> values = make_values(size, size + 1);
+			std::vector<int64_t> input(values.begin(), values.end());
+			std::vector<int64_t> expected(size);
+			int64_t running = 10;
+			for (uint32_t i = 0; i < size; ++i)
+			{
+				expected[i] = running;
+				running += input[i];
+			}
+
+			auto add = [](int64_t a, int64_t b) { return a + b; };
+			std::vector<int64_t> output(size);
+			CHECK(kth::parallel_exclusive_scan(tasker, input.data(), output.data(), size, int64_t(10), add) == running);
+			CHECK(output == expected);
+
+			// In place
+			CHECK(kth::parallel_exclusive_scan(tasker, input.data(), input.data(), size, int64_t(10), add) == running);
+			CHECK(input == expected);
+		}
+	}
+
+	struct keyed
+	{
+		int32_t key;
+		uint32_t position;
+	};
+
+	void test_sort(kth::Multitasker& tasker)
+	{
+		for (uint32_t size : sizes)
+		{
+			std::vector<int32_t> values = make_values(size, size + 2);
+			std::vector<int32_t> expected = values;
+			std::sort(expected.begin(), expected.end());
+			kth::parallel_sort(tasker, values.data(), size);
+			CHECK(values == expected);
+
+			// Stable on a key : equal keys keep their original order
+			std::vector<int32_t> keys = make_values(size, size + 3);
+			std::vector<keyed> elements(size);
+			for (uint32_t i = 0; i < size; ++i)
+				elements[i] = keyed{ keys[i] % 50, i };
+			std::vector<keyed> expected_elements = elements;
+			auto by_key = [](const keyed& a, const keyed& b) { return a.key < b.key; };
+			std::stable_sort(expected_elements.begin(), expected_elements.end(), by_key);
+			kth::parallel_sort(tasker, elements.data(), size, [](const keyed& element) { return element.key; });
+			bool same = true;
+			for (uint32_t i = 0; i < size; ++i)
+				same &= elements[i].key == expected_elements[i].key && elements[i].position == expected_elements[i].position;
+			CHECK(same);
+
+			// 64 bit keys, a single high digit in common
+			std::vector<uint64_t> wide(size);
+			for (uint32_t i = 0; i < size; ++i)
+				wide[i] = (uint64_t(1) << 40) + uint64_t(uint32_t(keys[i]));
+			std::vector<uint64_t> expected_wide = wide;
+			std::sort(expected_wide.begin(), expected_wide.end());
+			kth::parallel_sort(tasker, wide.data(), size);
+			CHECK(wide == expected_wide);
+		}
+	}
+
+	void test_for_covers_range(kth::Multitasker& tasker)
+	{
+		for (uint32_t size : sizes)
+		{
+			std::vector<std::atomic<uint32_t>> visits(size + 10);
+			for (auto& visit : visits)
+				visit = 0;
+			kth::parallel_for(tasker, 10, 10 + size, [&](uint32_t i) { ++visits[i]; });
+			bool once = true;
+			for (uint32_t i = 0; i < visits.size(); ++i)
+				once &= visits[i].load() == (i >= 10 ? 1u : 0u);
+			CHECK(once);
+		}
+		bool ran = false;
+		kth::parallel_for(tasker, 5, 5, [&](uint32_t) { ran = true; });
+		kth::parallel_for(tasker, 6, 5, [&](uint32_t) { ran = true; });
+		CHECK(!ran);
+	}
+
+	struct nested_context
+	{
+		kth::Multitasker* tasker;
+		std::atomic<int> failures;
+	};
+
+	// Each task runs the algorithms itself : their waits park the task's fiber, nested parallel_for included
+	TASK_FUNC(nested_task)
+	{
+		nested_context& context = *static_cast<nested_context*>(user_args);
+		kth::Multitasker& tasker = *context.tasker;
+		const uint32_t size = 5000 + bundle_index * 100;
+
+		std::vector<int32_t> values = make_values(size, bundle_index);
+		std::vector<int32_t> expected = values;
+		std::sort(expected.begin(), expected.end());
+		kth::parallel_sort(tasker, values.data(), size);
+		if (values != expected)
+			++context.failures;
+
+		int64_t sum = kth::parallel_reduce(tasker, 0, size, int64_t(0), [&](uint32_t i) { return int64_t(values[i]); }, [](int64_t a, int64_t b) { return a + b; });
+		if (sum != std::accumulate(expected.begin(), expected.end(), int64_t(0)))
+			++context.failures;
+
+		std::atomic<uint32_t> inner(0);
+		kth::parallel_for(tasker, 0, 16, [&](uint32_t)
+		{
+			kth::parallel_for(tasker, 0, 64, [&](uint32_t) { ++inner; }, 1);
+		}, 1);
+		if (inner.load() != 16 * 64)
+			++context.failures;
+	}
+
+	void test_nested(kth::Multitasker& tasker)
+	{
+		nested_context context{ &tasker, { 0 } };
+		kth::CounterHandle counter = kth::Multitasker::acquire_counter(0);
+		for (uint32_t i = 0; i < 12; ++i)
+			tasker.enqueue(nested_task, &context, i, 12, counter);
+		tasker.wait_for(counter, 0);
+		kth::Multitasker::release_counter(counter);
+		CHECK(context.failures.load() == 0);
+	}
+
+	// Non-worker threads (I/O, tools) run their part and block in wait_for until the split off tasks are done
+	void test_non_worker_thread(kth::Multitasker& tasker)
+	{
+		std::vector<int32_t> values = make_values(50000, 99);
+		std::vector<int32_t> expected = values;
+		std::sort(expected.begin(), expected.end());
+		int64_t sum = 0;
+
+		std::thread thread([&]
+		{
+			kth::parallel_sort(tasker, values.data(), (uint32_t)values.size());
+			sum = kth::parallel_reduce(tasker, 0, (uint32_t)values.size(), int64_t(0), [&](uint32_t i) { return int64_t(values[i]); }, [](int64_t a, int64_t b) { return a + b; });
+		});
+		thread.join();
+
+		CHECK(values == expected);
+		CHECK(sum == std::accumulate(expected.begin(), expected.end(), int64_t(0)));
+	}
+
+	// main() goes on with window and device calls after its waits : it must still be on its own thread
+	void test_main_fiber_stays(kth::Multitasker& tasker)
+	{
+		const std::thread::id main_thread = std::this_thread::get_id();
+		static int args[16];
+
+		for (int round = 0; round < 200; ++round)
+		{
+			std::atomic<uint32_t> sum(0);
+			// Elements that wait themselves, and long ones : the main fiber's wait often finds work left
+			kth::parallel_for(tasker, 0, 256, [&](uint32_t i)
+			{
+				if (i % 32 == 0)
+				{
+					kth::CounterHandle counter = tasker.enqueue(busy_task, args, 16);
+					tasker.wait_for(counter, 0);
+					kth::Multitasker::release_counter(counter);
+				}
+				else if (i % 8 == 0)
+				{
+					std::this_thread::yield();
+				}
+				sum += i;
+			}, 1);
+			CHECK(sum.load() == 256 * 255 / 2);
+			CHECK(std::this_thread::get_id() == main_thread);
+			CHECK(kth::Multitasker::get_current_thread_id() == 0);
+
+			// A plain wait on the main fiber too
+			kth::CounterHandle counter = tasker.enqueue(busy_task, args, 16);
+			tasker.wait_for(counter, 0);
+			kth::Multitasker::release_counter(counter);
+			CHECK(std::this_thread::get_id() == main_thread);
+		}
+	}
+}
+
+int main()
+{
+	kth::Multitasker tasker(worker_count, kth::FiberPoolDesc(), [](uint32_t) {});
+
+	test_for_covers_range(tasker);
+	test_reduce(tasker);
+	test_exclusive_scan(tasker);
+	test_sort(tasker);
+	test_nested(tasker);
+	test_non_worker_thread(tasker);
+	test_main_fiber_stays(tasker);
+
+	tasker.stop();
+	TEST_EXIT();
+}
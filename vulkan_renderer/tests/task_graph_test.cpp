@@ -0,0 +1,162 @@
+#include <tests/test.h>
+#include <thread/task_graph.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	const uint32_t worker_count = 4;
+	const uint32_t bundle_size = 8;
+
+	// Stamps from one sequence : a node started after a predecessor finished iff its first start > their last end
+	std::atomic<uint64_t> sequence(0);
+
+	struct NodeRecord
+	{
+		std::atomic<uint32_t> runs{ 0 };
+		std::atomic<uint64_t> first_start{ ~0ull };
+		std::atomic<uint64_t> last_end{ 0 };
+		std::vector<uint32_t> predecessors;
+
+		void reset()
+		{
+			runs = 0;
+			first_start = ~0ull;
+			last_end = 0;
+		}
+	};
+
+	struct ElementArgs
+	{
+		NodeRecord* record;
+	};
+
+	TASK_FUNC(record_task)
+	{
+		NodeRecord& record = *static_cast<ElementArgs*>(user_args)->record;
+		uint64_t start = ++sequence;
+		uint64_t first = record.first_start.load();
+		while (start < first && !record.first_start.compare_exchange_weak(first, start)) {}
+
+		volatile int sum = 0;
+		for (int i = 0; i < 2000; ++i)
+			sum = sum + i;
+
+		++record.runs;
+		uint64_t end = ++sequence;
+		uint64_t last = record.last_end.load();
+		while (end > last && !record.last_end.compare_exchange_weak(last, end)) {}
+	}
+
+	std::atomic<int> completions(0);
+
+	TASK_FUNC(completion_task)
+	{
+		++completions;
+	}
+
+	void test_diamond_and_chain(kth::Multitasker& tasker)
+	{
+		// 0 -> { 1 (bundle), 2 } -> 3 -> 4 -> 5 -> 6, and 7 alone
+		const uint32_t node_count = 8;
+		std::vector<NodeRecord> records(node_count);
+		std::vector<ElementArgs> args(node_count);
+		std::vector<ElementArgs> bundle_args(bundle_size, ElementArgs{ &records[1] });
+		for (uint32_t i = 0; i < node_count; ++i)
+			args[i].record = &records[i];
+
+		kth::TaskGraph graph(tasker);
+		std::vector<kth::TaskGraph::NodeId> nodes;
+		for (uint32_t i = 0; i < node_count; ++i)
+			nodes.push_back(i == 1 ? graph.add(record_task, bundle_args.data(), bundle_size) : graph.add(record_task, &args[i]));
+
+		auto edge = [&](uint32_t before, uint32_t after)
+		{
+			graph.add_edge(nodes[before], nodes[after]);
+			records[after].predecessors.push_back(before);
+		};
+		edge(0, 1);
+		edge(0, 2);
+		edge(1, 3);
+		edge(2, 3);
+		edge(3, 4);
+		edge(4, 5);
+		edge(5, 6);
+
+		// The same graph again : run resets the dependency counts
+		for (int round = 0; round < 50; ++round)
+		{
+			for (NodeRecord& record : records)
+				record.reset();
+			completions = 0;
+
+			kth::CounterHandle counter = graph.run();
+			kth::WaitingTask completion;
+			completion.continuation = completion_task;
+			tasker.wait_for_async(counter, 0, &completion);
+			tasker.wait_for(counter, 0, true);
+
+			// The continuation is enqueued once the counter reached zero : give it the time to run
+			for (int i = 0; i < 1000 && completions.load() == 0; ++i)
+				std::this_thread::sleep_for(std::chrono::microseconds(100));
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			CHECK(completions.load() == 1);
+			CHECK(counter.load() == 0);
+			kth::Multitasker::release_counter(counter);
+
+			for (uint32_t i = 0; i < node_count; ++i)
+			{
+				CHECK(records[i].runs.load() == (i == 1 ? bundle_size : 1u));
+				for (uint32_t predecessor : records[i].predecessors)
+					CHECK(records[i].first_start.load() > records[predecessor].last_end.load());
+			}
+		}
+	}
+
+	void test_empty_bundle_and_cycle(kth::Multitasker& tasker)
+	{
+		// An empty bundle completes at once and still releases its successor
+		NodeRecord record;
+		ElementArgs args{ &record };
+		kth::TaskGraph graph(tasker);
+		kth::TaskGraph::NodeId empty = graph.add(record_task, &args, 0);
+		kth::TaskGraph::NodeId after = graph.add(record_task, &args);
+		graph.add_edge(empty, after);
+		kth::CounterHandle counter = graph.run();
+		tasker.wait_for(counter, 0, true);
+		kth::Multitasker::release_counter(counter);
+		CHECK(record.runs.load() == 1);
+
+		kth::TaskGraph cyclic(tasker);
+		kth::TaskGraph::NodeId a = cyclic.add(record_task, &args);
+		kth::TaskGraph::NodeId b = cyclic.add(record_task, &args);
+		cyclic.add_edge(a, b);
+		cyclic.add_edge(b, a);
+		bool threw = false;
+		try
+		{
+			cyclic.run();
+		}
+		catch (std::logic_error&)
+		{
+			threw = true;
+		}
+		CHECK(threw);
+		CHECK(record.runs.load() == 1);
+	}
+}
+
+int main()
+{
+	kth::Multitasker tasker(worker_count, kth::FiberPoolDesc(), [](uint32_t) {});
+
+	test_diamond_and_chain(tasker);
+	test_empty_bundle_and_cycle(tasker);
+
+	tasker.stop();
+	TEST_EXIT();
+}
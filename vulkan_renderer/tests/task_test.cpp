@@ -0,0 +1,128 @@
+#include <tests/test.h>
+#include <thread/task.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static_assert(KTH_HAS_COROUTINES, "task_test is built as C++20");
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const uint32_t worker_count = 4;
+
+	kth::task<int> value(int v)
+	{
+		co_return v;
+	}
+
+	kth::task<int> chain(int depth)
+	{
+		if (depth == 0)
+			co_return 1;
+		int result = co_await chain(depth - 1);
+		co_return result + 1;
+	}
+
+	kth::task<int> thrower()
+	{
+		throw 5;
+		co_return 0;
+	}
+
+	TASK_FUNC(busy_task)
+	{
+		volatile int sum = 0;
+		for (int i = 0; i < 10000; ++i)
+			sum = sum + i;
+	}
+
+	kth::task<void> awaits_everything(kth::Multitasker& tasker, int i, std::atomic<int>& completed)
+	{
+		CHECK(co_await value(i) == i);
+		// Symmetric transfer : no stack growth
+		CHECK(co_await chain(10000) == 10001);
+
+		static int args[64];
+		kth::CounterHandle counter = tasker.enqueue(busy_task, args, 64);
+		co_await kth::wait_for(tasker, counter);
+		CHECK(counter.load() == 0);
+		kth::Multitasker::release_counter(counter);
+
+		co_await kth::schedule(tasker, kth::TaskDesc(kth::TaskPriority::normal, kth::TaskAffinity::main_thread));
+		CHECK(kth::Multitasker::get_current_thread_id() == 0);
+		co_await kth::schedule(tasker, kth::TaskPriority::high);
+
+		Clock::time_point begin = Clock::now();
+		co_await kth::poll_until(tasker, [&] { return Clock::now() - begin > std::chrono::microseconds(200); });
+
+		bool caught = false;
+		try
+		{
+			co_await thrower();
+		}
+		catch (int e)
+		{
+			caught = e == 5;
+		}
+		CHECK(caught);
+		++completed;
+	}
+
+	void test_awaiters(kth::Multitasker& tasker)
+	{
+		std::atomic<int> completed(0);
+		for (int round = 0; round < 20; ++round)
+		{
+			std::vector<kth::CounterHandle> counters;
+			for (int i = 0; i < 40; ++i)
+				counters.push_back(kth::spawn(tasker, awaits_everything(tasker, i, completed)));
+			for (kth::CounterHandle counter : counters)
+			{
+				tasker.wait_for(counter, 0, true);
+				kth::Multitasker::release_counter(counter);
+			}
+		}
+		CHECK(completed.load() == 20 * 40);
+	}
+
+	kth::task<void> polls(kth::Multitasker& tasker, std::atomic<bool>& ready)
+	{
+		co_await kth::poll_until(tasker, [&] { return ready.load(); });
+	}
+
+	// A pending poll must not keep the workers busy : they all park between two polls
+	void test_poll_parks_workers(kth::Multitasker& tasker)
+	{
+		std::atomic<bool> ready(false);
+		kth::CounterHandle counter = kth::spawn(tasker, polls(tasker, ready));
+
+		// This thread is worker 0 and does not wait_for meanwhile : the other workers may all park
+		bool all_parked = false;
+		Clock::time_point give_up = Clock::now() + std::chrono::milliseconds(500);
+		while (!all_parked && Clock::now() < give_up)
+		{
+			all_parked = tasker.parked_worker_count() == worker_count - 1;
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		CHECK(all_parked);
+		CHECK(counter.load() == 1);
+
+		ready.store(true);
+		tasker.wait_for(counter, 0, true);
+		kth::Multitasker::release_counter(counter);
+	}
+}
+
+int main()
+{
+	kth::Multitasker tasker(worker_count, kth::FiberPoolDesc(), [](uint32_t) {});
+
+	test_awaiters(tasker);
+	test_poll_parks_workers(tasker);
+
+	tasker.stop();
+	TEST_EXIT();
+}
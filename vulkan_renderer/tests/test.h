@@ -0,0 +1,38 @@
+#pragma once
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+/*
+Checks for the tests built by CMakeLists.txt : a failed CHECK is printed and the test exits with 1.
+
+The Multitasker has no shutdown : tests stop it, then end with TEST_EXIT() instead of returning from main, which
+would destroy it under its still running workers.
+*/
+
+namespace kth_test
+{
+	inline std::atomic<int>& failures()
+	{
+		static std::atomic<int> count(0);
+		return count;
+	}
+}
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			++kth_test::failures(); \
+		} \
+	} while (0)
+
+#define TEST_EXIT() \
+	do \
+	{ \
+		std::printf("%s\n", kth_test::failures().load() ? "FAILED" : "passed"); \
+		std::fflush(stdout); \
+		std::_Exit(kth_test::failures().load() ? 1 : 0); \
+	} while (0)
@@ -0,0 +1,136 @@
+#include <tests/test.h>
+#include <thread/multitasker.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+/*
+Threads that are not workers (GLFW callbacks, I/O threads, tools) block in wait_for on a futex, woken by the
+decrement that reaches their target.
+*/
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const uint32_t worker_count = 4;
+
+	TASK_FUNC(sleeping_task)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(*static_cast<int*>(user_args)));
+	}
+
+	TASK_FUNC(short_task)
+	{
+		volatile int sum = 0;
+		for (int i = 0; i < 100; ++i)
+			sum = sum + i;
+	}
+
+	// Already at or under the target : returns without waiting
+	void test_already_done(kth::Multitasker& tasker)
+	{
+		std::thread thread([&]
+		{
+			CHECK(kth::Multitasker::get_current_thread_id() >= worker_count);
+
+			kth::CounterHandle done = kth::Multitasker::acquire_counter(0);
+			tasker.wait_for(done, 0);
+			kth::Multitasker::release_counter(done);
+
+			kth::CounterHandle under = kth::Multitasker::acquire_counter(2);
+			tasker.wait_for(under, 3);
+			kth::Multitasker::release_counter(under);
+
+			static int args[8];
+			kth::CounterHandle finished = tasker.enqueue(short_task, args, 8);
+			while (finished.load() != 0)
+				std::this_thread::yield();
+			tasker.wait_for(finished, 0);
+			kth::Multitasker::release_counter(finished);
+		});
+		thread.join();
+	}
+
+	// Long enough to get past the spin : the futex wait is woken by the last task
+	void test_blocks_until_done(kth::Multitasker& tasker)
+	{
+		static int sleep_ms[8] = { 5, 5, 5, 5, 10, 10, 10, 20 };
+		std::atomic<bool> returned(false);
+		std::atomic<int> remaining(-1);
+
+		kth::CounterHandle counter = tasker.enqueue(sleeping_task, sleep_ms, 8);
+		std::thread thread([&]
+		{
+			Clock::time_point begin = Clock::now();
+			tasker.wait_for(counter, 0);
+			CHECK(Clock::now() - begin >= std::chrono::milliseconds(15));
+			remaining = counter.load();
+			returned = true;
+		});
+		thread.join();
+
+		CHECK(returned.load());
+		CHECK(remaining.load() == 0);
+		kth::Multitasker::release_counter(counter);
+	}
+
+	// A non-zero target : woken once that many tasks are left, while the rest still runs
+	void test_partial_target(kth::Multitasker& tasker)
+	{
+		static int sleep_ms[4] = { 1, 1, 200, 200 };
+		kth::CounterHandle counter = tasker.enqueue(sleeping_task, sleep_ms, 4);
+		int remaining = -1;
+		std::thread thread([&]
+		{
+			tasker.wait_for(counter, 2);
+			remaining = counter.load();
+		});
+		thread.join();
+		CHECK(remaining >= 1 && remaining <= 2);
+
+		tasker.wait_for(counter, 0, true);
+		kth::Multitasker::release_counter(counter);
+	}
+
+	// Many threads on one counter, and fibers on it too : no wake up is lost
+	void test_many_waiters(kth::Multitasker& tasker)
+	{
+		for (int round = 0; round < 200; ++round)
+		{
+			static int args[32];
+			kth::CounterHandle counter = tasker.enqueue(short_task, args, 32);
+			std::atomic<int> woken(0);
+			std::vector<std::thread> threads;
+			for (int t = 0; t < 4; ++t)
+			{
+				threads.emplace_back([&]
+				{
+					tasker.wait_for(counter, 0);
+					if (counter.load() == 0)
+						++woken;
+				});
+			}
+			tasker.wait_for(counter, 0, true);
+			for (std::thread& thread : threads)
+				thread.join();
+			CHECK(woken.load() == 4);
+			kth::Multitasker::release_counter(counter);
+		}
+	}
+}
+
+int main()
+{
+	kth::Multitasker tasker(worker_count, kth::FiberPoolDesc(), [](uint32_t) {});
+
+	test_already_done(tasker);
+	test_blocks_until_done(tasker);
+	test_partial_target(tasker);
+	test_many_waiters(tasker);
+
+	tasker.stop();
+	TEST_EXIT();
+}
@@ -0,0 +1,259 @@
+#include <tests/test.h>
+#include <thread/timer_wheel.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/*
+Drives the wheel with synthetic times, against a reference that keeps every timer in a list : a timer is due once
+the advanced tick reaches its deadline rounded up to a tick, or the first tick not advanced yet when it was inserted
+in the past.
+*/
+
+namespace
+{
+	typedef kth::TimerWheel Wheel;
+
+	const uint64_t tick = Wheel::tick_ns;
+	// Not a multiple of the tick : the wheel counts ticks from it
+	const uint64_t origin = 123456789;
+
+	uint64_t at_tick(uint64_t t, uint64_t offset = 0)
+	{
+		return origin + t * tick + offset;
+	}
+
+	struct TestTimer : kth::TimerNode
+	{
+		uint64_t deadline_ns = 0;
+		uint64_t due_tick = 0;
+		bool pending = false;
+	};
+
+	struct Reference
+	{
+		Wheel wheel{ origin };
+		std::vector<TestTimer*> timers;
+		// The wheel's next tick to process
+		uint64_t current_tick = 0;
+
+		void insert(TestTimer* timer, uint64_t deadline_ns)
+		{
+			uint64_t rounded = deadline_ns > origin ? (deadline_ns - origin + tick - 1) / tick : 0;
+			timer->deadline_ns = deadline_ns;
+			timer->due_tick = std::max(rounded, current_tick);
+			timer->pending = true;
+			timers.push_back(timer);
+			wheel.insert(timer, deadline_ns);
+		}
+
+		// Checks advance expires exactly the due timers, none before its deadline, and returns them
+		std::vector<TestTimer*> advance(uint64_t time_ns)
+		{
+			std::vector<TestTimer*> expected;
+			if (time_ns >= origin)
+			{
+				uint64_t target = (time_ns - origin) / tick;
+				for (TestTimer* timer : timers)
+				{
+					if (timer->due_tick <= target)
+						expected.push_back(timer);
+				}
+				current_tick = std::max(current_tick, target + 1);
+			}
+
+			std::vector<TestTimer*> expired;
+			for (kth::TimerNode* node = wheel.advance(time_ns); node; node = node->next)
+				expired.push_back(static_cast<TestTimer*>(node));
+
+			std::sort(expected.begin(), expected.end());
+			std::sort(expired.begin(), expired.end());
+			CHECK(expired == expected);
+			for (TestTimer* timer : expired)
+			{
+				CHECK(timer->deadline_ns <= time_ns);
+				timer->pending = false;
+			}
+			timers.erase(std::remove_if(timers.begin(), timers.end(), [](TestTimer* timer) { return !timer->pending; }), timers.end());
+
+			CHECK(wheel.size() == timers.size());
+			check_next_deadline();
+			return expired;
+		}
+
+		void check_next_deadline()
+		{
+			uint64_t earliest = Wheel::no_deadline;
+			for (TestTimer* timer : timers)
+				earliest = std::min(earliest, at_tick(timer->due_tick));
+			CHECK(wheel.next_deadline() == earliest);
+		}
+	};
+
+	// Several turns of the wheel away : skipped by every earlier visit of its slot
+	void test_far_deadline()
+	{
+		Reference reference;
+		TestTimer far, near;
+		reference.insert(&far, at_tick(1000, 1));
+		reference.insert(&near, at_tick(1000 - Wheel::slot_count * 3, 0));
+		reference.check_next_deadline();
+
+		for (uint64_t t = 0; t <= 1001; ++t)
+		{
+			std::vector<TestTimer*> expired = reference.advance(at_tick(t, tick / 2));
+			if (t == 1000 - Wheel::slot_count * 3)
+				CHECK(expired.size() == 1 && expired[0] == &near);
+			else if (t == 1001)
+				CHECK(expired.size() == 1 && expired[0] == &far);
+			else
+				CHECK(expired.empty());
+		}
+		CHECK(reference.wheel.next_deadline() == Wheel::no_deadline);
+
+		// The last slot of the turn is earlier than the next turn of the first one
+		Reference wrapping;
+		TestTimer last_slot, next_turn;
+		wrapping.insert(&next_turn, at_tick(Wheel::slot_count));
+		wrapping.insert(&last_slot, at_tick(Wheel::slot_count - 1));
+		CHECK(wrapping.wheel.next_deadline() == at_tick(Wheel::slot_count - 1));
+		CHECK(wrapping.advance(at_tick(Wheel::slot_count - 1)).size() == 1);
+		CHECK(wrapping.advance(at_tick(Wheel::slot_count)).size() == 1);
+	}
+
+	// One advance after a gap of several turns visits every slot once and expires everything due
+	void test_long_gap()
+	{
+		Reference reference;
+		TestTimer timers[6];
+		const uint64_t deadlines[6] = { 5, 255, 256, 300, 700, 5000 };
+		for (int i = 0; i < 6; ++i)
+			reference.insert(&timers[i], at_tick(deadlines[i]));
+
+		// A later turn in an earlier slot does not hide a nearer timer further in this turn
+		TestTimer nearer;
+		reference.insert(&nearer, at_tick(200));
+		CHECK(reference.wheel.next_deadline() == at_tick(5));
+		CHECK(reference.advance(at_tick(5)).size() == 1);
+		CHECK(reference.wheel.next_deadline() == at_tick(200));
+
+		// Every slot holds a timer due by the next advance
+		std::vector<TestTimer> full_turn(Wheel::slot_count);
+		for (uint32_t i = 0; i < Wheel::slot_count; ++i)
+			reference.insert(&full_turn[i], at_tick(300 + i, tick / 2));
+
+		CHECK(reference.advance(at_tick(800)).size() == 5 + Wheel::slot_count);
+		CHECK(reference.wheel.next_deadline() == at_tick(5000));
+		CHECK(reference.advance(at_tick(4999, tick - 1)).empty());
+		CHECK(reference.advance(at_tick(5000)).size() == 1);
+	}
+
+	void test_past_deadline()
+	{
+		Reference reference;
+		TestTimer before_origin, past, now;
+		reference.advance(at_tick(100, 10));
+
+		reference.insert(&before_origin, origin - 5 * tick);
+		reference.insert(&past, at_tick(50));
+		reference.insert(&now, at_tick(100, 20));
+		// In the slot of the tick just processed
+		TestTimer last_processed;
+		reference.insert(&last_processed, at_tick(100));
+		// Tick 100 was processed : due on the next one
+		CHECK(reference.wheel.next_deadline() == at_tick(101));
+		CHECK(reference.advance(at_tick(100, 30)).empty());
+		CHECK(reference.advance(at_tick(101)).size() == 4);
+
+		// Times before the origin expire nothing
+		Reference early;
+		TestTimer timer;
+		early.insert(&timer, origin);
+		CHECK(early.advance(origin - 1).empty());
+		CHECK(early.advance(origin).size() == 1);
+	}
+
+	// Random inserts and advances, gaps of up to three turns
+	void test_random()
+	{
+		Reference reference;
+		std::vector<TestTimer> pool(4096);
+		size_t used = 0;
+		uint32_t state = 12345;
+		auto random = [&state](uint32_t range)
+		{
+			state = state * 1664525u + 1013904223u;
+			return (state >> 8) % range;
+		};
+
+		uint64_t now = origin;
+		for (int step = 0; step < 3000; ++step)
+		{
+			uint32_t inserts = random(3);
+			for (uint32_t i = 0; i < inserts && used < pool.size(); ++i)
+			{
+				// From 50 ticks in the past to 8 turns ahead
+				int64_t delta = (int64_t)random(2100 * (uint32_t)tick) - 50 * (int64_t)tick;
+				uint64_t deadline = (int64_t)now + delta > 0 ? (uint64_t)((int64_t)now + delta) : 0;
+				reference.insert(&pool[used++], deadline);
+			}
+			reference.check_next_deadline();
+
+			// Mostly short gaps, so that a few hundred timers are pending over every turn of the wheel
+			uint32_t kind = random(50);
+			uint64_t gap = kind == 0 ? random(3 * Wheel::slot_count) * tick : kind < 30 ? random((uint32_t)tick) : random(4 * (uint32_t)tick);
+			now += gap;
+			reference.advance(now);
+		}
+		now += 3000 * tick;
+		reference.advance(now);
+		CHECK(reference.timers.empty());
+	}
+
+	// The re-arming of enqueue_periodic : on the period grid, one expiry and a fresh start after falling behind
+	void test_periodic()
+	{
+		Reference reference;
+		TestTimer timer;
+		const uint64_t period = 3 * tick + tick / 2;
+		reference.insert(&timer, origin + period);
+
+		uint32_t runs = 0;
+		uint64_t now = origin;
+		for (int step = 0; step < 200; ++step)
+		{
+			now += tick / 4;
+			std::vector<TestTimer*> expired = reference.advance(now);
+			if (expired.empty()) continue;
+			++runs;
+			CHECK(timer.deadline_ns <= now);
+			uint64_t next = Wheel::next_period_deadline(timer.deadline_ns, period, now);
+			CHECK(next == timer.deadline_ns + period);
+			reference.insert(&timer, next);
+		}
+		// 50 ticks : a run every 3.5 ticks, each late by at most a tick
+		CHECK(runs >= 13 && runs <= 14);
+
+		// Ten periods without an advance : one expiry, then the grid starts again from now
+		uint64_t last_deadline = timer.deadline_ns;
+		now = last_deadline + 10 * period + tick / 3;
+		CHECK(reference.advance(now).size() == 1);
+		uint64_t next = Wheel::next_period_deadline(last_deadline, period, now);
+		CHECK(next == now + period);
+		reference.insert(&timer, next);
+		CHECK(reference.advance(now + period - tick).empty());
+		CHECK(reference.advance(now + period + tick).size() == 1);
+	}
+}
+
+int main()
+{
+	test_far_deadline();
+	test_long_gap();
+	test_past_deadline();
+	test_random();
+	test_periodic();
+
+	TEST_EXIT();
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+/*
+Heap allocation of over-aligned (cache line padded) objects : operator new only guarantees 16 bytes of alignment
+before C++17, alignas(64) members of a plain new'd object can straddle cache lines (and MSVC warns, C4316).
+
+The block is over-allocated and aligned by hand, the original allocation is kept just before it for aligned_free.
+*/
+
+namespace kth
+{
+
+	inline void* aligned_allocate(size_t size, size_t alignment)
+	{
+		char* memory = static_cast<char*>(::operator new(size + alignment + sizeof(void*)));
+		uintptr_t aligned = (reinterpret_cast<uintptr_t>(memory) + sizeof(void*) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+		reinterpret_cast<void**>(aligned)[-1] = memory;
+		return reinterpret_cast<void*>(aligned);
+	}
+
+	inline void aligned_free(void* pointer)
+	{
+		if (pointer)
+			::operator delete(static_cast<void**>(pointer)[-1]);
+	}
+
+	template<typename T, typename... Args>
+	T* aligned_new(Args&&... args)
+	{
+		void* memory = aligned_allocate(sizeof(T), alignof(T));
+		return new (memory) T(std::forward<Args>(args)...);
+	}
+
+	template<typename T>
+	void aligned_delete(T* object)
+	{
+		if (!object) return;
+		object->~T();
+		aligned_free(object);
+	}
+
+	// Deleter of unique_ptrs to aligned_new'd objects
+	struct AlignedDelete
+	{
+		template<typename T>
+		void operator()(T* object) const { aligned_delete(object); }
+	};
+
+}
@@ -0,0 +1,632 @@
+#include <thread/benchmark.h>
+#include <thread/multitasker.h>
+#include <thread/parallel.h>
+#include <thread/thread.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double elapsed_microseconds(Clock::time_point begin, Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::micro>(end - begin).count();
+	}
+
+	void spin_for(double microseconds)
+	{
+		Clock::time_point end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::micro>(microseconds));
+		while (Clock::now() < end)
+			kth::cpu_pause();
+	}
+
+	// Sorts samples
+	double percentile(std::vector<double>& samples, double fraction)
+	{
+		std::sort(samples.begin(), samples.end());
+		size_t index = std::min(samples.size() - 1, (size_t)(fraction * (samples.size() - 1) + 0.5));
+		return samples[index];
+	}
+
+	uint32_t scaled(uint32_t count, const kth::BenchmarkOptions& options)
+	{
+		return std::max(1u, (uint32_t)(count * options.iteration_scale));
+	}
+
+	// Smaller than the default pools : every configuration leaks its tasker
+	kth::FiberPoolDesc benchmark_fiber_pool()
+	{
+		kth::FiberPoolDesc desc;
+		desc.initial_count[(size_t)kth::FiberStack::small] = 16;
+		desc.initial_count[(size_t)kth::FiberStack::large] = 1;
+		return desc;
+	}
+
+	template<typename Func>
+	void run_on_tasker(uint32_t worker_count, const Func& func)
+	{
+		std::thread thread([&]
+		{
+			kth::Multitasker* tasker = new kth::Multitasker(worker_count, benchmark_fiber_pool(), [](uint32_t) {});
+			func(*tasker);
+			tasker->stop();
+		});
+		thread.join();
+	}
+
+	TASK_FUNC(empty_task)
+	{
+	}
+
+	struct ResumeContext
+	{
+		kth::Multitasker* tasker;
+		kth::CounterHandle counter;
+		Clock::time_point signaled;
+	};
+
+	TASK_FUNC(signal_task)
+	{
+		ResumeContext& context = *static_cast<ResumeContext*>(user_args);
+		// Long enough for the enqueuing fiber to be waiting already
+		spin_for(20.0);
+		context.signaled = Clock::now();
+		context.tasker->signal(context.counter);
+	}
+
+	TASK_FUNC(low_priority_task)
+	{
+		spin_for(50.0);
+	}
+
+	// parallel_for waits anywhere, the taskers' threads only wait with return_on_same_thread
+	TASK_FUNC(function_task)
+	{
+		(*static_cast<std::function<void()>*>(user_args))();
+	}
+
+	// Start time of a task, polled by a caller that must not run it itself
+	struct WakeProbe
+	{
+		Clock::time_point started;
+		std::atomic<bool> ran;
+	};
+
+	TASK_FUNC(wake_probe_task)
+	{
+		WakeProbe& probe = *static_cast<WakeProbe*>(user_args);
+		probe.started = Clock::now();
+		probe.ran.store(true, std::memory_order_release);
+	}
+
+	// Baseline without fibers : std::threads taking tasks from a queue behind a mutex.
+	// notify		textbook thread pool, one idle thread woken per enqueued task
+	// poll_4ms		the workers' idle loop before the event count : idle threads sleep 4 ms on a condition variable
+	//				notified when a task completes, never when one is enqueued
+	class BaselinePool
+	{
+	public:
+		enum class Wake
+		{
+			notify,
+			poll_4ms
+		};
+
+		BaselinePool(uint32_t thread_count, Wake wake) : _wake(wake), _pending(0), _stop(false)
+		{
+			for (uint32_t i = 0; i < thread_count; ++i)
+				_threads.emplace_back([this] { run(); });
+		}
+
+		~BaselinePool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_stop = true;
+			}
+			_wake_up.notify_all();
+			for (std::thread& thread : _threads)
+				thread.join();
+		}
+
+		void enqueue(std::function<void()> task)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_tasks.push_back(std::move(task));
+				++_pending;
+			}
+			if (_wake == Wake::notify)
+				_wake_up.notify_one();
+		}
+
+		// Until every task enqueued so far ran
+		void wait_idle()
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_idle.wait(lock, [this] { return _pending == 0; });
+		}
+
+	private:
+		void run()
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			while (!_stop)
+			{
+				if (_tasks.empty())
+				{
+					if (_wake == Wake::poll_4ms)
+						_wake_up.wait_for(lock, std::chrono::milliseconds(4));
+					else
+						_wake_up.wait(lock);
+					continue;
+				}
+
+				std::function<void()> task = std::move(_tasks.front());
+				_tasks.pop_front();
+				lock.unlock();
+				task();
+				lock.lock();
+
+				if (--_pending == 0)
+					_idle.notify_all();
+				if (_wake == Wake::poll_4ms)
+					_wake_up.notify_all();
+			}
+		}
+
+		Wake _wake;
+		std::mutex _mutex;
+		std::condition_variable _wake_up;
+		std::condition_variable _idle;
+		std::deque<std::function<void()>> _tasks;
+		uint32_t _pending;
+		std::vector<std::thread> _threads;
+		bool _stop;
+	};
+
+	void add_result(std::vector<kth::BenchmarkResult>& results, const char* benchmark, uint32_t workers, const char* metric, double value, const char* unit)
+	{
+		results.push_back(kth::BenchmarkResult{ benchmark, workers, metric, value, unit });
+	}
+
+	void empty_task_throughput(kth::Multitasker& tasker, const kth::BenchmarkOptions& options, std::vector<kth::BenchmarkResult>& results)
+	{
+		uint32_t task_count = scaled(1 << 20, options);
+		std::vector<char> args(task_count);
+
+		Clock::time_point begin = Clock::now();
+		kth::CounterHandle counter = tasker.enqueue(empty_task, args.data(), (int)task_count);
+		tasker.wait_for(counter, 0, true);
+		kth::Multitasker::release_counter(counter);
+		double bundle_time = elapsed_microseconds(begin, Clock::now());
+
+		begin = Clock::now();
+		counter = tasker.enqueue(empty_task, args.data(), (int)task_count, kth::TaskDesc(kth::TaskPriority::normal, kth::TaskAffinity::any, kth::FiberStack::small, kth::TaskDesc::auto_chunk));
+		tasker.wait_for(counter, 0, true);
+		kth::Multitasker::release_counter(counter);
+		double chunked_bundle_time = elapsed_microseconds(begin, Clock::now());
+
+		begin = Clock::now();
+		counter = kth::Multitasker::acquire_counter(0);
+		for (uint32_t i = 0; i < task_count; ++i)
+			tasker.enqueue(empty_task, nullptr, i, task_count, counter);
+		tasker.wait_for(counter, 0, true);
+		kth::Multitasker::release_counter(counter);
+		double single_time = elapsed_microseconds(begin, Clock::now());
+
+		double baseline_time;
+		{
+			BaselinePool pool(tasker.worker_count(), BaselinePool::Wake::notify);
+			begin = Clock::now();
+			for (uint32_t i = 0; i < task_count; ++i)
+				pool.enqueue([] {});
+			pool.wait_idle();
+			baseline_time = elapsed_microseconds(begin, Clock::now());
+		}
+
+		add_result(results, "empty_task_throughput", tasker.worker_count(), "bundle", task_count / bundle_time, "tasks/us");
+		add_result(results, "empty_task_throughput", tasker.worker_count(), "chunked_bundle", task_count / chunked_bundle_time, "tasks/us");
+		add_result(results, "empty_task_throughput", tasker.worker_count(), "single_enqueue", task_count / single_time, "tasks/us");
+		add_result(results, "empty_task_throughput", tasker.worker_count(), "baseline_thread_pool", task_count / baseline_time, "tasks/us");
+	}
+
+	void fan_out_fan_in(kth::Multitasker& tasker, const kth::BenchmarkOptions& options, std::vector<kth::BenchmarkResult>& results)
+	{
+		uint32_t round_count = scaled(2000, options);
+		uint32_t fan = tasker.worker_count() * 4;
+		std::vector<char> args(fan);
+
+		std::vector<double> samples;
+		for (uint32_t round = 0; round < round_count; ++round)
+		{
+			Clock::time_point begin = Clock::now();
+			kth::CounterHandle counter = tasker.enqueue(empty_task, args.data(), (int)fan);
+			tasker.wait_for(counter, 0, true);
+			samples.push_back(elapsed_microseconds(begin, Clock::now()));
+			kth::Multitasker::release_counter(counter);
+		}
+
+		std::vector<double> baseline_samples;
+		{
+			BaselinePool pool(tasker.worker_count(), BaselinePool::Wake::notify);
+			for (uint32_t round = 0; round < round_count; ++round)
+			{
+				Clock::time_point begin = Clock::now();
+				for (uint32_t i = 0; i < fan; ++i)
+					pool.enqueue([] {});
+				pool.wait_idle();
+				baseline_samples.push_back(elapsed_microseconds(begin, Clock::now()));
+			}
+		}
+
+		add_result(results, "fan_out_fan_in", tasker.worker_count(), "p50", percentile(samples, 0.5), "us");
+		add_result(results, "fan_out_fan_in", tasker.worker_count(), "p99", percentile(samples, 0.99), "us");
+		add_result(results, "fan_out_fan_in", tasker.worker_count(), "baseline_thread_pool_p50", percentile(baseline_samples, 0.5), "us");
+		add_result(results, "fan_out_fan_in", tasker.worker_count(), "baseline_thread_pool_p99", percentile(baseline_samples, 0.99), "us");
+	}
+
+	void wait_resume_latency(kth::Multitasker& tasker, const kth::BenchmarkOptions& options, std::vector<kth::BenchmarkResult>& results)
+	{
+		uint32_t round_count = scaled(2000, options);
+
+		std::vector<double> samples;
+		ResumeContext context;
+		context.tasker = &tasker;
+		for (uint32_t round = 0; round < round_count; ++round)
+		{
+			context.counter = kth::Multitasker::acquire_counter(1);
+			kth::CounterHandle task_counter = tasker.enqueue(signal_task, &context);
+			tasker.wait_for(context.counter, 0, true);
+			samples.push_back(elapsed_microseconds(context.signaled, Clock::now()));
+
+			tasker.wait_for(task_counter, 0, true);
+			kth::Multitasker::release_counter(task_counter);
+			kth::Multitasker::release_counter(context.counter);
+		}
+
+		// A thread blocked on a condition variable instead of a fiber waiting on the counter
+		std::vector<double> baseline_samples;
+		{
+			BaselinePool pool(1, BaselinePool::Wake::notify);
+			std::mutex mutex;
+			std::condition_variable signaled;
+			bool done = false;
+			for (uint32_t round = 0; round < round_count; ++round)
+			{
+				done = false;
+				pool.enqueue([&]
+				{
+					spin_for(20.0);
+					std::lock_guard<std::mutex> lock(mutex);
+					context.signaled = Clock::now();
+					done = true;
+					signaled.notify_one();
+				});
+
+				std::unique_lock<std::mutex> lock(mutex);
+				signaled.wait(lock, [&] { return done; });
+				baseline_samples.push_back(elapsed_microseconds(context.signaled, Clock::now()));
+			}
+			pool.wait_idle();
+		}
+
+		add_result(results, "wait_resume_latency", tasker.worker_count(), "p50", percentile(samples, 0.5), "us");
+		add_result(results, "wait_resume_latency", tasker.worker_count(), "p99", percentile(samples, 0.99), "us");
+		add_result(results, "wait_resume_latency", tasker.worker_count(), "baseline_condition_variable_p50", percentile(baseline_samples, 0.5), "us");
+		add_result(results, "wait_resume_latency", tasker.worker_count(), "baseline_condition_variable_p99", percentile(baseline_samples, 0.99), "us");
+	}
+
+	struct SwitchContext
+	{
+		kth::Fiber caller;
+		kth::Fiber callee;
+	};
+
+	FIBER_FUNC(switch_back_fiber)
+	{
+		SwitchContext& context = *static_cast<SwitchContext*>(user_args);
+		for (;;)
+			kth::switch_to_fiber(context.caller);
+	}
+
+	void fiber_switch_cost(const kth::BenchmarkOptions& options, std::vector<kth::BenchmarkResult>& results)
+	{
+		uint32_t round_trips = scaled(1 << 20, options);
+		double time = 0.0;
+
+		// A thread of its own : a thread is converted to a fiber once, the taskers convert theirs. The callee fiber is
+		// left suspended when the thread ends.
+		std::thread thread([&]
+		{
+			SwitchContext context;
+			context.caller = kth::convert_thread_to_fiber();
+			context.callee = kth::create_fiber(switch_back_fiber, &context, 64 * 1024);
+
+			Clock::time_point begin = Clock::now();
+			for (uint32_t i = 0; i < round_trips; ++i)
+				kth::switch_to_fiber(context.callee);
+			time = elapsed_microseconds(begin, Clock::now());
+		});
+		thread.join();
+
+		// Two threads handing a futex word back and forth : what a switch costs without fibers
+		uint32_t thread_round_trips = scaled(1 << 16, options);
+		std::atomic<uint32_t> turn(0);
+		std::thread other([&]
+		{
+			for (uint32_t i = 0; i < thread_round_trips; ++i)
+			{
+				while (turn.load() != 1)
+					kth::futex_wait(&turn, 0);
+				turn.store(0);
+				kth::futex_wake(&turn, 1);
+			}
+		});
+		Clock::time_point begin = Clock::now();
+		for (uint32_t i = 0; i < thread_round_trips; ++i)
+		{
+			turn.store(1);
+			kth::futex_wake(&turn, 1);
+			while (turn.load() != 0)
+				kth::futex_wait(&turn, 1);
+		}
+		double thread_time = elapsed_microseconds(begin, Clock::now());
+		other.join();
+
+		add_result(results, "fiber_switch", 1, "switch", time * 1000.0 / (2.0 * round_trips), "ns");
+		add_result(results, "fiber_switch", 1, "baseline_thread_switch", thread_time * 1000.0 / (2.0 * thread_round_trips), "ns");
+	}
+
+	const uint32_t nested_outer_count = 64;
+	const uint32_t nested_inner_count = 4096;
+
+	void nested_element(std::vector<float>& output, uint32_t outer, uint32_t inner, uint32_t repetition)
+	{
+		float value = (float)(outer * nested_inner_count + inner + repetition);
+		for (uint32_t i = 0; i < 64; ++i)
+			value = std::sqrt(value * value + 1.0f);
+		output[outer * nested_inner_count + inner] = value;
+	}
+
+	// Baseline of nested_parallel_for : the same loops on one thread, no tasker
+	void nested_serial_for(const kth::BenchmarkOptions& options, std::vector<kth::BenchmarkResult>& results, double& serial_time)
+	{
+		uint32_t repetitions = scaled(8, options);
+		std::vector<float> output(nested_outer_count * nested_inner_count);
+
+		Clock::time_point begin = Clock::now();
+		for (uint32_t repetition = 0; repetition < repetitions; ++repetition)
+		{
+			for (uint32_t outer = 0; outer < nested_outer_count; ++outer)
+			{
+				for (uint32_t inner = 0; inner < nested_inner_count; ++inner)
+					nested_element(output, outer, inner, repetition);
+			}
+		}
+		serial_time = elapsed_microseconds(begin, Clock::now()) / repetitions;
+
+		add_result(results, "nested_parallel_for", 1, "baseline_serial_time", serial_time, "us");
+	}
+
+	void nested_parallel_for(kth::Multitasker& tasker, const kth::BenchmarkOptions& options, std::vector<kth::BenchmarkResult>& results, double serial_time, double& single_worker_time)
+	{
+		uint32_t repetitions = scaled(8, options);
+		std::vector<float> output(nested_outer_count * nested_inner_count);
+
+		std::function<void()> run = [&]
+		{
+			for (uint32_t repetition = 0; repetition < repetitions; ++repetition)
+			{
+				kth::parallel_for(tasker, 0, nested_outer_count, [&](uint32_t outer)
+				{
+					kth::parallel_for(tasker, 0, nested_inner_count, [&](uint32_t inner)
+					{
+						nested_element(output, outer, inner, repetition);
+					});
+				});
+			}
+		};
+
+		Clock::time_point begin = Clock::now();
+		kth::CounterHandle counter = tasker.enqueue(function_task, &run);
+		tasker.wait_for(counter, 0, true);
+		kth::Multitasker::release_counter(counter);
+		double time = elapsed_microseconds(begin, Clock::now()) / repetitions;
+
+		if (tasker.worker_count() == 1)
+			single_worker_time = time;
+		add_result(results, "nested_parallel_for", tasker.worker_count(), "time", time, "us");
+		add_result(results, "nested_parallel_for", tasker.worker_count(), "speedup", single_worker_time > 0.0 ? single_worker_time / time : 0.0, "x");
+		add_result(results, "nested_parallel_for", tasker.worker_count(), "speedup_vs_serial", serial_time / time, "x");
+	}
+
+	// Every worker but the calling one parked : time from enqueue until the task starts on a woken worker. The caller
+	// polls instead of waiting, it would run the task itself. It yields, the worker may need its core.
+	void parked_wake_latency(kth::Multitasker& tasker, const kth::BenchmarkOptions& options, std::vector<kth::BenchmarkResult>& results)
+	{
+		uint32_t parkable = tasker.worker_count() - 1;
+		if (parkable == 0)
+			return;
+		uint32_t round_count = scaled(200, options);
+
+		std::vector<double> samples;
+		WakeProbe probe;
+		for (uint32_t round = 0; round < round_count; ++round)
+		{
+			Clock::time_point give_up = Clock::now() + std::chrono::seconds(1);
+			while (tasker.parked_worker_count() < parkable && Clock::now() < give_up)
+				std::this_thread::yield();
+			if (tasker.parked_worker_count() < parkable)
+				continue;
+
+			probe.ran.store(false);
+			Clock::time_point enqueued = Clock::now();
+			kth::CounterHandle counter = tasker.enqueue(wake_probe_task, &probe);
+			while (!probe.ran.load(std::memory_order_acquire))
+				std::this_thread::yield();
+			samples.push_back(elapsed_microseconds(enqueued, probe.started));
+
+			tasker.wait_for(counter, 0, true);
+			kth::Multitasker::release_counter(counter);
+		}
+
+		// Same rounds on the 4 ms polling loop, with as many threads
+		std::vector<double> baseline_samples;
+		{
+			BaselinePool pool(parkable, BaselinePool::Wake::poll_4ms);
+			for (uint32_t round = 0; round < round_count; ++round)
+			{
+				// Lets the threads woken by the previous round's completion go back to sleep
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+				probe.ran.store(false);
+				Clock::time_point enqueued = Clock::now();
+				pool.enqueue([&probe] { wake_probe_task(&probe, 0, 1); });
+				while (!probe.ran.load(std::memory_order_acquire))
+					std::this_thread::yield();
+				baseline_samples.push_back(elapsed_microseconds(enqueued, probe.started));
+			}
+		}
+
+		if (!samples.empty())
+		{
+			add_result(results, "parked_wake_latency", tasker.worker_count(), "p50", percentile(samples, 0.5), "us");
+			add_result(results, "parked_wake_latency", tasker.worker_count(), "p99", percentile(samples, 0.99), "us");
+		}
+		add_result(results, "parked_wake_latency", tasker.worker_count(), "baseline_4ms_poll_p50", percentile(baseline_samples, 0.5), "us");
+		add_result(results, "parked_wake_latency", tasker.worker_count(), "baseline_4ms_poll_p99", percentile(baseline_samples, 0.99), "us");
+	}
+
+	// Rounds of a fresh low priority backlog then a probe task : high priority, or as a baseline the backlog's own
+	// priority (the scheduler before priorities). The probe is stolen by the other workers, the caller spins instead of
+	// waiting since it would pop the probe it just pushed.
+	void mixed_priorities(kth::Multitasker& tasker, const kth::BenchmarkOptions& options, std::vector<kth::BenchmarkResult>& results)
+	{
+		uint32_t backlog_count = tasker.worker_count() * 8;
+		uint32_t round_count = 2 * scaled(100, options);
+		std::vector<char> args(backlog_count);
+
+		std::vector<double> high_samples;
+		std::vector<double> baseline_samples;
+		WakeProbe probe;
+		Clock::time_point begin = Clock::now();
+		for (uint32_t round = 0; round < round_count; ++round)
+		{
+			kth::CounterHandle backlog = tasker.enqueue(low_priority_task, args.data(), (int)backlog_count, kth::TaskDesc(kth::TaskPriority::low));
+
+			kth::TaskPriority priority = round % 2 ? kth::TaskPriority::low : kth::TaskPriority::high;
+			probe.ran.store(false);
+			Clock::time_point enqueued = Clock::now();
+			kth::CounterHandle counter = tasker.enqueue(wake_probe_task, &probe, kth::TaskDesc(priority));
+			while (tasker.worker_count() > 1 && !probe.ran.load(std::memory_order_acquire))
+				std::this_thread::yield();
+			tasker.wait_for(counter, 0, true);
+			kth::Multitasker::release_counter(counter);
+			(priority == kth::TaskPriority::high ? high_samples : baseline_samples).push_back(elapsed_microseconds(enqueued, probe.started));
+
+			tasker.wait_for(backlog, 0, true);
+			kth::Multitasker::release_counter(backlog);
+		}
+		double time = elapsed_microseconds(begin, Clock::now());
+
+		add_result(results, "mixed_priorities", tasker.worker_count(), "high_start_p50", percentile(high_samples, 0.5), "us");
+		add_result(results, "mixed_priorities", tasker.worker_count(), "high_start_p99", percentile(high_samples, 0.99), "us");
+		add_result(results, "mixed_priorities", tasker.worker_count(), "baseline_same_priority_start_p50", percentile(baseline_samples, 0.5), "us");
+		add_result(results, "mixed_priorities", tasker.worker_count(), "baseline_same_priority_start_p99", percentile(baseline_samples, 0.99), "us");
+		add_result(results, "mixed_priorities", tasker.worker_count(), "low_throughput", backlog_count * round_count / time, "tasks/us");
+	}
+}
+
+namespace kth
+{
+
+	std::vector<BenchmarkResult> run_multitasker_benchmarks(const BenchmarkOptions& options)
+	{
+		std::vector<BenchmarkResult> results;
+		uint32_t max_workers = options.max_workers ? options.max_workers : get_processor_count();
+
+		fiber_switch_cost(options, results);
+
+		run_on_tasker(max_workers, [&](Multitasker& tasker)
+		{
+			empty_task_throughput(tasker, options, results);
+			fan_out_fan_in(tasker, options, results);
+			wait_resume_latency(tasker, options, results);
+			parked_wake_latency(tasker, options, results);
+			mixed_priorities(tasker, options, results);
+		});
+
+		// Powers of two, then max_workers itself
+		std::vector<uint32_t> worker_counts;
+		for (uint32_t workers = 1; workers < max_workers; workers *= 2)
+			worker_counts.push_back(workers);
+		worker_counts.push_back(max_workers);
+
+		double serial_time = 0.0;
+		nested_serial_for(options, results, serial_time);
+
+		double single_worker_time = 0.0;
+		for (uint32_t workers : worker_counts)
+		{
+			run_on_tasker(workers, [&](Multitasker& tasker)
+			{
+				nested_parallel_for(tasker, options, results, serial_time, single_worker_time);
+			});
+		}
+
+		return results;
+	}
+
+	bool write_benchmark_json(const std::vector<BenchmarkResult>& results, const std::string& path)
+	{
+		std::ofstream file(path);
+		if (!file) return false;
+
+		file << "{\"benchmarks\":[\n";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const BenchmarkResult& result = results[i];
+			file << "{\"benchmark\":\"" << result.benchmark << "\",\"workers\":" << result.workers << ",\"metric\":\"" << result.metric
+				<< "\",\"value\":" << result.value << ",\"unit\":\"" << result.unit << "\"}" << (i + 1 < results.size() ? ",\n" : "\n");
+		}
+		file << "]}\n";
+		return (bool)file;
+	}
+
+	bool write_benchmark_csv(const std::vector<BenchmarkResult>& results, const std::string& path)
+	{
+		std::ofstream file(path);
+		if (!file) return false;
+
+		file << "benchmark,workers,metric,value,unit\n";
+		for (const BenchmarkResult& result : results)
+			file << result.benchmark << "," << result.workers << "," << result.metric << "," << result.value << "," << result.unit << "\n";
+		return (bool)file;
+	}
+
+	void run_multitasker_benchmarks_and_exit(const BenchmarkOptions& options)
+	{
+		std::vector<BenchmarkResult> results = run_multitasker_benchmarks(options);
+		for (const BenchmarkResult& result : results)
+			std::printf("%-24s %3u workers  %-32s %12.3f %s\n", result.benchmark.c_str(), result.workers, result.metric.c_str(), result.value, result.unit.c_str());
+		bool written = write_benchmark_json(results, "multitasker_benchmarks.json");
+		written = write_benchmark_csv(results, "multitasker_benchmarks.csv") && written;
+
+		std::fflush(stdout);
+		std::_Exit(written ? 0 : 1);
+	}
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Multitasker microbenchmarks, each next to a baseline (metrics starting with baseline_) :
+
+	empty_task_throughput	bundles and single enqueues		a std::thread pool on a mutex protected queue
+	fan_out_fan_in			enqueue then wait_for			the same thread pool
+	wait_resume_latency		fiber resumed by a signal		thread blocked on a condition variable
+	parked_wake_latency		enqueue to run, workers parked	the former 4 ms condition variable polling
+	fiber_switch			switch_to_fiber					two threads handing a futex back and forth
+	nested_parallel_for		1 worker to max_workers			the same loops, serial
+	mixed_priorities		high priority under a backlog	a probe of the backlog's own priority
+
+	auto results = kth::run_multitasker_benchmarks(kth::BenchmarkOptions());
+	kth::write_benchmark_json(results, "multitasker_benchmarks.json");
+
+Every configuration gets a Multitasker of its own, created on a dedicated thread. The Multitasker has no shutdown :
+they are stopped and leaked once measured, run this in a process of its own that ends with std::_Exit, not with
+static destruction under the still running workers. run_multitasker_benchmarks_and_exit does it all, for
+RUN_MULTITASKER_BENCHMARKS in config_defines.h (instead of the renderer) and the CMake multitasker_benchmark target.
+*/
+
+namespace kth
+{
+
+	struct BenchmarkOptions
+	{
+		// 0 : one per logical processor
+		uint32_t max_workers = 0;
+		// Scales every benchmark's iteration count, lower for a quick run
+		double iteration_scale = 1.0;
+	};
+
+	struct BenchmarkResult
+	{
+		std::string benchmark;
+		uint32_t workers;
+		std::string metric;
+		double value;
+		std::string unit;
+	};
+
+	std::vector<BenchmarkResult> run_multitasker_benchmarks(const BenchmarkOptions& options);
+
+	bool write_benchmark_json(const std::vector<BenchmarkResult>& results, const std::string& path);
+	bool write_benchmark_csv(const std::vector<BenchmarkResult>& results, const std::string& path);
+
+	// Prints the results, writes multitasker_benchmarks.json and .csv in the working directory, then std::_Exit,
+	// 1 if a file could not be written
+	[[noreturn]] void run_multitasker_benchmarks_and_exit(const BenchmarkOptions& options);
+
+}
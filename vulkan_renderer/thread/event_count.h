@@ -0,0 +1,82 @@
+#pragma once
+#include <thread/thread.h>
+
+#include <atomic>
+#include <cstdint>
+
+/*
+Event count : lets a thread sleep until "something changed" without a lost wake up, and costs a single load to
+the notifier when nobody sleeps.
+
+waiter   : key = prepare_wait() ; check the condition again ; if true cancel_wait() else wait(key)
+notifier : make the condition true ; notify(n)
+*/
+
+namespace kth
+{
+
+	class EventCount
+	{
+	public:
+		EventCount() : _epoch(0), _waiters(0) {}
+
+		EventCount(const EventCount&) = delete;
+		EventCount& operator=(const EventCount&) = delete;
+
+		uint32_t prepare_wait()
+		{
+			_waiters.fetch_add(1, std::memory_order_seq_cst);
+			// Orders the waiter registration before the caller's re-check of its condition
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			return _epoch.load(std::memory_order_acquire);
+		}
+
+		void cancel_wait()
+		{
+			_waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		void wait(uint32_t key)
+		{
+			while (_epoch.load(std::memory_order_acquire) == key)
+				futex_wait(&_epoch, key);
+			_waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		// Same as wait, but also returns after about timeout_ns
+		void wait_for(uint32_t key, uint64_t timeout_ns)
+		{
+			if (_epoch.load(std::memory_order_acquire) == key)
+				futex_wait(&_epoch, key, timeout_ns);
+			_waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		// Wakes up to count sleeping waiters. Waiters between prepare_wait() and wait() always return.
+		void notify(uint32_t count)
+		{
+			// Orders the caller's condition update before the waiters check
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			uint32_t waiters = _waiters.load(std::memory_order_relaxed);
+			if (waiters == 0) return;
+
+			_epoch.fetch_add(1, std::memory_order_release);
+			futex_wake(&_epoch, count < waiters ? count : waiters);
+		}
+
+		void notify_all()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_waiters.load(std::memory_order_relaxed) == 0) return;
+
+			_epoch.fetch_add(1, std::memory_order_release);
+			futex_wake_all(&_epoch);
+		}
+
+		uint32_t waiter_count() const { return _waiters.load(std::memory_order_relaxed); }
+
+	private:
+		std::atomic<uint32_t> _epoch;
+		std::atomic<uint32_t> _waiters;
+	};
+
+}
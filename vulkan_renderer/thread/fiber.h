@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <functional>
 
 namespace kth
@@ -16,7 +17,8 @@ namespace kth
 		void* address;
 	};
 
-	Fiber create_fiber(FIBER_FUNC_PTR(func), void* user_args);
+	// stack_size 0 : platform default (1 MB). Stacks end in a guard page, overflowing one reports it and crashes.
+	Fiber create_fiber(FIBER_FUNC_PTR(func), void* user_args, size_t stack_size = 0);
 
 	Fiber convert_thread_to_fiber();
 	void switch_to_fiber(Fiber& fiber);
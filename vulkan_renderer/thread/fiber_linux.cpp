@@ -0,0 +1,304 @@
+#include "fiber.h"
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+/*
+Linux fibers : stacks are mmap'd with a PROT_NONE guard page below them, and switching only saves
+the callee-saved registers (plus the FPU control words on x86-64) on the outgoing stack then swaps
+the stack pointer. No syscall is made on a switch, unlike swapcontext which saves the signal mask.
+*/
+
+namespace
+{
+	// Same default as CreateFiber(0, ...) on Windows
+	const size_t default_fiber_stack_size = 1024 * 1024;
+
+	struct FiberContext
+	{
+		void* stack_pointer = nullptr;
+		char* mapping = nullptr;
+		size_t mapping_size = 0;
+		FIBER_FUNC_PTR(function) = nullptr;
+		void* user_args = nullptr;
+	};
+
+	thread_local FiberContext* current_fiber = nullptr;
+
+	// The overflow handler runs on its own stack : the faulting one has no room left
+	const size_t signal_stack_size = 64 * 1024;
+	struct sigaction previous_segv_action;
+	size_t guard_page_size = 0;
+
+	void segv_handler(int signal, siginfo_t* info, void* context)
+	{
+		FiberContext* fiber = current_fiber;
+		char* address = static_cast<char*>(info->si_addr);
+		if (fiber && fiber->mapping && address >= fiber->mapping && address < fiber->mapping + guard_page_size)
+		{
+			const char message[] = "kth : fiber stack overflow\n";
+			ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+			(void)written;
+		}
+
+		// Let the previous handler (or the default action, a core dump) deal with the fault
+		if (previous_segv_action.sa_flags & SA_SIGINFO)
+		{
+			previous_segv_action.sa_sigaction(signal, info, context);
+		}
+		else if (previous_segv_action.sa_handler != SIG_DFL && previous_segv_action.sa_handler != SIG_IGN)
+		{
+			previous_segv_action.sa_handler(signal);
+		}
+		else
+		{
+			// Returning re-executes the faulting access, with the default action this time
+			struct sigaction default_action = {};
+			default_action.sa_handler = SIG_DFL;
+			sigaction(SIGSEGV, &default_action, nullptr);
+		}
+	}
+
+	void install_overflow_handler()
+	{
+		static std::once_flag installed;
+		std::call_once(installed, []
+		{
+			guard_page_size = (size_t)sysconf(_SC_PAGESIZE);
+			struct sigaction action = {};
+			action.sa_sigaction = segv_handler;
+			action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+			sigemptyset(&action.sa_mask);
+			sigaction(SIGSEGV, &action, &previous_segv_action);
+		});
+
+		// Per thread, leaked with the thread : workers live as long as the process
+		stack_t signal_stack = {};
+		signal_stack.ss_sp = mmap(nullptr, signal_stack_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (signal_stack.ss_sp == MAP_FAILED) return;
+		signal_stack.ss_size = signal_stack_size;
+		sigaltstack(&signal_stack, nullptr);
+	}
+}
+
+extern "C"
+{
+	void kth_fiber_switch(void** from_stack_pointer, void* to_stack_pointer);
+	void kth_fiber_trampoline();
+
+	__attribute__((used)) void kth_fiber_entry(FiberContext* context)
+	{
+		context->function(context->user_args);
+		// Returning from a fiber function exits the thread, as on Windows. The trampoline has no unwind info
+		// so the forced unwind stops right here and resumes on the thread's own stack to terminate it.
+		pthread_exit(nullptr);
+	}
+}
+
+#if defined(__x86_64__)
+
+asm(R"(
+	.text
+	.globl kth_fiber_switch
+	.hidden kth_fiber_switch
+	.type kth_fiber_switch, @function
+	.p2align 4
+kth_fiber_switch:
+	pushq %rbp
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	pushq %r14
+	pushq %r15
+	subq $16, %rsp
+	fnstcw (%rsp)
+	stmxcsr 8(%rsp)
+	movq %rsp, (%rdi)
+	movq %rsi, %rsp
+	fldcw (%rsp)
+	ldmxcsr 8(%rsp)
+	addq $16, %rsp
+	popq %r15
+	popq %r14
+	popq %r13
+	popq %r12
+	popq %rbx
+	popq %rbp
+	ret
+	.size kth_fiber_switch, .-kth_fiber_switch
+
+	.globl kth_fiber_trampoline
+	.hidden kth_fiber_trampoline
+	.type kth_fiber_trampoline, @function
+	.p2align 4
+kth_fiber_trampoline:
+	movq %r12, %rdi
+	call kth_fiber_entry
+	ud2
+	.size kth_fiber_trampoline, .-kth_fiber_trampoline
+)");
+
+namespace
+{
+	// Builds the frame kth_fiber_switch pops on its first switch to this fiber : r12 holds the context, ret lands in the trampoline
+	void* init_fiber_stack(char* stack_top, FiberContext* context)
+	{
+		uint64_t* top = reinterpret_cast<uint64_t*>(reinterpret_cast<uintptr_t>(stack_top) & ~uintptr_t(15));
+		uint64_t* sp = top - 11;
+
+		uint16_t fpu_control_word = 0x037F;
+		uint32_t mxcsr = 0x1F80;
+		memcpy(&sp[0], &fpu_control_word, sizeof(fpu_control_word));
+		memcpy(&sp[1], &mxcsr, sizeof(mxcsr));
+		sp[2] = 0; // r15
+		sp[3] = 0; // r14
+		sp[4] = 0; // r13
+		sp[5] = reinterpret_cast<uint64_t>(context); // r12
+		sp[6] = 0; // rbx
+		sp[7] = 0; // rbp
+		sp[8] = reinterpret_cast<uint64_t>(&kth_fiber_trampoline);
+		// sp[9] and sp[10] : rsp is 16-byte aligned after ret, as the trampoline's call requires
+		sp[9] = 0;
+		sp[10] = 0;
+		return sp;
+	}
+}
+
+#elif defined(__aarch64__)
+
+asm(R"(
+	.text
+	.globl kth_fiber_switch
+	.hidden kth_fiber_switch
+	.type kth_fiber_switch, %function
+	.p2align 4
+kth_fiber_switch:
+	sub sp, sp, #160
+	stp x19, x20, [sp, #0]
+	stp x21, x22, [sp, #16]
+	stp x23, x24, [sp, #32]
+	stp x25, x26, [sp, #48]
+	stp x27, x28, [sp, #64]
+	stp x29, x30, [sp, #80]
+	stp d8, d9, [sp, #96]
+	stp d10, d11, [sp, #112]
+	stp d12, d13, [sp, #128]
+	stp d14, d15, [sp, #144]
+	mov x2, sp
+	str x2, [x0]
+	mov sp, x1
+	ldp x19, x20, [sp, #0]
+	ldp x21, x22, [sp, #16]
+	ldp x23, x24, [sp, #32]
+	ldp x25, x26, [sp, #48]
+	ldp x27, x28, [sp, #64]
+	ldp x29, x30, [sp, #80]
+	ldp d8, d9, [sp, #96]
+	ldp d10, d11, [sp, #112]
+	ldp d12, d13, [sp, #128]
+	ldp d14, d15, [sp, #144]
+	add sp, sp, #160
+	ret
+	.size kth_fiber_switch, .-kth_fiber_switch
+
+	.globl kth_fiber_trampoline
+	.hidden kth_fiber_trampoline
+	.type kth_fiber_trampoline, %function
+	.p2align 4
+kth_fiber_trampoline:
+	mov x0, x19
+	bl kth_fiber_entry
+	brk #0
+	.size kth_fiber_trampoline, .-kth_fiber_trampoline
+)");
+
+namespace
+{
+	// Builds the frame kth_fiber_switch pops on its first switch to this fiber : x19 holds the context, x30 points to the trampoline
+	void* init_fiber_stack(char* stack_top, FiberContext* context)
+	{
+		uint64_t* top = reinterpret_cast<uint64_t*>(reinterpret_cast<uintptr_t>(stack_top) & ~uintptr_t(15));
+		uint64_t* sp = top - 20;
+		memset(sp, 0, 20 * sizeof(uint64_t));
+		sp[0] = reinterpret_cast<uint64_t>(context); // x19
+		sp[11] = reinterpret_cast<uint64_t>(&kth_fiber_trampoline); // x30
+		return sp;
+	}
+}
+
+#else
+#error "fiber_linux.cpp : unsupported architecture"
+#endif
+
+namespace kth
+{
+
+	Fiber create_fiber(FIBER_FUNC_PTR(func), void* user_args, size_t requested_stack_size)
+	{
+		const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+		if (requested_stack_size == 0)
+			requested_stack_size = default_fiber_stack_size;
+		const size_t stack_size = (requested_stack_size + page_size - 1) & ~(page_size - 1);
+
+		FiberContext* context = new FiberContext;
+		context->function = func;
+		context->user_args = user_args;
+		context->mapping_size = stack_size + page_size;
+
+		void* mapping = mmap(nullptr, context->mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if (mapping == MAP_FAILED)
+		{
+			delete context;
+			return Fiber();
+		}
+		context->mapping = static_cast<char*>(mapping);
+
+		// Guard page : stacks grow down, an overflow faults instead of silently corrupting the neighbour mapping
+		mprotect(context->mapping, page_size, PROT_NONE);
+
+		context->stack_pointer = init_fiber_stack(context->mapping + context->mapping_size, context);
+
+		return Fiber(context);
+	}
+
+	Fiber convert_thread_to_fiber()
+	{
+		install_overflow_handler();
+
+		// The thread keeps its own stack, the context only stores its stack pointer while switched out
+		FiberContext* context = new FiberContext;
+		current_fiber = context;
+		return Fiber(context);
+	}
+
+	void switch_to_fiber(Fiber& fiber)
+	{
+		FiberContext* from = current_fiber;
+		FiberContext* to = static_cast<FiberContext*>(fiber.address);
+		current_fiber = to;
+		kth_fiber_switch(&from->stack_pointer, to->stack_pointer);
+	}
+
+	void delete_fiber(Fiber& fiber)
+	{
+		FiberContext* context = static_cast<FiberContext*>(fiber.address);
+		if (!context) return;
+
+		if (context->mapping)
+			munmap(context->mapping, context->mapping_size);
+		delete context;
+		fiber.address = nullptr;
+	}
+
+	Fiber get_current_fiber()
+	{
+		Fiber fiber;
+		fiber.address = current_fiber;
+		return fiber;
+	}
+}
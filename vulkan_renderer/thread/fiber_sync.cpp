@@ -0,0 +1,267 @@
+#include <thread/fiber_sync.h>
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+	std::mutex registry_mutex;
+	std::vector<kth::detail::SyncPrimitive*> registry;
+
+	struct BarrierWaiter
+	{
+		kth::fiber_barrier* barrier;
+		uint64_t phase;
+	};
+}
+
+namespace kth
+{
+
+	std::vector<SyncStats> sync_stats()
+	{
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		std::vector<SyncStats> stats;
+		for (detail::SyncPrimitive* primitive : registry)
+			stats.push_back(primitive->stats());
+		return stats;
+	}
+
+	namespace detail
+	{
+		SyncPrimitive::SyncPrimitive(Multitasker& tasker, const char* name)
+			: _tasker(&tasker), _first_waiter(nullptr), _last_waiter(nullptr), _waiter_count(0), _name(name), _acquisitions(0), _contentions(0), _peak_waiters(0)
+		{
+			if (_name)
+			{
+				std::lock_guard<std::mutex> lock(registry_mutex);
+				registry.push_back(this);
+			}
+		}
+
+		SyncPrimitive::~SyncPrimitive()
+		{
+			if (_name)
+			{
+				std::lock_guard<std::mutex> lock(registry_mutex);
+				registry.erase(std::find(registry.begin(), registry.end(), this));
+			}
+		}
+
+		SyncStats SyncPrimitive::stats() const
+		{
+			SyncStats stats;
+			stats.name = _name;
+			stats.acquisitions = _acquisitions.load(std::memory_order_relaxed);
+			stats.contentions = _contentions.load(std::memory_order_relaxed);
+			stats.peak_waiters = _peak_waiters.load(std::memory_order_relaxed);
+			return stats;
+		}
+
+		void SyncPrimitive::push_waiter(WaitingTask* waiting_task)
+		{
+			waiting_task->next = nullptr;
+			if (_last_waiter)
+				_last_waiter->next = waiting_task;
+			else
+				_first_waiter = waiting_task;
+			_last_waiter = waiting_task;
+
+			if (++_waiter_count > _peak_waiters.load(std::memory_order_relaxed))
+				_peak_waiters.store(_waiter_count, std::memory_order_relaxed);
+		}
+
+		WaitingTask* SyncPrimitive::pop_waiter()
+		{
+			WaitingTask* waiting_task = _first_waiter;
+			if (waiting_task)
+			{
+				_first_waiter = waiting_task->next;
+				if (!_first_waiter)
+					_last_waiter = nullptr;
+				--_waiter_count;
+			}
+			return waiting_task;
+		}
+	}
+
+	void fiber_mutex::lock()
+	{
+		if (try_lock()) return;
+
+		_contentions.fetch_add(1, std::memory_order_relaxed);
+		if (!is_worker_thread())
+		{
+			while (!try_lock())
+				std::this_thread::yield();
+			return;
+		}
+
+		// Resumed as the owner : unlock hands the mutex over without releasing it
+		_tasker->park(publish_waiter, this);
+		_acquisitions.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	bool fiber_mutex::try_lock()
+	{
+		std::lock_guard<SpinLock> lock(_state_lock);
+		if (_locked) return false;
+
+		_locked = true;
+		_acquisitions.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	void fiber_mutex::unlock()
+	{
+		WaitingTask* next_owner;
+		{
+			std::lock_guard<SpinLock> lock(_state_lock);
+			next_owner = pop_waiter();
+			if (!next_owner)
+				_locked = false;
+		}
+
+		if (next_owner)
+			_tasker->resume(next_owner);
+	}
+
+	bool fiber_mutex::publish_waiter(void* context, WaitingTask* waiting_task)
+	{
+		fiber_mutex& mutex = *static_cast<fiber_mutex*>(context);
+		std::lock_guard<SpinLock> lock(mutex._state_lock);
+
+		// Unlocked while the fiber was being switched out : it owns the mutex now
+		if (!mutex._locked)
+		{
+			mutex._locked = true;
+			return false;
+		}
+		mutex.push_waiter(waiting_task);
+		return true;
+	}
+
+	void fiber_semaphore::acquire()
+	{
+		if (try_acquire()) return;
+
+		_contentions.fetch_add(1, std::memory_order_relaxed);
+		if (!is_worker_thread())
+		{
+			while (!try_acquire())
+				std::this_thread::yield();
+			return;
+		}
+
+		_tasker->park(publish_waiter, this);
+		_acquisitions.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	bool fiber_semaphore::try_acquire()
+	{
+		std::lock_guard<SpinLock> lock(_state_lock);
+		if (_count == 0) return false;
+
+		--_count;
+		_acquisitions.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	void fiber_semaphore::release(uint32_t count)
+	{
+		// Waiters take their unit directly, only the rest goes back to the count. Kept in arrival order.
+		WaitingTask* released = nullptr;
+		WaitingTask* last_released = nullptr;
+		{
+			std::lock_guard<SpinLock> lock(_state_lock);
+			for (; count > 0 && _first_waiter; --count)
+			{
+				WaitingTask* waiting_task = pop_waiter();
+				waiting_task->next = nullptr;
+				if (last_released)
+					last_released->next = waiting_task;
+				else
+					released = waiting_task;
+				last_released = waiting_task;
+			}
+			_count += count;
+		}
+
+		while (released)
+		{
+			WaitingTask* next = released->next;
+			_tasker->resume(released);
+			released = next;
+		}
+	}
+
+	bool fiber_semaphore::publish_waiter(void* context, WaitingTask* waiting_task)
+	{
+		fiber_semaphore& semaphore = *static_cast<fiber_semaphore*>(context);
+		std::lock_guard<SpinLock> lock(semaphore._state_lock);
+
+		if (semaphore._count > 0)
+		{
+			--semaphore._count;
+			return false;
+		}
+		semaphore.push_waiter(waiting_task);
+		return true;
+	}
+
+	void fiber_barrier::arrive_and_wait()
+	{
+		_acquisitions.fetch_add(1, std::memory_order_relaxed);
+
+		uint64_t phase;
+		WaitingTask* released = nullptr;
+		{
+			std::lock_guard<SpinLock> lock(_state_lock);
+			phase = _phase.load(std::memory_order_relaxed);
+			if (++_arrived == _participant_count)
+			{
+				_arrived = 0;
+				_phase.store(phase + 1, std::memory_order_release);
+				released = _first_waiter;
+				_first_waiter = _last_waiter = nullptr;
+				_waiter_count = 0;
+			}
+		}
+
+		if (released || _phase.load(std::memory_order_relaxed) != phase)
+		{
+			while (released)
+			{
+				WaitingTask* next = released->next;
+				_tasker->resume(released);
+				released = next;
+			}
+			return;
+		}
+
+		_contentions.fetch_add(1, std::memory_order_relaxed);
+		if (!is_worker_thread())
+		{
+			while (_phase.load(std::memory_order_acquire) == phase)
+				std::this_thread::yield();
+			return;
+		}
+
+		BarrierWaiter waiter{ this, phase };
+		_tasker->park(publish_waiter, &waiter);
+	}
+
+	bool fiber_barrier::publish_waiter(void* context, WaitingTask* waiting_task)
+	{
+		BarrierWaiter& waiter = *static_cast<BarrierWaiter*>(context);
+		std::lock_guard<SpinLock> lock(waiter.barrier->_state_lock);
+
+		// The last participant arrived while the fiber was being switched out
+		if (waiter.barrier->_phase.load(std::memory_order_relaxed) != waiter.phase)
+			return false;
+		waiter.barrier->push_waiter(waiting_task);
+		return true;
+	}
+
+}
@@ -0,0 +1,136 @@
+#pragma once
+#include <thread/multitasker.h>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/*
+Fiber aware synchronization : a contended lock, acquire or barrier wait parks the calling fiber and gives its worker
+back to process_tasks instead of blocking the thread. Non-worker threads have no fiber to park, they yield until the
+primitive is available.
+
+Waiters are resumed in arrival order, a fiber_mutex is handed directly to its next waiter on unlock.
+Primitives given a name report their contention counters through sync_stats().
+*/
+
+namespace kth
+{
+
+	// For the few instructions of state the primitives below protect, never held across a park
+	class SpinLock
+	{
+	public:
+		SpinLock() : _locked(false) {}
+
+		void lock()
+		{
+			while (_locked.exchange(true, std::memory_order_acquire))
+			{
+				while (_locked.load(std::memory_order_relaxed))
+					cpu_pause();
+			}
+		}
+
+		void unlock() { _locked.store(false, std::memory_order_release); }
+
+	private:
+		std::atomic<bool> _locked;
+	};
+
+	struct SyncStats
+	{
+		const char* name = nullptr;
+		uint64_t acquisitions = 0;
+		// Acquisitions that had to wait
+		uint64_t contentions = 0;
+		uint32_t peak_waiters = 0;
+	};
+
+	// Every live named primitive
+	std::vector<SyncStats> sync_stats();
+
+	namespace detail
+	{
+		class SyncPrimitive
+		{
+		public:
+			SyncStats stats() const;
+
+		protected:
+			SyncPrimitive(Multitasker& tasker, const char* name);
+			~SyncPrimitive();
+
+			SyncPrimitive(const SyncPrimitive&) = delete;
+			SyncPrimitive& operator=(const SyncPrimitive&) = delete;
+
+			bool is_worker_thread() const { return Multitasker::get_current_thread_id() < _tasker->worker_count(); }
+
+			// Under _state_lock
+			void push_waiter(WaitingTask* waiting_task);
+			WaitingTask* pop_waiter();
+
+			Multitasker* _tasker;
+			SpinLock _state_lock;
+			WaitingTask* _first_waiter;
+			WaitingTask* _last_waiter;
+			uint32_t _waiter_count;
+
+			const char* _name;
+			std::atomic<uint64_t> _acquisitions;
+			std::atomic<uint64_t> _contentions;
+			std::atomic<uint32_t> _peak_waiters;
+		};
+	}
+
+	// Same interface as std::mutex, usable with std::lock_guard / std::unique_lock
+	class fiber_mutex : public detail::SyncPrimitive
+	{
+	public:
+		explicit fiber_mutex(Multitasker& tasker, const char* name = nullptr) : SyncPrimitive(tasker, name), _locked(false) {}
+
+		void lock();
+		bool try_lock();
+		void unlock();
+
+	private:
+		static bool publish_waiter(void* context, WaitingTask* waiting_task);
+
+		bool _locked;
+	};
+
+	class fiber_semaphore : public detail::SyncPrimitive
+	{
+	public:
+		fiber_semaphore(Multitasker& tasker, uint32_t initial_count, const char* name = nullptr) : SyncPrimitive(tasker, name), _count(initial_count) {}
+
+		void acquire();
+		bool try_acquire();
+		void release(uint32_t count = 1);
+
+	private:
+		static bool publish_waiter(void* context, WaitingTask* waiting_task);
+
+		uint32_t _count;
+	};
+
+	// Frame phases : the participant_count-th arrival releases everyone and starts the next phase.
+	// Participants must be separate tasks : the elements of one bundle run one after the other on the same fiber.
+	class fiber_barrier : public detail::SyncPrimitive
+	{
+	public:
+		fiber_barrier(Multitasker& tasker, uint32_t participant_count, const char* name = nullptr) : SyncPrimitive(tasker, name), _participant_count(participant_count), _arrived(0), _phase(0) {}
+
+		void arrive_and_wait();
+
+		uint64_t phase() const { return _phase.load(std::memory_order_acquire); }
+
+	private:
+		static bool publish_waiter(void* context, WaitingTask* waiting_task);
+
+		uint32_t _participant_count;
+		uint32_t _arrived;
+		std::atomic<uint64_t> _phase;
+	};
+
+}
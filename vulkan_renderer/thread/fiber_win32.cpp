@@ -8,10 +8,12 @@
 namespace kth
 {
 
-	Fiber create_fiber(FIBER_FUNC_PTR(func), void* user_args)
+	Fiber create_fiber(FIBER_FUNC_PTR(func), void* user_args, size_t stack_size)
 	{
+		// Only the reserve is stack_size, pages are committed on use behind Windows' own guard page
+		// (an overflow raises EXCEPTION_STACK_OVERFLOW)
 		Fiber fiber;
-		fiber.address = CreateFiber(0, (LPFIBER_START_ROUTINE)func, user_args);
+		fiber.address = CreateFiberEx(0, stack_size, FIBER_FLAG_FLOAT_SWITCH, (LPFIBER_START_ROUTINE)func, user_args);
 		return fiber;
 	}
 
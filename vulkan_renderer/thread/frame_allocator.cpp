@@ -0,0 +1,146 @@
+#include <thread/frame_allocator.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+	// Arenas start on a cache line, the bump offset is aligned relative to it
+	const size_t arena_alignment = 64;
+
+	char* align_up(char* pointer, size_t alignment)
+	{
+		return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(pointer) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	}
+
+	char* allocate_arena(size_t size)
+	{
+		return static_cast<char*>(kth::aligned_allocate(size, arena_alignment));
+	}
+
+	void update_max(std::atomic<size_t>& value, size_t candidate)
+	{
+		size_t current = value.load(std::memory_order_relaxed);
+		while (candidate > current && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {}
+	}
+}
+
+namespace kth
+{
+
+	FrameAllocator::FrameAllocator(Multitasker& tasker, uint32_t frames_in_flight, size_t worker_arena_size, size_t overflow_arena_size)
+		: _worker_count(tasker.worker_count()), _worker_arena_size(worker_arena_size), _overflow_arena_size(overflow_arena_size),
+		_current_frame(0), _frame_counter(0), _worker_high_water(0), _overflow_high_water(0), _heap_allocations(0)
+	{
+		for (uint32_t i = 0; i < frames_in_flight; ++i)
+		{
+			std::unique_ptr<Frame> frame(new Frame);
+			for (uint32_t worker = 0; worker < _worker_count; ++worker)
+			{
+				frame->worker_arenas.emplace_back(aligned_new<Arena>());
+				frame->worker_arenas.back()->memory = allocate_arena(_worker_arena_size);
+			}
+			frame->overflow = allocate_arena(_overflow_arena_size);
+			_frames.push_back(std::move(frame));
+		}
+	}
+
+	FrameAllocator::~FrameAllocator()
+	{
+		for (uint32_t i = 0; i < _frames.size(); ++i)
+		{
+			end_frame(i);
+			for (auto& arena : _frames[i]->worker_arenas)
+				aligned_free(arena->memory);
+			aligned_free(_frames[i]->overflow);
+		}
+	}
+
+	uint32_t FrameAllocator::begin_frame()
+	{
+		uint32_t frame = _frame_counter++ % (uint32_t)_frames.size();
+		if (_frames[frame]->in_use)
+			throw std::logic_error("FrameAllocator : frame memory reused before end_frame");
+
+		_frames[frame]->in_use = true;
+		// Release : workers reading the new frame index see its arenas reset
+		_current_frame.store(frame, std::memory_order_release);
+		return frame;
+	}
+
+	void FrameAllocator::end_frame(uint32_t frame_index)
+	{
+		Frame& frame = *_frames[frame_index];
+
+		for (auto& arena : frame.worker_arenas)
+		{
+			update_max(_worker_high_water, arena->offset);
+			arena->offset = 0;
+		}
+
+		update_max(_overflow_high_water, frame.overflow_offset.load(std::memory_order_relaxed));
+		frame.overflow_offset.store(0, std::memory_order_relaxed);
+
+		for (void* allocation : frame.heap_allocations)
+			::operator delete(allocation);
+		frame.heap_allocations.clear();
+
+		frame.in_use = false;
+	}
+
+	void* FrameAllocator::allocate(size_t size, size_t alignment)
+	{
+		Frame& frame = *_frames[_current_frame.load(std::memory_order_acquire)];
+
+		// Nothing below can suspend the fiber : the worker id stays valid until the bump is done
+		uint32_t id = Multitasker::get_current_thread_id();
+		if (id < _worker_count)
+		{
+			Arena& arena = *frame.worker_arenas[id];
+			char* base = arena.memory;
+			char* pointer = align_up(base + arena.offset, alignment);
+			if (pointer + size <= base + _worker_arena_size)
+			{
+				arena.offset = (size_t)(pointer + size - base);
+				return pointer;
+			}
+		}
+
+		return allocate_overflow(frame, size, alignment);
+	}
+
+	void* FrameAllocator::allocate_overflow(Frame& frame, size_t size, size_t alignment)
+	{
+		char* base = frame.overflow;
+		size_t offset = frame.overflow_offset.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			char* pointer = align_up(base + offset, alignment);
+			size_t end = (size_t)(pointer + size - base);
+			if (end > _overflow_arena_size) break;
+			if (frame.overflow_offset.compare_exchange_weak(offset, end, std::memory_order_relaxed))
+				return pointer;
+		}
+
+		// Past the overflow arena : counted, the stats tell which arena to grow
+		_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+		char* allocation = static_cast<char*>(::operator new(size + alignment));
+		{
+			std::lock_guard<std::mutex> lock(frame.heap_mutex);
+			frame.heap_allocations.push_back(allocation);
+		}
+		return align_up(allocation, alignment);
+	}
+
+	FrameAllocatorStats FrameAllocator::stats() const
+	{
+		FrameAllocatorStats stats;
+		stats.worker_arena_size = _worker_arena_size;
+		stats.worker_high_water = _worker_high_water.load(std::memory_order_relaxed);
+		stats.overflow_arena_size = _overflow_arena_size;
+		stats.overflow_high_water = _overflow_high_water.load(std::memory_order_relaxed);
+		stats.heap_allocations = _heap_allocations.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+}
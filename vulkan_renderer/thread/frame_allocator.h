@@ -0,0 +1,100 @@
+#pragma once
+#include <thread/multitasker.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+Per-frame scratch memory for tasks : each worker bumps a pointer in its own arena, nothing is freed individually.
+A worker whose arena is full (and non-worker threads) take from a shared overflow arena, past it from the heap.
+
+Each of the frames in flight has its own arenas. The frame loop (one thread) :
+
+	uint32_t frame = frame_allocator.begin_frame();
+	... enqueue the frame's tasks, they allocate with frame_allocator.allocate
+	... later, once the frame's counter reached zero (waited on) :
+	frame_allocator.end_frame(frame);
+
+Allocations are valid until end_frame : a task allocating after begin_frame of the next frame gets memory of that
+next frame, tasks still running when their frame ends must not allocate.
+*/
+
+namespace kth
+{
+
+	struct FrameAllocatorStats
+	{
+		size_t worker_arena_size = 0;
+		// Highest over all workers and frames since the allocator was created
+		size_t worker_high_water = 0;
+		size_t overflow_arena_size = 0;
+		size_t overflow_high_water = 0;
+		// Allocations that did not fit in the overflow arena either
+		uint64_t heap_allocations = 0;
+	};
+
+	class FrameAllocator
+	{
+	public:
+		FrameAllocator(Multitasker& tasker, uint32_t frames_in_flight, size_t worker_arena_size, size_t overflow_arena_size);
+		~FrameAllocator();
+
+		FrameAllocator(const FrameAllocator&) = delete;
+		FrameAllocator& operator=(const FrameAllocator&) = delete;
+
+		// Moves allocations to the next frame's arenas. Throws std::logic_error if that frame was not ended.
+		uint32_t begin_frame();
+		// Resets the frame's arenas : none of its tasks may still use them
+		void end_frame(uint32_t frame);
+
+		// Any thread, never fails. alignment must be a power of two.
+		void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+		template<typename T>
+		T* allocate_array(size_t count) { return static_cast<T*>(allocate(sizeof(T) * count, alignof(T))); }
+
+		FrameAllocatorStats stats() const;
+
+	private:
+
+		// Only touched by its worker between begin_frame and end_frame, a cache line of its own (aligned_new) so
+		// workers do not share cache lines
+		struct alignas(64) Arena
+		{
+			char* memory = nullptr;
+			size_t offset = 0;
+		};
+
+		struct Frame
+		{
+			std::vector<std::unique_ptr<Arena, AlignedDelete>> worker_arenas;
+
+			char* overflow = nullptr;
+			std::atomic<size_t> overflow_offset{ 0 };
+
+			std::mutex heap_mutex;
+			std::vector<void*> heap_allocations;
+
+			bool in_use = false;
+		};
+
+		void* allocate_overflow(Frame& frame, size_t size, size_t alignment);
+
+		uint32_t _worker_count;
+		size_t _worker_arena_size;
+		size_t _overflow_arena_size;
+
+		std::vector<std::unique_ptr<Frame>> _frames;
+		std::atomic<uint32_t> _current_frame;
+		uint32_t _frame_counter;
+
+		// Updated by end_frame
+		std::atomic<size_t> _worker_high_water;
+		std::atomic<size_t> _overflow_high_water;
+		std::atomic<uint64_t> _heap_allocations;
+	};
+
+}
@@ -0,0 +1,158 @@
+#include <thread/io_service.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+
+namespace kth
+{
+
+	IoService::IoService(Multitasker& tasker, uint32_t queue_depth, uint32_t fallback_threads)
+		: _tasker(tasker), _uring(detail::create_io_uring(queue_depth, complete)), _stop(false),
+		_uring_reads(0), _fallback_reads(0), _bytes_read(0), _in_flight(0)
+	{
+		// Created from a thread pinned to a worker's processor : they would share it with that worker
+		if (_uring)
+		{
+			_completion_thread = std::thread([uring = _uring]
+			{
+				std::this_thread::clear_affinity();
+				detail::run_io_uring_completions(uring);
+			});
+		}
+
+		// Also takes the reads that do not fit in a full ring
+		for (uint32_t i = 0; i < std::max(1u, fallback_threads); ++i)
+		{
+			_fallback_threads.emplace_back([this]
+			{
+				std::this_thread::clear_affinity();
+				fallback_thread_routine();
+			});
+		}
+	}
+
+	IoService::~IoService()
+	{
+		while (_in_flight.load() != 0)
+			std::this_thread::yield();
+
+		if (_uring)
+		{
+			detail::stop_io_uring(_uring);
+			_completion_thread.join();
+			detail::destroy_io_uring(_uring);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_fallback_mutex);
+			_stop = true;
+		}
+		_fallback_available.notify_all();
+		for (auto& thread : _fallback_threads)
+			thread.join();
+	}
+
+	CounterHandle IoService::read_file(const std::string& path, IoRead& read)
+	{
+		return submit(path, 0, 0, true, read);
+	}
+
+	CounterHandle IoService::read(const std::string& path, uint64_t offset, size_t size, IoRead& read)
+	{
+		return submit(path, offset, size, false, read);
+	}
+
+	CounterHandle IoService::submit(const std::string& path, uint64_t offset, size_t size, bool whole_file, IoRead& read)
+	{
+		read.data.clear();
+		read.error = 0;
+
+		// Copied out : the request can complete and be deleted before submit returns
+		CounterHandle counter = Multitasker::acquire_counter(1);
+		detail::IoRequest* request = new detail::IoRequest{ this, &_tasker, counter, &read, path, offset, size, whole_file, -1, 0 };
+
+		_in_flight.fetch_add(1);
+		if (_uring && detail::submit_io_uring(_uring, request))
+		{
+			_uring_reads.fetch_add(1, std::memory_order_relaxed);
+			return counter;
+		}
+
+		_fallback_reads.fetch_add(1, std::memory_order_relaxed);
+		{
+			std::lock_guard<std::mutex> lock(_fallback_mutex);
+			_fallback_requests.push_back(request);
+		}
+		_fallback_available.notify_one();
+		return counter;
+	}
+
+	void IoService::complete(detail::IoRequest* request)
+	{
+		IoService* service = request->service;
+		Multitasker* tasker = request->tasker;
+		CounterHandle counter = request->counter;
+		service->_bytes_read.fetch_add(request->read->data.size(), std::memory_order_relaxed);
+		delete request;
+
+		tasker->signal(counter);
+		// Last : the destructor can run as soon as this reaches zero
+		service->_in_flight.fetch_sub(1);
+	}
+
+	void IoService::fallback_thread_routine()
+	{
+		for (;;)
+		{
+			detail::IoRequest* request;
+			{
+				std::unique_lock<std::mutex> lock(_fallback_mutex);
+				_fallback_available.wait(lock, [this] { return _stop || !_fallback_requests.empty(); });
+				if (_fallback_requests.empty()) return;
+				request = _fallback_requests.front();
+				_fallback_requests.pop_front();
+			}
+
+			IoRead& read = *request->read;
+			errno = 0;
+			std::ifstream file(request->path, std::ios::binary);
+			if (!file)
+			{
+				read.error = errno ? errno : ENOENT;
+				complete(request);
+				continue;
+			}
+
+			size_t size = request->size;
+			uint64_t offset = request->offset;
+			if (request->whole_file)
+			{
+				file.seekg(0, std::ios::end);
+				size = (size_t)file.tellg();
+				offset = 0;
+			}
+
+			read.data.resize(size);
+			file.seekg((std::streamoff)offset);
+			file.read(read.data.data(), (std::streamsize)size);
+			// Reading past the end is a short read, not an error
+			read.data.resize((size_t)file.gcount());
+			if (file.bad())
+				read.error = EIO;
+
+			complete(request);
+		}
+	}
+
+	IoStats IoService::stats() const
+	{
+		IoStats stats;
+		stats.uring_reads = _uring_reads.load(std::memory_order_relaxed);
+		stats.fallback_reads = _fallback_reads.load(std::memory_order_relaxed);
+		stats.bytes_read = _bytes_read.load(std::memory_order_relaxed);
+		stats.in_flight = _in_flight.load(std::memory_order_relaxed);
+		return stats;
+	}
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <thread/multitasker.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Asynchronous file reads for tasks : a read returns a counter that reaches zero once the data is in, a fiber can
+wait_for it (and its worker keeps running other tasks meanwhile), or wait_for_async / task<T> can continue on it.
+
+	kth::IoRead read;
+	auto counter = io.read_file("data/texture.png", read);
+	... other work
+	tasker.wait_for(counter, 0);
+	kth::Multitasker::release_counter(counter);
+	if (read.error == 0) decode(read.data);
+
+On Linux reads go through io_uring, a completion thread signals the counters. Where io_uring is not available
+(other platforms, old kernels, seccomp) and when its ring is full, reads are done by a small pool of I/O threads.
+Opening the file is synchronous in both cases.
+*/
+
+namespace kth
+{
+
+	struct IoRead
+	{
+		std::vector<char> data;
+		// 0 on success, otherwise an errno value
+		int error = 0;
+	};
+
+	struct IoStats
+	{
+		uint64_t uring_reads = 0;
+		uint64_t fallback_reads = 0;
+		uint64_t bytes_read = 0;
+		uint32_t in_flight = 0;
+	};
+
+	namespace detail
+	{
+		struct IoRequest;
+		struct IoUring;
+
+		typedef void(*IoCompleteFunc)(IoRequest* request);
+
+		// Platform backend, io_service_linux.cpp / io_service_win32.cpp. create_io_uring returns nullptr if unavailable.
+		IoUring* create_io_uring(uint32_t queue_depth, IoCompleteFunc complete);
+		// False if the ring is full or the kernel refused the read : the request is left for the fallback threads.
+		// Otherwise complete is called once it is done, with read->error set if it failed.
+		bool submit_io_uring(IoUring* uring, IoRequest* request);
+		// Completion thread : blocks for completions until stop_io_uring
+		void run_io_uring_completions(IoUring* uring);
+		void stop_io_uring(IoUring* uring);
+		// Once run_io_uring_completions returned
+		void destroy_io_uring(IoUring* uring);
+	}
+
+	class IoService
+	{
+	public:
+		// queue_depth : io_uring submission queue size, fallback_threads : I/O threads when io_uring is unavailable or full
+		IoService(Multitasker& tasker, uint32_t queue_depth = 64, uint32_t fallback_threads = 2);
+		// Waits for the reads in flight
+		~IoService();
+
+		IoService(const IoService&) = delete;
+		IoService& operator=(const IoService&) = delete;
+
+		// read must live until the counter reached zero. Any thread.
+		CounterHandle read_file(const std::string& path, IoRead& read);
+		// Reads up to size bytes at offset, read.data is resized to what was read
+		CounterHandle read(const std::string& path, uint64_t offset, size_t size, IoRead& read);
+
+		bool uses_io_uring() const { return _uring != nullptr; }
+		IoStats stats() const;
+
+	private:
+		CounterHandle submit(const std::string& path, uint64_t offset, size_t size, bool whole_file, IoRead& read);
+		static void complete(detail::IoRequest* request);
+		void fallback_thread_routine();
+
+		Multitasker& _tasker;
+
+		detail::IoUring* _uring;
+		std::thread _completion_thread;
+
+		std::vector<std::thread> _fallback_threads;
+		std::mutex _fallback_mutex;
+		std::condition_variable _fallback_available;
+		std::deque<detail::IoRequest*> _fallback_requests;
+		bool _stop;
+
+		std::atomic<uint64_t> _uring_reads;
+		std::atomic<uint64_t> _fallback_reads;
+		std::atomic<uint64_t> _bytes_read;
+		std::atomic<uint32_t> _in_flight;
+	};
+
+	namespace detail
+	{
+		struct IoRequest
+		{
+			IoService* service;
+			Multitasker* tasker;
+			CounterHandle counter;
+			IoRead* read;
+
+			std::string path;
+			uint64_t offset;
+			size_t size;
+			bool whole_file;
+
+			// io_uring : file descriptor and bytes already read, short reads are resubmitted for the rest
+			int file;
+			size_t done;
+		};
+	}
+
+}
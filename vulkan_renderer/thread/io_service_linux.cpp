@@ -0,0 +1,325 @@
+#include <thread/io_service.h>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+/*
+Raw io_uring (no liburing) : one submission ring shared by all threads under a mutex, the completion thread waits in
+io_uring_enter. Needs IORING_OP_READ (Linux 5.6), older kernels and sandboxes without io_uring use the fallback threads.
+*/
+
+namespace
+{
+	// A single read is capped, the rest is resubmitted like a short read
+	const size_t max_read_size = 1u << 30;
+
+	int io_uring_setup(uint32_t entries, io_uring_params* params)
+	{
+		return (int)syscall(__NR_io_uring_setup, entries, params);
+	}
+
+	int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+	{
+		return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+	}
+
+	int io_uring_register(int fd, uint32_t opcode, void* arg, uint32_t arg_count)
+	{
+		return (int)syscall(__NR_io_uring_register, fd, opcode, arg, arg_count);
+	}
+
+	// The ring indices are shared with the kernel
+	uint32_t load_acquire(const uint32_t* address) { return __atomic_load_n(address, __ATOMIC_ACQUIRE); }
+	void store_release(uint32_t* address, uint32_t value) { __atomic_store_n(address, value, __ATOMIC_RELEASE); }
+}
+
+namespace kth
+{
+	namespace detail
+	{
+		struct IoUring
+		{
+			int fd = -1;
+			IoCompleteFunc complete = nullptr;
+
+			void* sq_ring = MAP_FAILED;
+			size_t sq_ring_size = 0;
+			void* cq_ring = MAP_FAILED;
+			size_t cq_ring_size = 0;
+			io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+			size_t sqes_size = 0;
+
+			uint32_t* sq_head = nullptr;
+			uint32_t* sq_tail = nullptr;
+			uint32_t sq_mask = 0;
+			uint32_t* sq_array = nullptr;
+			uint32_t sq_entries = 0;
+
+			uint32_t* cq_head = nullptr;
+			uint32_t* cq_tail = nullptr;
+			uint32_t cq_mask = 0;
+			io_uring_cqe* cqes = nullptr;
+
+			// Guards the submission ring and in_flight. At most sq_entries requests in flight : the completion ring
+			// (twice as large) cannot overflow.
+			std::mutex submit_mutex;
+			uint32_t in_flight = 0;
+		};
+
+		namespace
+		{
+			void release_io_uring(IoUring* uring)
+			{
+				if (uring->sqes != MAP_FAILED) munmap(uring->sqes, uring->sqes_size);
+				if (uring->cq_ring != MAP_FAILED && uring->cq_ring != uring->sq_ring) munmap(uring->cq_ring, uring->cq_ring_size);
+				if (uring->sq_ring != MAP_FAILED) munmap(uring->sq_ring, uring->sq_ring_size);
+				if (uring->fd >= 0) close(uring->fd);
+				delete uring;
+			}
+
+			bool supports_read(int fd)
+			{
+				const uint32_t op_count = 256;
+				size_t size = sizeof(io_uring_probe) + op_count * sizeof(io_uring_probe_op);
+				std::vector<char> memory(size, 0);
+				io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(memory.data());
+				// Probing itself is 5.6, as is IORING_OP_READ
+				if (io_uring_register(fd, IORING_REGISTER_PROBE, probe, op_count) < 0) return false;
+				return probe->last_op >= IORING_OP_READ && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+			}
+
+			// Under submit_mutex. A null request is the stop marker. Returns 0, or the errno io_uring_enter failed with :
+			// the entry is then taken back out of the ring.
+			int push_sqe(IoUring* uring, IoRequest* request)
+			{
+				uint32_t tail = *uring->sq_tail;
+				uint32_t index = tail & uring->sq_mask;
+				io_uring_sqe& sqe = uring->sqes[index];
+				memset(&sqe, 0, sizeof(sqe));
+
+				if (request)
+				{
+					size_t remaining = request->read->data.size() - request->done;
+					sqe.opcode = IORING_OP_READ;
+					sqe.fd = request->file;
+					sqe.addr = (uint64_t)(uintptr_t)(request->read->data.data() + request->done);
+					sqe.len = (uint32_t)std::min(remaining, max_read_size);
+					sqe.off = request->offset + request->done;
+				}
+				else
+				{
+					sqe.opcode = IORING_OP_NOP;
+				}
+				sqe.user_data = (uint64_t)(uintptr_t)request;
+
+				uring->sq_array[index] = index;
+				store_release(uring->sq_tail, tail + 1);
+
+				for (;;)
+				{
+					if (io_uring_enter(uring->fd, 1, 0, 0) >= 0)
+						return 0;
+					int error = errno;
+					if (error == EINTR)
+						continue;
+					// Each entry is submitted by its own enter under submit_mutex : on failure the kernel consumed none
+					if (load_acquire(uring->sq_head) == tail + 1)
+						return 0;
+					store_release(uring->sq_tail, tail);
+					return error;
+				}
+			}
+
+			void finish(IoUring* uring, IoRequest* request)
+			{
+				close(request->file);
+				request->read->data.resize(request->done);
+				{
+					std::lock_guard<std::mutex> lock(uring->submit_mutex);
+					--uring->in_flight;
+				}
+				uring->complete(request);
+			}
+
+			// Completion thread : the rest of a short or interrupted read. A refused one completes with the error.
+			void resubmit(IoUring* uring, IoRequest* request)
+			{
+				int error;
+				{
+					std::lock_guard<std::mutex> lock(uring->submit_mutex);
+					error = push_sqe(uring, request);
+				}
+				if (error != 0)
+				{
+					request->read->error = error;
+					finish(uring, request);
+				}
+			}
+		}
+
+		IoUring* create_io_uring(uint32_t queue_depth, IoCompleteFunc complete)
+		{
+			io_uring_params params;
+			memset(&params, 0, sizeof(params));
+			int fd = io_uring_setup(queue_depth, &params);
+			if (fd < 0) return nullptr;
+
+			IoUring* uring = new IoUring;
+			uring->fd = fd;
+			uring->complete = complete;
+			if (!supports_read(fd))
+			{
+				release_io_uring(uring);
+				return nullptr;
+			}
+
+			uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+			uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			if (params.features & IORING_FEAT_SINGLE_MMAP)
+				uring->sq_ring_size = uring->cq_ring_size = std::max(uring->sq_ring_size, uring->cq_ring_size);
+
+			uring->sq_ring = mmap(nullptr, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			if (uring->sq_ring == MAP_FAILED)
+			{
+				release_io_uring(uring);
+				return nullptr;
+			}
+			uring->cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? uring->sq_ring :
+				mmap(nullptr, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			uring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+			uring->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+			if (uring->cq_ring == MAP_FAILED || uring->sqes == MAP_FAILED)
+			{
+				release_io_uring(uring);
+				return nullptr;
+			}
+
+			char* sq = static_cast<char*>(uring->sq_ring);
+			uring->sq_head = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+			uring->sq_tail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+			uring->sq_mask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+			uring->sq_array = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+			uring->sq_entries = params.sq_entries;
+
+			char* cq = static_cast<char*>(uring->cq_ring);
+			uring->cq_head = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+			uring->cq_tail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+			uring->cq_mask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+			uring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+			return uring;
+		}
+
+		bool submit_io_uring(IoUring* uring, IoRequest* request)
+		{
+			{
+				std::lock_guard<std::mutex> lock(uring->submit_mutex);
+				if (uring->in_flight == uring->sq_entries) return false;
+				++uring->in_flight;
+			}
+
+			request->file = open(request->path.c_str(), O_RDONLY | O_CLOEXEC);
+			struct stat file_stat;
+			if (request->file < 0 || (request->whole_file && fstat(request->file, &file_stat) < 0))
+			{
+				request->read->error = errno;
+				if (request->file >= 0) close(request->file);
+				{
+					std::lock_guard<std::mutex> lock(uring->submit_mutex);
+					--uring->in_flight;
+				}
+				uring->complete(request);
+				return true;
+			}
+
+			if (request->whole_file)
+			{
+				request->offset = 0;
+				request->size = (size_t)file_stat.st_size;
+			}
+			request->read->data.resize(request->size);
+			if (request->size == 0)
+			{
+				finish(uring, request);
+				return true;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(uring->submit_mutex);
+				if (push_sqe(uring, request) == 0)
+					return true;
+				--uring->in_flight;
+			}
+
+			// Refused by the kernel (out of memory, resource limits) : the fallback threads read it instead
+			close(request->file);
+			request->file = -1;
+			return false;
+		}
+
+		void run_io_uring_completions(IoUring* uring)
+		{
+			for (;;)
+			{
+				uint32_t head = *uring->cq_head;
+				if (head == load_acquire(uring->cq_tail))
+				{
+					io_uring_enter(uring->fd, 0, 1, IORING_ENTER_GETEVENTS);
+					continue;
+				}
+
+				io_uring_cqe cqe = uring->cqes[head & uring->cq_mask];
+				store_release(uring->cq_head, head + 1);
+
+				IoRequest* request = reinterpret_cast<IoRequest*>((uintptr_t)cqe.user_data);
+				if (!request) return;
+
+				if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+				{
+					resubmit(uring, request);
+					continue;
+				}
+				if (cqe.res < 0)
+				{
+					request->read->error = -cqe.res;
+					finish(uring, request);
+					continue;
+				}
+
+				request->done += (size_t)cqe.res;
+				// Zero is the end of the file
+				if (cqe.res > 0 && request->done < request->read->data.size())
+				{
+					resubmit(uring, request);
+					continue;
+				}
+				finish(uring, request);
+			}
+		}
+
+		void stop_io_uring(IoUring* uring)
+		{
+			// Retried : the completion thread only returns once it received the marker
+			for (;;)
+			{
+				{
+					std::lock_guard<std::mutex> lock(uring->submit_mutex);
+					if (push_sqe(uring, nullptr) == 0)
+						return;
+				}
+				std::this_thread::yield();
+			}
+		}
+
+		void destroy_io_uring(IoUring* uring)
+		{
+			release_io_uring(uring);
+		}
+	}
+}
@@ -0,0 +1,31 @@
+#include <thread/io_service.h>
+
+// No io_uring : every read goes to the fallback threads
+
+namespace kth
+{
+	namespace detail
+	{
+		IoUring* create_io_uring(uint32_t, IoCompleteFunc)
+		{
+			return nullptr;
+		}
+
+		bool submit_io_uring(IoUring*, IoRequest*)
+		{
+			return false;
+		}
+
+		void run_io_uring_completions(IoUring*)
+		{
+		}
+
+		void stop_io_uring(IoUring*)
+		{
+		}
+
+		void destroy_io_uring(IoUring*)
+		{
+		}
+	}
+}
@@ -1,12 +1,17 @@
 #include <thread/multitasker.h>
 #include <thread/thread.h>
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 
 
 namespace
 {
 	FIBER_FUNC(process_task_fiber)
 	{
-		static_cast<kth::Multitasker*>(user_args)->process_tasks();
+		kth::PoolFiber* self = static_cast<kth::PoolFiber*>(user_args);
+		self->tasker->process_tasks(self);
 	}
 
 	FIBER_FUNC(fiber_switching_fiber_routine_fiber)
@@ -19,37 +24,166 @@ namespace
 		static_cast<kth::Multitasker*>(user_args)->waiting_counter_fiber_routine();
 	}
 
+	// Counters and closures are carved from blocks that are never freed : a thread still reading a counter after it was
+	// released (a decrement or a waiter publication racing with the release) only ever sees another valid counter
+	const uint32_t pool_block_size = 256;
+	// Past this many free objects, a thread hands its releases to the shared pool (producer/consumer thread pairs)
+	const uint32_t max_local_free_objects = 1024;
+
+	// auto_chunk splits bundles in up to this many chunks per worker, enough for stealing to even out uneven elements
+	const uint32_t bundle_chunks_per_worker = 4;
+	const uint32_t max_bundle_chunks = 256;
+	// Bundle tasks are pushed in bulk this many at a time, with a single wake each
+	const uint32_t bundle_push_batch = 256;
+
+	// A lower priority with work gets the next pop after being passed over this many times
+	const uint32_t starvation_limit = 32;
+	const uint32_t priority_count = (uint32_t)kth::TaskPriority::count;
+
+	const uint32_t fiber_stack_count = (uint32_t)kth::FiberStack::count;
+	// The switching and waiting fibers only run the scheduler's own loops
+	const size_t service_fiber_stack_size = 64 * 1024;
+
+	// Busy workers expire the timer wheel every this many tasks, idle ones every time they run out of work
+	const uint32_t timer_poll_interval = 64;
+
+	// 24 byte records : 1.5 MB per worker
+	const uint32_t trace_events_per_worker = 64 * 1024;
+
+	template<typename T>
+	struct FreeList
+	{
+		T* head = nullptr;
+		uint32_t count = 0;
+	};
+
+	template<typename T>
+	T* pop_free(FreeList<T>& free_list, moodycamel::ConcurrentQueue<T*>& shared_free, T* (*allocate_block)())
+	{
+		if (!free_list.head)
+		{
+			T* objects[64];
+			size_t count = shared_free.try_dequeue_bulk(objects, 64);
+			if (count == 0)
+			{
+				T* block = allocate_block();
+				for (uint32_t i = 0; i < pool_block_size; ++i)
+				{
+					block[i].next_free = free_list.head;
+					free_list.head = &block[i];
+				}
+				free_list.count += pool_block_size;
+			}
+			else
+			{
+				for (size_t i = 0; i < count; ++i)
+				{
+					objects[i]->next_free = free_list.head;
+					free_list.head = objects[i];
+				}
+				free_list.count += (uint32_t)count;
+			}
+		}
+
+		T* object = free_list.head;
+		free_list.head = object->next_free;
+		--free_list.count;
+		object->next_free = nullptr;
+		return object;
+	}
+
+	template<typename T>
+	void push_free(FreeList<T>& free_list, moodycamel::ConcurrentQueue<T*>& shared_free, T* object)
+	{
+		if (free_list.count >= max_local_free_objects)
+		{
+			shared_free.enqueue(object);
+			return;
+		}
+		object->next_free = free_list.head;
+		free_list.head = object;
+		++free_list.count;
+	}
+
+	kth::AtomicCounter* allocate_counter_block()
+	{
+		return new kth::AtomicCounter[pool_block_size];
+	}
+
+	// operator new only guarantees 16 bytes of alignment before C++17, closures are cache line aligned by hand
+	kth::TaskClosure* allocate_closure_block()
+	{
+		const size_t alignment = alignof(kth::TaskClosure);
+		char* memory = static_cast<char*>(::operator new(sizeof(kth::TaskClosure) * pool_block_size + alignment));
+		kth::TaskClosure* block = reinterpret_cast<kth::TaskClosure*>((reinterpret_cast<uintptr_t>(memory) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+		for (uint32_t i = 0; i < pool_block_size; ++i)
+			new (&block[i]) kth::TaskClosure();
+		return block;
+	}
+
+	uint64_t timer_now()
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	thread_local FreeList<kth::AtomicCounter> local_free_counters;
+	moodycamel::ConcurrentQueue<kth::AtomicCounter*> shared_free_counters;
+	thread_local FreeList<kth::TaskClosure> local_free_closures;
+	moodycamel::ConcurrentQueue<kth::TaskClosure*> shared_free_closures;
+
 }
 
+#if KTH_TRACE
+#define TRACE_EVENT(...) _tracer->record(__VA_ARGS__)
+#else
+#define TRACE_EVENT(...) ((void)0)
+#endif
+
+#ifdef _MSC_VER
+#define KTH_NOINLINE __declspec(noinline)
+#else
+#define KTH_NOINLINE __attribute__((noinline))
+#endif
+
 namespace kth
 {
 
 	thread_local uint32_t Multitasker::thread_id = -1;
-	thread_local Fiber Multitasker::_fiber_switching_fiber_origin(nullptr);
-	thread_local Fiber Multitasker::_fiber_switching_fiber_destination(nullptr);
-	thread_local Fiber Multitasker::_waiting_counter_fiber_origin(nullptr);
-	thread_local Fiber Multitasker::_waiting_counter_fiber_destination(nullptr);
-	thread_local std::shared_ptr<AtomicCounter> Multitasker::_waiting_counter_fiber_counter(nullptr);
-	thread_local int Multitasker::_waiting_counter_fiber_counter_target(0);
-	thread_local int Multitasker::_waiting_counter_fiber_affinity(0);
 	
 
-	Multitasker::Multitasker(uint32_t worker_threads, uint32_t fiber_pool_size, std::function<void(uint32_t)> init_func)
+	Multitasker::Multitasker(uint32_t worker_threads, const FiberPoolDesc& fiber_pool, std::function<void(uint32_t)> init_func, bool smt_siblings)
+		: _timers(timer_now())
 	{
 		_stop = false;
-		for (uint32_t i = 0; i < fiber_pool_size; ++i)
+		for (uint32_t stack = 0; stack < fiber_stack_count; ++stack)
+		{
+			_fiber_pools[stack].stack_size = fiber_pool.stack_size[stack];
+			_fiber_pools[stack].max_count = std::max(fiber_pool.max_count[stack], fiber_pool.initial_count[stack]);
+			for (uint32_t i = 0; i < fiber_pool.initial_count[stack]; ++i)
+			{
+				++_fiber_pools[stack].created;
+				_fiber_pools[stack].free_fibers.enqueue(create_pool_fiber((FiberStack)stack));
+			}
+		}
+
+		// All workers must exist before any thread can push or steal
+		for (uint32_t i = 0; i < worker_threads; ++i)
 		{
-			_fiber_pool.enqueue(create_fiber(process_task_fiber, this));
+			_workers.emplace_back(aligned_new<Worker>());
+			_workers.back()->steal_seed = 2463534242u + i * 2654435761u;
 		}
-		
-		std::this_thread::set_affinity(0);
-		convert_thread_to_fiber();
+		place_workers(smt_siblings);
+#if KTH_TRACE
+		_tracer.reset(new Tracer(worker_threads, trace_events_per_worker));
+#endif
+
+		if (_workers[0]->processor != uint32_t(-1))
+			std::this_thread::set_affinity(_workers[0]->processor);
+		_main_fiber = convert_thread_to_fiber();
 		thread_id = 0;
-		_fiber_switching_fibers.resize(worker_threads);
-		_waiting_counter_fibers.resize(worker_threads);
 
-		_fiber_switching_fibers[thread_id] = create_fiber(fiber_switching_fiber_routine_fiber, this);
-		_waiting_counter_fibers[thread_id] = create_fiber(waiting_counter_fiber_routine_fiber, this);
+		_workers[thread_id]->fiber_switching_fiber = create_fiber(fiber_switching_fiber_routine_fiber, this, service_fiber_stack_size);
+		_workers[thread_id]->waiting_counter_fiber = create_fiber(waiting_counter_fiber_routine_fiber, this, service_fiber_stack_size);
 
 		_init_function = init_func;
 
@@ -65,26 +199,319 @@ namespace kth
 	{
 		thread_id = worker_id;
 		convert_thread_to_fiber();
-		std::this_thread::set_affinity(worker_id);
+		if (_workers[worker_id]->processor != uint32_t(-1))
+			std::this_thread::set_affinity(_workers[worker_id]->processor);
 
-		{
-			// std::lock_guard<std::recursive_mutex> lock(_mutex);
-			_fiber_switching_fibers[thread_id] = create_fiber(fiber_switching_fiber_routine_fiber, this);
-			_waiting_counter_fibers[thread_id] = create_fiber(waiting_counter_fiber_routine_fiber, this);
-		}
+		_workers[thread_id]->fiber_switching_fiber = create_fiber(fiber_switching_fiber_routine_fiber, this, service_fiber_stack_size);
+		_workers[thread_id]->waiting_counter_fiber = create_fiber(waiting_counter_fiber_routine_fiber, this, service_fiber_stack_size);
 		
 		// Callback init function
 		_init_function(worker_id);
-		
-		process_tasks();
+
+		// Tasks never run on the thread's own fiber : after a wait it could be resumed on another thread, and returning
+		// from init_worker there would unwind this thread's entry frames on the wrong thread. Pool fibers exit the thread
+		// they are on when process_tasks returns.
+		PoolFiber* fiber = acquire_pool_fiber(FiberStack::small);
+		switch_to_fiber(fiber->fiber);
+	}
+
+	PoolFiber* Multitasker::create_pool_fiber(FiberStack stack)
+	{
+		std::unique_ptr<PoolFiber> pool_fiber(new PoolFiber);
+		pool_fiber->tasker = this;
+		pool_fiber->stack = stack;
+		pool_fiber->fiber = create_fiber(process_task_fiber, pool_fiber.get(), _fiber_pools[(size_t)stack].stack_size);
+
+		std::lock_guard<std::mutex> lock(_pool_fibers_mutex);
+		_pool_fibers.push_back(std::move(pool_fiber));
+		return _pool_fibers.back().get();
+	}
+
+	PoolFiber* Multitasker::acquire_pool_fiber(FiberStack stack)
+	{
+		FiberPool& pool = _fiber_pools[(size_t)stack];
+
+		PoolFiber* fiber = nullptr;
+		if (!pool.free_fibers.try_dequeue(fiber))
+		{
+			// Grow while under the cap, past it wait for a fiber to come back
+			uint32_t created = pool.created.load(std::memory_order_relaxed);
+			while (created < pool.max_count && !pool.created.compare_exchange_weak(created, created + 1, std::memory_order_relaxed)) {}
+
+			if (created < pool.max_count)
+				fiber = create_pool_fiber(stack);
+			else
+				pool.free_fibers.wait_dequeue(fiber);
+		}
+
+		uint32_t in_use = pool.in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+		uint32_t peak = pool.peak_in_use.load(std::memory_order_relaxed);
+		while (in_use > peak && !pool.peak_in_use.compare_exchange_weak(peak, in_use, std::memory_order_relaxed)) {}
+		return fiber;
+	}
+
+	void Multitasker::release_pool_fiber(PoolFiber* fiber)
+	{
+		FiberPool& pool = _fiber_pools[(size_t)fiber->stack];
+		pool.in_use.fetch_sub(1, std::memory_order_relaxed);
+		pool.free_fibers.enqueue(fiber);
+	}
+
+	std::vector<FiberPoolStats> Multitasker::fiber_pool_stats() const
+	{
+		std::vector<FiberPoolStats> stats(fiber_stack_count);
+		for (uint32_t stack = 0; stack < fiber_stack_count; ++stack)
+		{
+			stats[stack].stack_size = _fiber_pools[stack].stack_size;
+			stats[stack].created = _fiber_pools[stack].created.load(std::memory_order_relaxed);
+			stats[stack].in_use = _fiber_pools[stack].in_use.load(std::memory_order_relaxed);
+			stats[stack].peak_in_use = _fiber_pools[stack].peak_in_use.load(std::memory_order_relaxed);
+		}
+		return stats;
+	}
+
+	void Multitasker::place_workers(bool smt_siblings)
+	{
+		const CpuTopology& topology = get_cpu_topology();
+		_numa_node_count = topology.numa_node_count;
+
+		// First hardware thread of every core before any sibling, performance cores first, grouped by NUMA node
+		std::vector<const LogicalProcessor*> layout;
+		for (auto& processor : topology.processors)
+			layout.push_back(&processor);
+		std::stable_sort(layout.begin(), layout.end(), [](const LogicalProcessor* a, const LogicalProcessor* b)
+		{
+			if (a->smt_index != b->smt_index) return a->smt_index < b->smt_index;
+			if (a->efficiency_core != b->efficiency_core) return b->efficiency_core;
+			if (a->numa_node != b->numa_node) return a->numa_node < b->numa_node;
+			return a->core < b->core;
+		});
+
+		// Siblings only when asked for or when there are more workers than cores, oversubscribed workers wrap around
+		uint32_t usable = (uint32_t)layout.size();
+		if (!smt_siblings && _workers.size() <= topology.core_count)
+			usable = std::min(usable, topology.core_count);
+
+		printf("Multitasker : %u workers, %u cores, %u logical processors, %u NUMA nodes\n",
+			(uint32_t)_workers.size(), topology.core_count, (uint32_t)topology.processors.size(), _numa_node_count);
+
+		for (uint32_t i = 0; i < _workers.size(); ++i)
+		{
+			if (usable == 0)
+			{
+				printf("  worker %u : not pinned\n", i);
+				continue;
+			}
+
+			const LogicalProcessor& processor = *layout[i % usable];
+			_workers[i]->processor = processor.id;
+			_workers[i]->numa_node = processor.numa_node;
+			printf("  worker %u : cpu %u (core %u%s, node %u%s)\n", i, processor.id, processor.core,
+				processor.smt_index ? ", SMT sibling" : "", processor.numa_node, processor.efficiency_core ? ", efficiency core" : "");
+		}
+	}
+
+	// Fibers can be resumed on another thread than the one they were suspended on :
+	// the thread id must be reloaded after any switch, never from a TLS address cached before it
+	KTH_NOINLINE uint32_t Multitasker::get_current_thread_id()
+	{
+		return thread_id;
+	}
+
+	KTH_NOINLINE CounterHandle Multitasker::acquire_counter(int value)
+	{
+		AtomicCounter* counter = pop_free(local_free_counters, shared_free_counters, allocate_counter_block);
+		counter->value.store(value, std::memory_order_relaxed);
+		return CounterHandle(counter);
+	}
+
+	KTH_NOINLINE void Multitasker::release_counter(CounterHandle counter)
+	{
+		if (!counter) return;
+		push_free(local_free_counters, shared_free_counters, counter.get());
+	}
+
+	KTH_NOINLINE TaskClosure* Multitasker::acquire_closure()
+	{
+		return pop_free(local_free_closures, shared_free_closures, allocate_closure_block);
+	}
+
+	KTH_NOINLINE void Multitasker::release_closure(TaskClosure* closure)
+	{
+		push_free(local_free_closures, shared_free_closures, closure);
+	}
+
+	// The closure is released by the worker that ran it, not the thread that enqueued it : the shared pool evens that out
+	TASK_FUNC(Multitasker::run_closure)
+	{
+		TaskClosure* closure = static_cast<TaskClosure*>(user_args);
+		closure->invoke(closure, TaskClosure::Call::run_and_destroy);
+		release_closure(closure);
+	}
+
+	// Periodic callables run again, the timer destroys them once cancelled
+	TASK_FUNC(Multitasker::run_closure_in_place)
+	{
+		TaskClosure* closure = static_cast<TaskClosure*>(user_args);
+		closure->invoke(closure, TaskClosure::Call::run);
+	}
+
+	CounterHandle Multitasker::enqueue_after(std::chrono::nanoseconds delay, TASK_FUNC_PTR(func), void* user_args, TaskDesc desc)
+	{
+		CounterHandle counter = acquire_counter(1);
+		ScheduledTask* timer = new ScheduledTask();
+		timer->task = Task(func, user_args, counter.get(), 0, 1);
+		timer->desc = desc;
+		schedule(timer, timer_now() + (uint64_t)std::max<int64_t>(delay.count(), 0));
+		return counter;
+	}
+
+	void Multitasker::enqueue_after_detached(std::chrono::nanoseconds delay, TASK_FUNC_PTR(func), void* user_args, TaskDesc desc)
+	{
+		ScheduledTask* timer = new ScheduledTask();
+		timer->task = Task(func, user_args, nullptr, 0, 1);
+		timer->desc = desc;
+		schedule(timer, timer_now() + (uint64_t)std::max<int64_t>(delay.count(), 0));
+	}
+
+	TimerHandle Multitasker::enqueue_periodic(std::chrono::nanoseconds period, TASK_FUNC_PTR(func), void* user_args, TaskDesc desc)
+	{
+		return schedule_periodic(period, Task(func, user_args, nullptr, 0, 1), nullptr, desc);
+	}
+
+	TimerHandle Multitasker::schedule_periodic(std::chrono::nanoseconds period, Task task, TaskClosure* closure, TaskDesc desc)
+	{
+		ScheduledTask* timer = new ScheduledTask();
+		timer->runs = acquire_counter(0).get();
+		timer->task = task;
+		timer->task.counter = timer->runs;
+		timer->desc = desc;
+		// Shorter periods than a tick would only ever skip
+		timer->period_ns = std::max<uint64_t>((uint64_t)std::max<int64_t>(period.count(), 0), TimerWheel::tick_ns);
+		timer->closure = closure;
+		schedule(timer, timer_now() + timer->period_ns);
+		return TimerHandle(timer);
+	}
+
+	void Multitasker::cancel_periodic(TimerHandle timer)
+	{
+		// Freed by the next poll that expires it with no run in flight
+		timer.get()->cancelled.store(true);
+	}
+
+	void Multitasker::schedule(ScheduledTask* timer, uint64_t deadline_ns)
+	{
+		timer->deadline_ns = deadline_ns;
+		bool earlier;
+		{
+			std::lock_guard<std::mutex> lock(_timers_mutex);
+			_timers.insert(timer, deadline_ns);
+			uint64_t next_deadline = _timers.next_deadline();
+			earlier = next_deadline < _next_timer_deadline.exchange(next_deadline);
+		}
+
+		// The worker sleeping until the previous deadline must go back to sleep with the new one
+		if (earlier)
+			_work_available.notify_all();
+	}
+
+	uint32_t Multitasker::poll_timers()
+	{
+		uint64_t now = timer_now();
+		if (now < _next_timer_deadline.load(std::memory_order_relaxed))
+			return 0;
+
+		std::unique_lock<std::mutex> lock(_timers_mutex, std::try_to_lock);
+		if (!lock.owns_lock())
+			return 0;
+
+		uint32_t pushed = 0;
+		ScheduledTask* finished = nullptr;
+		TimerNode* expired = _timers.advance(now);
+		while (expired)
+		{
+			ScheduledTask* timer = static_cast<ScheduledTask*>(expired);
+			expired = expired->next;
+
+			if (!timer->runs)
+			{
+				push_task(timer->task, timer->desc);
+				notify_pushed(1, timer->desc);
+				++pushed;
+				delete timer;
+				continue;
+			}
+
+			bool running = timer->runs->load() > 0;
+			if (timer->cancelled.load())
+			{
+				// Polled again every period until the last run finished
+				if (!running)
+				{
+					timer->next = finished;
+					finished = timer;
+					continue;
+				}
+			}
+			else if (!running)
+			{
+				timer->runs->value.fetch_add(1);
+				push_task(timer->task, timer->desc);
+				notify_pushed(1, timer->desc);
+				++pushed;
+			}
+
+			timer->deadline_ns = TimerWheel::next_period_deadline(timer->deadline_ns, timer->period_ns, now);
+			_timers.insert(timer, timer->deadline_ns);
+		}
+		_next_timer_deadline.store(_timers.next_deadline());
+		lock.unlock();
+
+		while (finished)
+		{
+			ScheduledTask* timer = finished;
+			finished = static_cast<ScheduledTask*>(timer->next);
+			if (timer->closure)
+			{
+				timer->closure->invoke(timer->closure, TaskClosure::Call::destroy);
+				release_closure(timer->closure);
+			}
+			release_counter(CounterHandle(timer->runs));
+			delete timer;
+		}
+		return pushed;
+	}
+
+	uint32_t Multitasker::local_task_count() const
+	{
+		uint32_t id = get_current_thread_id();
+		if (id >= _workers.size()) return 0;
+
+		int64_t size = 0;
+		for (auto& tasks : _workers[id]->tasks)
+			size += std::max(tasks.size(), int64_t(0));
+		return (uint32_t)size;
+	}
+
+	std::vector<WorkerStats> Multitasker::worker_stats() const
+	{
+		std::vector<WorkerStats> stats(_workers.size());
+		for (size_t i = 0; i < _workers.size(); ++i)
+		{
+			stats[i].executed_tasks = _workers[i]->executed_tasks.load(std::memory_order_relaxed);
+			stats[i].steals = _workers[i]->steals.load(std::memory_order_relaxed);
+			stats[i].failed_steals = _workers[i]->failed_steals.load(std::memory_order_relaxed);
+		}
+		return stats;
 	}
 
 	void Multitasker::fiber_switching_fiber_routine()
 	{
 		for (;;)
 		{
-			_fiber_pool.enqueue(_fiber_switching_fiber_origin);
-			switch_to_fiber(_fiber_switching_fiber_destination);
+			Worker& worker = *_workers[get_current_thread_id()];
+			release_pool_fiber(worker.fiber_switching_fiber_origin);
+			switch_to_fiber(worker.fiber_switching_fiber_destination);
 		}
 	}
 
@@ -92,65 +519,407 @@ namespace kth
 	{
 		for (;;)
 		{
-			
+			Worker& worker = *_workers[get_current_thread_id()];
+			// The waiting fiber is switched out, it can be published
+			if (worker.park_publish)
+			{
+				ParkPublishFunc publish = worker.park_publish;
+				worker.park_publish = nullptr;
+				if (!publish(worker.park_context, worker.waiting_counter_fiber_task))
+					resume(worker.waiting_counter_fiber_task);
+			}
+			else
 			{
-				std::lock_guard<std::recursive_mutex> lock(_mutex);
-				_waiting_tasks.emplace_back(_waiting_counter_fiber_origin, _waiting_counter_fiber_counter, _waiting_counter_fiber_counter_target, _waiting_counter_fiber_affinity);
+				add_waiter(worker.waiting_counter_fiber_counter, worker.waiting_counter_fiber_task);
 			}
-			switch_to_fiber(_waiting_counter_fiber_destination);
+			switch_to_fiber(worker.waiting_counter_fiber_destination);
 		}
 
 	}
 
-	void Multitasker::process_tasks()
+	void Multitasker::add_waiter(AtomicCounter* counter, WaitingTask* waiting_task)
 	{
-		uint32_t id = thread_id;
-		while (!_stop.load())
+		// Once published the waiter can be resumed (and its WaitingTask gone) at any time
+		int target = waiting_task->target;
+
+		WaitingTask* head = counter->waiters.load();
+		do
+		{
+			waiting_task->next = head;
+		} while (!counter->waiters.compare_exchange_weak(head, waiting_task));
+
+		// The last decrement may have happened before the push and seen no waiter
+		if (counter->value.load() <= target)
+			wake_waiters(counter);
+	}
+
+	void Multitasker::push_task(Task task, TaskDesc desc)
+	{
+		task.stack = desc.stack;
+
+		if (desc.affinity == TaskAffinity::main_thread)
+		{
+			_main_thread_tasks.enqueue(task);
+			return;
+		}
+
+		uint32_t id = get_current_thread_id();
+		if (id < _workers.size())
+			_workers[id]->tasks[(size_t)desc.priority].push(task);
+		else
+			_task_queues[(size_t)desc.priority].enqueue(task);
+	}
+
+	void Multitasker::push_tasks(const Task* tasks, uint32_t count, TaskDesc desc)
+	{
+		if (desc.affinity == TaskAffinity::main_thread)
+		{
+			_main_thread_tasks.enqueue_bulk(tasks, count);
+			return;
+		}
+
+		uint32_t id = get_current_thread_id();
+		if (id < _workers.size())
+			_workers[id]->tasks[(size_t)desc.priority].push_bulk(tasks, count);
+		else
+			_task_queues[(size_t)desc.priority].enqueue_bulk(tasks, count);
+	}
+
+	void Multitasker::push_bundle(TASK_FUNC_PTR(func), void* user_args_array, uint32_t user_args_stride, AtomicCounter* counter, uint32_t bundle_size, TaskDesc desc)
+	{
+		if (bundle_size == 0) return;
+
+		uint32_t chunk_size = desc.chunk_size;
+		if (chunk_size == TaskDesc::auto_chunk)
+		{
+			uint32_t chunk_count = std::min(std::min(bundle_size, (uint32_t)_workers.size() * bundle_chunks_per_worker), max_bundle_chunks);
+			chunk_size = (bundle_size + chunk_count - 1) / chunk_count;
+		}
+		uint32_t chunk_count = (bundle_size + chunk_size - 1) / chunk_size;
+
+		Task tasks[bundle_push_batch];
+		for (uint32_t batch = 0; batch < chunk_count; batch += bundle_push_batch)
+		{
+			uint32_t batch_count = std::min(bundle_push_batch, chunk_count - batch);
+			for (uint32_t i = 0; i < batch_count; ++i)
+			{
+				uint32_t first = (batch + i) * chunk_size;
+				void* user_args = static_cast<char*>(user_args_array) + (size_t)first * user_args_stride;
+				tasks[i] = Task(func, user_args, counter, first, bundle_size, std::min(chunk_size, bundle_size - first), user_args_stride);
+				tasks[i].stack = desc.stack;
+			}
+
+			push_tasks(tasks, batch_count, desc);
+			notify_pushed(batch_count, desc);
+		}
+	}
+
+	void Multitasker::run_main_thread_tasks()
+	{
+		Task task;
+		while (_main_thread_tasks.try_dequeue(task))
+			run_task(task);
+	}
+
+	void Multitasker::run_task(const Task& task)
+	{
+		TRACE_EVENT(get_current_thread_id(), TraceEvent::task_begin, reinterpret_cast<const void*>(task.function), local_task_count());
+
+		char* user_args = static_cast<char*>(task.user_args);
+		for (uint32_t i = 0; i < task.chunk_size; ++i)
+			task.function(user_args + (size_t)i * task.user_args_stride, task.bundle_index + i, task.bundle_size);
+
+		// The task may have waited : this can be another worker than the one it began on
+		TRACE_EVENT(get_current_thread_id(), TraceEvent::task_end, reinterpret_cast<const void*>(task.function));
+
+		// The counter counts bundle elements, a chunk completes all of its elements at once
+		if (task.counter)
+			decrement_counter(task.counter, (int)task.chunk_size);
+	}
+
+	void Multitasker::decrement_counter(AtomicCounter* counter, int amount)
+	{
+		// Both seq_cst : either this sees the waiter pushed, or the waiter sees the new value
+		counter->value.fetch_sub(amount);
+		if (counter->waiters.load() != nullptr)
+			wake_waiters(counter);
+	}
+
+	void Multitasker::wake_waiters(AtomicCounter* counter)
+	{
+		uint32_t woken_count = 0;
+		bool woke_bound_fiber = false;
+		for (;;)
 		{
-			bool has_waiting_task = false;
+			// Take the whole list : the nodes are owned by this thread until pushed back or made ready
+			WaitingTask* waiting_task = counter->waiters.exchange(nullptr);
+			if (!waiting_task) break;
+
+			int value = counter->value.load();
+			bool has_pending = false;
+			int highest_pending_target = 0;
+			while (waiting_task)
 			{
-				std::lock_guard<std::recursive_mutex> lock(_mutex);
-				if (_waiting_tasks.size())
+				WaitingTask* next = waiting_task->next;
+				// Copied out too : once pushed back, another decrement can make the node ready and its fiber pop it
+				int target = waiting_task->target;
+				if (value <= target)
 				{
-					for (auto it = _waiting_tasks.begin(); it != _waiting_tasks.end(); ++it)
+					// Copy out before publishing, the fiber can resume and pop its WaitingTask right after
+					Fiber fiber = waiting_task->fiber;
+					int affinity = waiting_task->affinity;
+					if (waiting_task->wake_word)
 					{
-						if (it->counter->load() == it->target)
-						{
-							if(it->affinity == -1 || it->affinity == id)
-							{
-								_fiber_switching_fiber_destination = it->fiber;
-								_fiber_switching_fiber_origin = get_current_fiber();
-
-								if (it != --_waiting_tasks.end())
-									*it = std::move(_waiting_tasks.back());
-								_waiting_tasks.pop_back();
-								has_waiting_task = true;
-								break;
-							}
-						}
+						// The blocked thread may return as soon as the word is set : the wake can hit a dead stack
+						// address, at worst a spurious wake up for whatever futex waits there now
+						std::atomic<uint32_t>* wake_word = waiting_task->wake_word;
+						wake_word->store(1, std::memory_order_release);
+						futex_wake(wake_word, 1);
 					}
+					else if (waiting_task->continuation)
+					{
+						push_task(Task(waiting_task->continuation, waiting_task->continuation_args, nullptr, 0, 1), TaskDesc());
+						++woken_count;
+					}
+					else if (affinity == -1)
+					{
+						_ready_fibers.enqueue(fiber);
+						++woken_count;
+					}
+					else
+					{
+						_workers[affinity]->ready_fibers.enqueue(fiber);
+						woke_bound_fiber = true;
+					}
+				}
+				else
+				{
+					WaitingTask* head = counter->waiters.load();
+					do
+					{
+						waiting_task->next = head;
+					} while (!counter->waiters.compare_exchange_weak(head, waiting_task));
+
+					highest_pending_target = has_pending ? std::max(highest_pending_target, target) : target;
+					has_pending = true;
 				}
+				waiting_task = next;
 			}
-			if(has_waiting_task)
+
+			// A decrement during the walk saw an empty list and relies on this thread to recheck
+			if (!has_pending || counter->value.load() > highest_pending_target)
+				break;
+		}
+
+		// Parked workers are not individually addressable : a fiber bound to one worker wakes them all (main fiber and
+		// return_on_same_thread waits only)
+		if (woke_bound_fiber)
+			_work_available.notify_all();
+		else if (woken_count)
+			_work_available.notify(woken_count);
+	}
+
+	bool Multitasker::pop_local_task(uint32_t worker_id, Task& task)
+	{
+		Worker& worker = *_workers[worker_id];
+
+		// Only worker 0 can run them, before anything other workers could take
+		if (worker_id == 0 && _main_thread_tasks.try_dequeue(task))
+			return true;
+
+		// Starvation protection : a priority passed over too often gets this pop, if it still has local work
+		for (uint32_t priority = priority_count - 1; priority > 0; --priority)
+		{
+			if (worker.passed_over[priority] < starvation_limit) continue;
+
+			worker.passed_over[priority] = 0;
+			if (worker.tasks[priority].pop(task) || _task_queues[priority].try_dequeue(task))
+				return true;
+		}
+
+		for (uint32_t priority = 0; priority < priority_count; ++priority)
+		{
+			if (worker.tasks[priority].pop(task) || _task_queues[priority].try_dequeue(task))
 			{
-				switch_to_fiber(_fiber_switching_fibers[id]);
+				for (uint32_t lower = priority + 1; lower < priority_count; ++lower)
+				{
+					if (worker.tasks[lower].size() > 0 || _task_queues[lower].size_approx())
+						++worker.passed_over[lower];
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Multitasker::pop_task(uint32_t worker_id, Task& task)
+	{
+		Worker& worker = *_workers[worker_id];
+
+		if (!pop_local_task(worker_id, task))
+		{
+			// Steal from the other workers, starting at a random one so thieves spread over victims, highest priority first.
+			// Workers on the same NUMA node are tried before the others : their tasks' data is likely in local memory.
+			uint32_t worker_count = (uint32_t)_workers.size();
+			worker.steal_seed ^= worker.steal_seed << 13;
+			worker.steal_seed ^= worker.steal_seed >> 17;
+			worker.steal_seed ^= worker.steal_seed << 5;
+
+			uint32_t first_victim = worker.steal_seed % worker_count;
+			uint32_t pass_count = _numa_node_count > 1 ? 2 : 1;
+			bool stolen = false;
+			for (uint32_t priority = 0; priority < priority_count && !stolen; ++priority)
+			{
+				for (uint32_t i = 0; i < worker_count * pass_count && !stolen; ++i)
+				{
+					uint32_t victim = (first_victim + i) % worker_count;
+					if (victim == worker_id) continue;
+					bool same_node = _workers[victim]->numa_node == worker.numa_node;
+					if (pass_count > 1 && same_node != (i < worker_count)) continue;
+
+					WorkStealingDeque<Task>& victim_tasks = _workers[victim]->tasks[priority];
+					if (victim_tasks.size() <= 0) continue;
+
+					stolen = victim_tasks.steal(task);
+					if (stolen)
+					{
+						worker.steals.fetch_add(1, std::memory_order_relaxed);
+						TRACE_EVENT(worker_id, TraceEvent::steal, nullptr, victim);
+					}
+					else
+						worker.failed_steals.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+			if (!stolen) return false;
+		}
+
+		worker.executed_tasks.fetch_add(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool Multitasker::has_work(uint32_t worker_id) const
+	{
+		const Worker& worker = *_workers[worker_id];
+		if (worker.ready_fibers.size_approx() || _ready_fibers.size_approx())
+			return true;
+		if (worker_id == 0 && _main_thread_tasks.size_approx())
+			return true;
+
+		for (uint32_t priority = 0; priority < priority_count; ++priority)
+		{
+			if (_task_queues[priority].size_approx())
+				return true;
+
+			for (auto& other : _workers)
+			{
+				if (other->tasks[priority].size() > 0)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	void Multitasker::wait_for_work(uint32_t worker_id)
+	{
+		const uint32_t min_spin_count = 16;
+		const uint32_t max_spin_count = 4096;
+
+		Worker& worker = *_workers[worker_id];
+		worker.spin_count = std::max(min_spin_count, std::min(worker.spin_count, max_spin_count));
+
+		// Spin first : bursty frame workloads usually enqueue again within microseconds
+		for (uint32_t i = 0; i < worker.spin_count; ++i)
+		{
+			cpu_pause();
+			if ((i & 15) == 15 && has_work(worker_id))
+			{
+				worker.spin_count = std::min(worker.spin_count * 2, max_spin_count);
+				return;
+			}
+		}
+		worker.spin_count = std::max(worker.spin_count / 2, min_spin_count);
+
+		uint32_t key = _work_available.prepare_wait();
+		if (_stop.load() || has_work(worker_id))
+		{
+			_work_available.cancel_wait();
+			return;
+		}
+
+		TRACE_EVENT(worker_id, TraceEvent::park);
+		// Read after prepare_wait : a timer scheduled earlier than this deadline notifies
+		uint64_t deadline = _next_timer_deadline.load();
+		if (deadline != TimerWheel::no_deadline && !_timer_keeper.exchange(true))
+		{
+			uint64_t now = timer_now();
+			if (deadline > now)
+				_work_available.wait_for(key, deadline - now);
+			else
+				_work_available.cancel_wait();
+			_timer_keeper.store(false);
+		}
+		else
+		{
+			_work_available.wait(key);
+		}
+		TRACE_EVENT(worker_id, TraceEvent::unpark);
+	}
+
+	void Multitasker::process_tasks(PoolFiber* self)
+	{
+		while (!_stop.load())
+		{
+			// Reloaded every iteration : this fiber may have been resumed on another thread while running a task
+			uint32_t id = get_current_thread_id();
+			Worker& worker = *_workers[id];
+
+			if (worker.has_handoff_task)
+			{
+				// This fiber was switched to for a task the previous loop fiber's stack was too small for
+				worker.has_handoff_task = false;
+				Task task = worker.handoff_task;
+				run_task(task);
+				continue;
+			}
+
+			Fiber ready_fiber;
+			if (worker.ready_fibers.try_dequeue(ready_fiber) || _ready_fibers.try_dequeue(ready_fiber))
+			{
+				worker.fiber_switching_fiber_destination = ready_fiber;
+				worker.fiber_switching_fiber_origin = self;
+				switch_to_fiber(worker.fiber_switching_fiber);
 			}
 			else
 			{
 				Task task;
-				if (_task_queue.try_dequeue(task))
+				if (pop_task(id, task))
 				{
-					task.function(task.user_args, task.bundle_index, task.bundle_size);
-					task.counter->fetch_sub(1); 
-					// Wake all dormant workers, to check for waiting tasks
-					_worker_wake_up.notify_all();
+					if (task.stack > self->stack)
+					{
+						worker.handoff_task = task;
+						worker.has_handoff_task = true;
+						worker.fiber_switching_fiber_destination = acquire_pool_fiber(task.stack)->fiber;
+						worker.fiber_switching_fiber_origin = self;
+						switch_to_fiber(worker.fiber_switching_fiber);
+					}
+					else
+					{
+						run_task(task);
+					}
+
+					// Not id's worker anymore if the task waited
+					Worker& current = *_workers[get_current_thread_id()];
+					if (++current.tasks_since_timer_poll >= timer_poll_interval)
+					{
+						current.tasks_since_timer_poll = 0;
+						poll_timers();
+					}
 				}
-				else
+				else if (poll_timers() == 0)
 				{
-					// Nothing to do, sleep a little
-					// TODO(antoine): wait forever until signaled ? Need to check all possibles cases
-					std::unique_lock<std::mutex> lock(_cv_mutex);
-					_worker_wake_up.wait_for(lock, std::chrono::milliseconds(4));
+					TRACE_EVENT(id, TraceEvent::idle_begin);
+					wait_for_work(id);
+					TRACE_EVENT(id, TraceEvent::idle_end);
 				}
 			}
 			
@@ -159,19 +928,93 @@ namespace kth
 
 	}
 
-	void Multitasker::wait_for(std::shared_ptr<AtomicCounter> counter, int value, bool return_on_same_thread)
+	void Multitasker::wait_for_async(CounterHandle counter, int value, WaitingTask* waiting_task)
+	{
+		waiting_task->target = value;
+		if (counter->load() <= value)
+		{
+			enqueue_detached(waiting_task->continuation, waiting_task->continuation_args);
+			return;
+		}
+		add_waiter(counter.get(), waiting_task);
+	}
+
+	void Multitasker::park(ParkPublishFunc publish, void* context)
+	{
+		Worker& worker = *_workers[get_current_thread_id()];
+		WaitingTask waiting_task(get_current_fiber(), 0, wait_affinity(get_current_thread_id(), false));
+
+		worker.waiting_counter_fiber_destination = acquire_pool_fiber(FiberStack::small)->fiber;
+		worker.waiting_counter_fiber_task = &waiting_task;
+		worker.park_publish = publish;
+		worker.park_context = context;
+		TRACE_EVENT(get_current_thread_id(), TraceEvent::wait, context);
+		switch_to_fiber(worker.waiting_counter_fiber);
+		TRACE_EVENT(get_current_thread_id(), TraceEvent::resume, context);
+	}
+
+	void Multitasker::resume(WaitingTask* waiting_task)
+	{
+		// Copied out : the fiber can run and pop its WaitingTask as soon as it is queued
+		Fiber fiber = waiting_task->fiber;
+		int affinity = waiting_task->affinity;
+		if (affinity == -1)
+		{
+			_ready_fibers.enqueue(fiber);
+			_work_available.notify(1);
+		}
+		else
+		{
+			_workers[affinity]->ready_fibers.enqueue(fiber);
+			_work_available.notify_all();
+		}
+	}
+
+	int Multitasker::wait_affinity(uint32_t id, bool return_on_same_thread) const
+	{
+		// main() runs on worker 0's own fiber and goes on with GLFW / Vulkan calls after its waits
+		if (return_on_same_thread || get_current_fiber().address == _main_fiber.address)
+			return (int)id;
+		return -1;
+	}
+
+	void Multitasker::wait_for(CounterHandle counter, int value, bool return_on_same_thread)
+	{
+		if (counter->load() <= value) return;
+
+		auto id = get_current_thread_id();
+		if (id >= _workers.size())
+		{
+			block_thread_until(counter.get(), value);
+			return;
+		}
+		Worker& worker = *_workers[id];
+
+		WaitingTask waiting_task(get_current_fiber(), value, wait_affinity(id, return_on_same_thread));
+
+		// The worker loop carries on on a small fiber, tasks needing more are handed off
+		worker.waiting_counter_fiber_destination = acquire_pool_fiber(FiberStack::small)->fiber;
+		worker.waiting_counter_fiber_task = &waiting_task;
+		worker.waiting_counter_fiber_counter = counter.get();
+		TRACE_EVENT(id, TraceEvent::wait, counter.get());
+		switch_to_fiber(worker.waiting_counter_fiber);
+		TRACE_EVENT(get_current_thread_id(), TraceEvent::resume, counter.get());
+	}
+
+	void Multitasker::block_thread_until(AtomicCounter* counter, int value)
 	{
-		if (counter->load() == value) return;
+		const uint32_t spin_count = 256;
 
-		auto id = thread_id;
+		std::atomic<uint32_t> woken{ 0 };
+		WaitingTask waiting_task;
+		waiting_task.target = value;
+		waiting_task.wake_word = &woken;
+		add_waiter(counter, &waiting_task);
 
-		Fiber fiber;
-		_fiber_pool.wait_dequeue(fiber);
-		_waiting_counter_fiber_destination = fiber;
-		_waiting_counter_fiber_origin = get_current_fiber();
-		_waiting_counter_fiber_counter = counter;
-		_waiting_counter_fiber_counter_target = value;
-		_waiting_counter_fiber_affinity = return_on_same_thread ? thread_id : -1;
-		switch_to_fiber(_waiting_counter_fibers[id]);
+		// Short jobs finish before the futex round trip would
+		for (uint32_t i = 0; i < spin_count && woken.load(std::memory_order_acquire) == 0; ++i)
+			cpu_pause();
+		while (woken.load(std::memory_order_acquire) == 0)
+			futex_wait(&woken, 0);
 	}
 }
@@ -1,16 +1,49 @@
 #pragma once
 #include <atomic>
-#include <condition_variable>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <thread/aligned_allocation.h>
 #include <thread/fiber.h>
 #include <vector>
+#include <type_traits>
+#include <new>
+#include <utility>
 #include <concurrentqueue/blockingconcurrentqueue.h>
+#include <thread/work_stealing_deque.h>
+#include <thread/event_count.h>
+#include <thread/trace.h>
+#include <thread/timer_wheel.h>
 
 /*
 Fiber types : 
 
 fiber pool : worker loop, pop a task, run it and decrease its counter
-fiber_switching_fibers : loop : enqueue origin fiber (from tls) back in fiber pool then switch to target fiber (from tls) (use when restoring a waiting fiber in worker loop)
-waiting_counter_fiber : loop : enqueue origin fiber (from tls) in waiting fiber map then switch to target fiber (from tls, one of the worker from pool)
+fiber_switching_fibers : loop : enqueue origin fiber (from worker) back in fiber pool then switch to target fiber (from worker) (use when restoring a waiting fiber in worker loop)
+waiting_counter_fiber : loop : push origin fiber (from worker) on its counter's waiter list (or hand it to a park publish callback) then switch to target fiber (from worker, one of the worker from pool)
+
+Counters only count down. The thread whose decrement brings a counter to or below a waiter's target moves
+that waiter to a ready queue (global, or the worker's own one when it asked to return on the same thread).
+
+Pool fibers come in two stack sizes (FiberStack in TaskDesc) and are created on demand up to a cap. The loop runs
+on small fibers, a task that asks for a large stack is handed off to a large fiber first.
+
+Counters come from per-thread free lists and have an explicit lifetime : enqueue hands one out, the caller gives
+it back with release_counter once it reached zero and nobody waits on it anymore.
+
+Callables can be enqueued directly : their captures are moved into a pooled cache line sized TaskClosure (up to
+TaskClosure::capacity bytes, checked at compile time), run then destroyed by the task.
+
+	int* results = ...;
+	CounterHandle counter = tasker.enqueue([results, i] { results[i] = compute(i); });
+
+Delayed and periodic tasks wait in a timer wheel (1 ms ticks). Idle workers expire it, busy ones every few dozen
+tasks, and one parked worker sleeps only until the next deadline : maintenance work runs in the gaps of the frame.
+
+Tasks have a priority : each worker has one deque per priority and pops / steals the highest one first, a lower
+priority passed over too many times while it had work gets the next pop. Main thread tasks go to a queue only
+worker 0 drains (window / GLFW calls) ; a main thread task that waits must use return_on_same_thread. main() itself
+runs on worker 0's own fiber, whose waits always resume on worker 0.
 
 */
 
@@ -20,109 +53,508 @@ waiting_counter_fiber : loop : enqueue origin fiber (from tls) in waiting fiber
 namespace kth
 {
 
-	
-	typedef std::atomic<int> AtomicCounter;
+	struct WaitingTask;
+
+	enum class TaskPriority : uint8_t
+	{
+		high,		// Frame critical : culling, command recording
+		normal,
+		low,		// Background : streaming, asset decoding
+		count
+	};
+
+	enum class TaskAffinity : uint8_t
+	{
+		any,
+		main_thread
+	};
+
+	enum class FiberStack : uint8_t
+	{
+		small,		// Most tasks
+		large,		// Deep recursion, big stack arrays, third party parsers
+		count
+	};
+
+	struct TaskDesc
+	{
+		// chunk_size : a bundle runs as one task per element by default, see Task before chunking it
+		static const uint32_t auto_chunk = 0;
+
+		TaskDesc(TaskPriority priority = TaskPriority::normal, TaskAffinity affinity = TaskAffinity::any, FiberStack stack = FiberStack::small, uint32_t chunk_size = 1)
+			: priority(priority), affinity(affinity), stack(stack), chunk_size(chunk_size) {}
+
+		TaskPriority priority;
+		TaskAffinity affinity;
+		FiberStack stack;
+		// Bundle elements per task, or auto_chunk : a few chunks per worker
+		uint32_t chunk_size;
+	};
+
+	struct FiberPoolDesc
+	{
+		FiberPoolDesc()
+		{
+			stack_size[(size_t)FiberStack::small] = 64 * 1024;
+			stack_size[(size_t)FiberStack::large] = 1024 * 1024;
+			initial_count[(size_t)FiberStack::small] = 64;
+			initial_count[(size_t)FiberStack::large] = 8;
+			max_count[(size_t)FiberStack::small] = 4096;
+			max_count[(size_t)FiberStack::large] = 256;
+		}
+
+		size_t stack_size[(size_t)FiberStack::count];
+		uint32_t initial_count[(size_t)FiberStack::count];
+		// Past it, waits block until a fiber is given back
+		uint32_t max_count[(size_t)FiberStack::count];
+	};
+
+	struct FiberPoolStats
+	{
+		size_t stack_size = 0;
+		uint32_t created = 0;
+		uint32_t in_use = 0;
+		uint32_t peak_in_use = 0;
+	};
+
+	struct AtomicCounter
+	{
+		AtomicCounter() : value(0), waiters(nullptr), next_free(nullptr) {}
+		explicit AtomicCounter(int value) : value(value), waiters(nullptr), next_free(nullptr) {}
+
+		int load() const { return value.load(); }
 
+		std::atomic<int> value;
+		// Lock-free stack of fibers waiting on this counter
+		std::atomic<WaitingTask*> waiters;
+		// Free list link while the counter sits in a pool
+		AtomicCounter* next_free;
+	};
+
+	// Non-owning : copies are free, the counter lives until Multitasker::release_counter
+	class CounterHandle
+	{
+	public:
+		CounterHandle() : _counter(nullptr) {}
+		explicit CounterHandle(AtomicCounter* counter) : _counter(counter) {}
+
+		int load() const { return _counter->load(); }
+		AtomicCounter* get() const { return _counter; }
+		AtomicCounter* operator->() const { return _counter; }
+		explicit operator bool() const { return _counter != nullptr; }
+
+	private:
+		AtomicCounter* _counter;
+	};
+
+	// Runs function over chunk_size consecutive elements of a bundle, starting at bundle_index.
+	// The elements of a chunk run one after the other on the same fiber : an element that waits for another element of
+	// its own bundle (fiber_barrier, fiber_semaphore, a counter it signals) never sees it start and deadlocks. Only
+	// bundles of independent elements may ask for TaskDesc::chunk_size > 1.
 	struct Task
 	{
 		Task(){}
-		Task(TASK_FUNC_PTR(func), void* user_args, std::shared_ptr<AtomicCounter> counter, uint32_t bundle_index, uint32_t bundle_size) : function(func), user_args(user_args), counter(counter), bundle_index(bundle_index), bundle_size(bundle_size){}
+		Task(TASK_FUNC_PTR(func), void* user_args, AtomicCounter* counter, uint32_t bundle_index, uint32_t bundle_size, uint32_t chunk_size = 1, uint32_t user_args_stride = 0)
+			: function(func), user_args(user_args), counter(counter), bundle_index(bundle_index), bundle_size(bundle_size), chunk_size(chunk_size), user_args_stride(user_args_stride){}
 
 		TASK_FUNC_PTR(function) = nullptr;
 		void* user_args = nullptr;
-		std::shared_ptr<AtomicCounter> counter;
+		AtomicCounter* counter = nullptr;
 		uint32_t bundle_index = 0;
 		uint32_t bundle_size = 0;
+		uint32_t chunk_size = 1;
+		uint32_t user_args_stride = 0;
+		FiberStack stack = FiberStack::small;
 	};
+	static_assert(std::is_trivially_copyable<Task>::value, "Task is stored by value in the work stealing deques");
+
+	// Callable enqueued by value : its captures live in the closure's storage instead of user_args.
+	// Pooled like the counters, handed back once the task ran.
+	struct alignas(64) TaskClosure
+	{
+		static const size_t capacity = 48;
+		static const size_t alignment = 16;
 
+		enum class Call : uint8_t
+		{
+			run,
+			run_and_destroy,
+			destroy
+		};
+
+		alignas(alignment) unsigned char storage[capacity];
+		void(*invoke)(TaskClosure* closure, Call call) = nullptr;
+		// Free list link while the closure sits in a pool
+		TaskClosure* next_free = nullptr;
+	};
+	static_assert(sizeof(TaskClosure) == 64, "A closure is one cache line");
+
+	// Lives on the waiting fiber's stack, linked in its counter's waiter list until the fiber is made ready.
+	// Without a fiber, continuation is enqueued instead (wait_for_async) : the WaitingTask then lives wherever the caller put it.
+	// A thread that is not a worker blocks on wake_word instead, set to 1 then futex woken.
 	struct WaitingTask
 	{
-		WaitingTask() : counter(nullptr), target(0), affinity(-1){}
-		WaitingTask(Fiber fiber, std::shared_ptr<AtomicCounter> counter, int target, int affinity) : fiber(fiber), counter(counter), target(target), affinity(affinity) {}
+		WaitingTask() : target(0), affinity(-1), continuation(nullptr), continuation_args(nullptr), wake_word(nullptr), next(nullptr){}
+		WaitingTask(Fiber fiber, int target, int affinity) : fiber(fiber), target(target), affinity(affinity), continuation(nullptr), continuation_args(nullptr), wake_word(nullptr), next(nullptr) {}
 
 		Fiber fiber;
-		std::shared_ptr<AtomicCounter> counter;
 		int target;
 		int affinity;
+		TASK_FUNC_PTR(continuation);
+		void* continuation_args;
+		std::atomic<uint32_t>* wake_word;
+		WaitingTask* next;
+	};
+
+	// Entry of the timer wheel : its task is pushed once the deadline passed, then every period until cancelled
+	struct ScheduledTask : TimerNode
+	{
+		Task task;
+		TaskDesc desc;
+		uint64_t deadline_ns = 0;
+		uint64_t period_ns = 0;
+		// Periodic only : runs pushed and not finished yet. A period is skipped rather than piling up runs.
+		AtomicCounter* runs = nullptr;
+		// Periodic callable, destroyed along with the timer
+		TaskClosure* closure = nullptr;
+		std::atomic<bool> cancelled{ false };
+	};
+
+	// Periodic task, until Multitasker::cancel_periodic
+	class TimerHandle
+	{
+	public:
+		TimerHandle() : _timer(nullptr) {}
+		explicit TimerHandle(ScheduledTask* timer) : _timer(timer) {}
+
+		ScheduledTask* get() const { return _timer; }
+		explicit operator bool() const { return _timer != nullptr; }
+
+	private:
+		ScheduledTask* _timer;
+	};
+
+	class Multitasker;
+
+	// Fiber running the worker loop, handed out by the pool
+	struct PoolFiber
+	{
+		Fiber fiber;
+		Multitasker* tasker = nullptr;
+		FiberStack stack = FiberStack::small;
+	};
+
+	struct WorkerStats
+	{
+		uint64_t executed_tasks = 0;
+		uint64_t steals = 0;
+		// Steal attempts on a non empty deque that came back empty handed (lost the race for the top element)
+		uint64_t failed_steals = 0;
 	};
 
 	class Multitasker
 	{
 	public:
 
-		Multitasker(uint32_t worker_threads, uint32_t fiber_pool_size, std::function<void(uint32_t)> init_func);
+		// Workers are pinned one per physical core, performance cores first, then on SMT siblings if smt_siblings
+		// (or if there are more workers than cores). The layout is printed at startup.
+		Multitasker(uint32_t worker_threads, const FiberPoolDesc& fiber_pool, std::function<void(uint32_t)> init_func, bool smt_siblings = false);
 		
 		void fiber_switching_fiber_routine();
 		void waiting_counter_fiber_routine();
-		void process_tasks();
+		void process_tasks(PoolFiber* self);
 
-		std::shared_ptr<AtomicCounter> enqueue(TASK_FUNC_PTR(func), void* user_args);
+		CounterHandle enqueue(TASK_FUNC_PTR(func), void* user_args, TaskDesc desc = TaskDesc());
 		template<typename T, int N>
-		std::shared_ptr<AtomicCounter> enqueue(TASK_FUNC_PTR(func), T(&user_args_array_fixed)[N]);
+		CounterHandle enqueue(TASK_FUNC_PTR(func), T(&user_args_array_fixed)[N], TaskDesc desc = TaskDesc());
 		template<typename T>
-		std::shared_ptr<AtomicCounter> enqueue(TASK_FUNC_PTR(func), T* user_args_array_dynamic, int n);
+		CounterHandle enqueue(TASK_FUNC_PTR(func), T* user_args_array_dynamic, int n, TaskDesc desc = TaskDesc());
+		// Adds one task to an existing counter (incremented before the push), for work that spawns more work
+		void enqueue(TASK_FUNC_PTR(func), void* user_args, uint32_t bundle_index, uint32_t bundle_size, CounterHandle counter, TaskDesc desc = TaskDesc());
+
+		// func is moved into a TaskClosure, no user_args to keep alive and no heap allocation. Signature void().
+		template<typename Func>
+		CounterHandle enqueue(Func&& func, TaskDesc desc = TaskDesc());
+		template<typename Func>
+		void enqueue(Func&& func, CounterHandle counter, TaskDesc desc = TaskDesc());
+
+		// No counter : nothing can wait on it, for tasks that signal their completion themselves
+		void enqueue_detached(TASK_FUNC_PTR(func), void* user_args, TaskDesc desc = TaskDesc());
+
+		// Pushed once delay elapsed, rounded up to the timer tick. Low priority by default : background maintenance.
+		CounterHandle enqueue_after(std::chrono::nanoseconds delay, TASK_FUNC_PTR(func), void* user_args, TaskDesc desc = TaskDesc(TaskPriority::low));
+		template<typename Func>
+		CounterHandle enqueue_after(std::chrono::nanoseconds delay, Func&& func, TaskDesc desc = TaskDesc(TaskPriority::low));
+		// No counter, like enqueue_detached
+		void enqueue_after_detached(std::chrono::nanoseconds delay, TASK_FUNC_PTR(func), void* user_args, TaskDesc desc = TaskDesc(TaskPriority::low));
+		// Pushed every period, first after one period. A period where the previous run has not finished is skipped.
+		TimerHandle enqueue_periodic(std::chrono::nanoseconds period, TASK_FUNC_PTR(func), void* user_args, TaskDesc desc = TaskDesc(TaskPriority::low));
+		template<typename Func>
+		TimerHandle enqueue_periodic(std::chrono::nanoseconds period, Func&& func, TaskDesc desc = TaskDesc(TaskPriority::low));
+		// No run is pushed after this returns, a run already pushed still completes. The timer is freed once it
+		// has : user_args must outlive that, and timer must not be used again.
+		void cancel_periodic(TimerHandle timer);
+
+		// Runs the pending main thread tasks on the calling fiber, for a main loop that does not wait every frame. Thread 0 only.
+		void run_main_thread_tasks();
+
+
+		// From a worker fiber, switches to other work until counter <= value, then resumes on any worker unless
+		// return_on_same_thread (always for worker 0's main fiber). From any other thread (GLFW callbacks, I/O threads,
+		// tools), blocks the thread on a futex, woken by the decrement like a fiber would be.
+		void wait_for(CounterHandle counter, int value, bool return_on_same_thread = false);
+		// Does not block : waiting_task->continuation is enqueued once counter <= value. waiting_task must live until then.
+		void wait_for_async(CounterHandle counter, int value, WaitingTask* waiting_task);
+		// Decrements a counter (and wakes its waiters) for work that is not a task : I/O, coroutines, GPU
+		void signal(CounterHandle counter, int amount = 1) { decrement_counter(counter.get(), amount); }
+
+		// Parks the calling fiber (worker threads only) for primitives other than counters. Once the fiber is switched out,
+		// publish(context, waiting_task) hands waiting_task to whoever calls resume later, or returns false to resume it now.
+		typedef bool(*ParkPublishFunc)(void* context, WaitingTask* waiting_task);
+		void park(ParkPublishFunc publish, void* context);
+		void resume(WaitingTask* waiting_task);
 
+		// Counters returned by enqueue, to release once they reached zero and all waits on them returned
+		static CounterHandle acquire_counter(int value);
+		static void release_counter(CounterHandle counter);
 
+		void stop() { _stop = true; _work_available.notify_all(); }
+		static uint32_t get_current_thread_id();
 
-		void wait_for(std::shared_ptr<AtomicCounter> counter, int value, bool return_on_same_thread = false);
+		uint32_t worker_count() const { return (uint32_t)_workers.size(); }
+		// Workers asleep on the event count (or about to), waiting for work
+		uint32_t parked_worker_count() const { return _work_available.waiter_count(); }
+		// Tasks waiting in the calling worker's own deques, 0 on other threads
+		uint32_t local_task_count() const;
 
-		void stop() { _stop = true; _worker_wake_up.notify_all(); }
-		static uint32_t get_current_thread_id() { return thread_id; }
+		std::vector<WorkerStats> worker_stats() const;
+		// One entry per FiberStack
+		std::vector<FiberPoolStats> fiber_pool_stats() const;
+
+		// Null unless built with KTH_TRACE
+#if KTH_TRACE
+		Tracer* tracer() const { return _tracer.get(); }
+#else
+		Tracer* tracer() const { return nullptr; }
+#endif
 	private:
+		// Pushes the bundles of its nodes straight onto the graph's counter
+		friend class TaskGraph;
+
+		// Per worker thread state, only touched by the thread owning it (except the deque top and the stats).
+		// Its deques are cache line aligned : allocated with aligned_new.
+		struct Worker
+		{
+			WorkStealingDeque<Task> tasks[(size_t)TaskPriority::count];
+			// Pops that went to a higher priority while this one had work
+			uint32_t passed_over[(size_t)TaskPriority::count] = {};
+			uint32_t steal_seed = 0;
+
+			// Logical processor the worker is pinned to, -1 if the topology is unknown
+			uint32_t processor = uint32_t(-1);
+			// Victims on the same node are tried first
+			uint32_t numa_node = 0;
+
+			Fiber fiber_switching_fiber;
+			PoolFiber* fiber_switching_fiber_origin = nullptr;
+			Fiber fiber_switching_fiber_destination;
+
+			Fiber waiting_counter_fiber;
+			Fiber waiting_counter_fiber_destination;
+			WaitingTask* waiting_counter_fiber_task = nullptr;
+			AtomicCounter* waiting_counter_fiber_counter = nullptr;
+			ParkPublishFunc park_publish = nullptr;
+			void* park_context = nullptr;
+
+			// Task needing a bigger stack than the loop fiber that popped it, run by the large fiber switched to next
+			Task handoff_task;
+			bool has_handoff_task = false;
+
+			// Fibers that waited with return_on_same_thread, filled by whichever thread decremented their counter
+			moodycamel::ConcurrentQueue<Fiber> ready_fibers;
+
+			// Tasks run since the last timer poll
+			uint32_t tasks_since_timer_poll = 0;
+
+			// Idle spin iterations before parking, doubled when spinning found work and halved when it did not
+			uint32_t spin_count = 0;
+
+			std::atomic<uint64_t> executed_tasks{ 0 };
+			std::atomic<uint64_t> steals{ 0 };
+			std::atomic<uint64_t> failed_steals{ 0 };
+		};
+
+		// Pool of fibers of one stack size, grown on demand
+		struct FiberPool
+		{
+			moodycamel::BlockingConcurrentQueue<PoolFiber*> free_fibers;
+			size_t stack_size = 0;
+			uint32_t max_count = 0;
+			std::atomic<uint32_t> created{ 0 };
+			std::atomic<uint32_t> in_use{ 0 };
+			std::atomic<uint32_t> peak_in_use{ 0 };
+		};
+
+		template<typename Func>
+		static TaskClosure* make_closure(Func&& func);
+		static TaskClosure* acquire_closure();
+		static void release_closure(TaskClosure* closure);
+		static TASK_FUNC(run_closure);
+		static TASK_FUNC(run_closure_in_place);
+		void schedule(ScheduledTask* timer, uint64_t deadline_ns);
+		TimerHandle schedule_periodic(std::chrono::nanoseconds period, Task task, TaskClosure* closure, TaskDesc desc);
+		// Pushes the tasks of the expired timers, returns their count. Cheap while no timer is due.
+		uint32_t poll_timers();
 
 		void init_worker(uint32_t worker_id);
+		PoolFiber* create_pool_fiber(FiberStack stack);
+		PoolFiber* acquire_pool_fiber(FiberStack stack);
+		void release_pool_fiber(PoolFiber* fiber);
+		void place_workers(bool smt_siblings);
+		void push_task(Task task, TaskDesc desc);
+		void push_tasks(const Task* tasks, uint32_t count, TaskDesc desc);
+		void push_bundle(TASK_FUNC_PTR(func), void* user_args_array, uint32_t user_args_stride, AtomicCounter* counter, uint32_t bundle_size, TaskDesc desc);
+		void notify_pushed(uint32_t count, TaskDesc desc);
+		void run_task(const Task& task);
+		bool pop_local_task(uint32_t worker_id, Task& task);
+		bool pop_task(uint32_t worker_id, Task& task);
+		void decrement_counter(AtomicCounter* counter, int amount);
+		void add_waiter(AtomicCounter* counter, WaitingTask* waiting_task);
+		void block_thread_until(AtomicCounter* counter, int value);
+		void wake_waiters(AtomicCounter* counter);
+		int wait_affinity(uint32_t id, bool return_on_same_thread) const;
+		bool has_work(uint32_t worker_id) const;
+		void wait_for_work(uint32_t worker_id);
 
 		static thread_local uint32_t thread_id;
-		std::recursive_mutex _mutex;
-		std::vector<Fiber> _fiber_switching_fibers;
-		static thread_local Fiber _fiber_switching_fiber_origin;
-		static thread_local Fiber _fiber_switching_fiber_destination;
-
-		std::vector<Fiber> _waiting_counter_fibers;
-		static thread_local Fiber _waiting_counter_fiber_origin;
-		static thread_local Fiber _waiting_counter_fiber_destination;
-		static thread_local std::shared_ptr<AtomicCounter> _waiting_counter_fiber_counter;
-		static thread_local int _waiting_counter_fiber_counter_target;
-		static thread_local int _waiting_counter_fiber_affinity;
-
-		moodycamel::BlockingConcurrentQueue<Fiber> _fiber_pool;
-		std::vector<WaitingTask> _waiting_tasks;
-		moodycamel::ConcurrentQueue<Task> _task_queue;
+		std::vector<std::unique_ptr<Worker, AlignedDelete>> _workers;
+		// The constructing thread's own fiber, main() runs on it
+		Fiber _main_fiber;
+		uint32_t _numa_node_count;
+
+		FiberPool _fiber_pools[(size_t)FiberStack::count];
+		// Owns the pool fibers, only locked when the pool grows
+		std::mutex _pool_fibers_mutex;
+		std::vector<std::unique_ptr<PoolFiber>> _pool_fibers;
+		moodycamel::ConcurrentQueue<Fiber> _ready_fibers;
+		// Tasks enqueued from threads that are not workers, workers push to their own deques
+		moodycamel::ConcurrentQueue<Task> _task_queues[(size_t)TaskPriority::count];
+		// Only drained by worker 0
+		moodycamel::ConcurrentQueue<Task> _main_thread_tasks;
 
 		std::atomic<bool> _stop;
 
-		std::mutex _cv_mutex;
-		std::condition_variable _worker_wake_up;
+		// Idle workers park here, signaled once per new task or ready fiber
+		EventCount _work_available;
 
 		std::function<void(uint32_t)> _init_function;
 
+		// Locked briefly to insert or expire, polled with try_lock
+		std::mutex _timers_mutex;
+		TimerWheel _timers;
+		// Cached TimerWheel::next_deadline, read without the lock
+		std::atomic<uint64_t> _next_timer_deadline{ TimerWheel::no_deadline };
+		// Set by the one parked worker that sleeps until the next deadline, the others sleep until notified
+		std::atomic<bool> _timer_keeper{ false };
+
+#if KTH_TRACE
+		std::unique_ptr<Tracer> _tracer;
+#endif
+
 	};
 
-	inline std::shared_ptr<AtomicCounter> Multitasker::enqueue(TASK_FUNC_PTR(func), void* user_args)
+	inline CounterHandle Multitasker::enqueue(TASK_FUNC_PTR(func), void* user_args, TaskDesc desc)
 	{ 
-		std::shared_ptr<AtomicCounter> counter = std::make_shared<AtomicCounter>(1);
-		_task_queue.enqueue(Task(func, user_args, counter, 0, 1));
-		_worker_wake_up.notify_one();
+		CounterHandle counter = acquire_counter(1);
+		push_task(Task(func, user_args, counter.get(), 0, 1), desc);
+		notify_pushed(1, desc);
 		return counter;
 	}
 
+	inline void Multitasker::enqueue(TASK_FUNC_PTR(func), void* user_args, uint32_t bundle_index, uint32_t bundle_size, CounterHandle counter, TaskDesc desc)
+	{
+		counter->value.fetch_add(1);
+		push_task(Task(func, user_args, counter.get(), bundle_index, bundle_size), desc);
+		notify_pushed(1, desc);
+	}
+
+	inline void Multitasker::enqueue_detached(TASK_FUNC_PTR(func), void* user_args, TaskDesc desc)
+	{
+		push_task(Task(func, user_args, nullptr, 0, 1), desc);
+		notify_pushed(1, desc);
+	}
+
 	template<typename T, int N>
-	std::shared_ptr<AtomicCounter> Multitasker::enqueue(TASK_FUNC_PTR(func), T(&user_args_array_fixed)[N])
+	CounterHandle Multitasker::enqueue(TASK_FUNC_PTR(func), T(&user_args_array_fixed)[N], TaskDesc desc)
 	{
-		return enqueue(func, user_args_array_fixed, N);
+		return enqueue(func, user_args_array_fixed, N, desc);
 	}
 
 	template<typename T>
-	std::shared_ptr<AtomicCounter> Multitasker::enqueue(TASK_FUNC_PTR(func), T* user_args_array_dynamic, int n)
+	CounterHandle Multitasker::enqueue(TASK_FUNC_PTR(func), T* user_args_array_dynamic, int n, TaskDesc desc)
 	{
-		std::shared_ptr<AtomicCounter> counter = std::make_shared<AtomicCounter>(n);
+		CounterHandle counter = acquire_counter(n);
+		push_bundle(func, user_args_array_dynamic, sizeof(T), counter.get(), n, desc);
+		return counter;
+	}
 
-		for (int i = 0; i < n; ++i)
+	template<typename Func>
+	TaskClosure* Multitasker::make_closure(Func&& func)
+	{
+		typedef typename std::decay<Func>::type Callable;
+		static_assert(sizeof(Callable) <= TaskClosure::capacity, "Captures too large for a TaskClosure : capture a pointer to the data instead");
+		static_assert(alignof(Callable) <= TaskClosure::alignment, "Captures too aligned for a TaskClosure");
+
+		TaskClosure* closure = acquire_closure();
+		new (closure->storage) Callable(std::forward<Func>(func));
+		closure->invoke = [](TaskClosure* closure, TaskClosure::Call call)
 		{
-			_task_queue.enqueue(Task(func, user_args_array_dynamic + i, counter, i, n));
-			_worker_wake_up.notify_one();
-		}
+			Callable* callable = reinterpret_cast<Callable*>(closure->storage);
+			if (call != TaskClosure::Call::destroy)
+				(*callable)();
+			if (call != TaskClosure::Call::run)
+				callable->~Callable();
+		};
+		return closure;
+	}
+
+	template<typename Func>
+	CounterHandle Multitasker::enqueue(Func&& func, TaskDesc desc)
+	{
+		CounterHandle counter = acquire_counter(1);
+		push_task(Task(run_closure, make_closure(std::forward<Func>(func)), counter.get(), 0, 1), desc);
+		notify_pushed(1, desc);
 		return counter;
 	}
 
+	template<typename Func>
+	void Multitasker::enqueue(Func&& func, CounterHandle counter, TaskDesc desc)
+	{
+		counter->value.fetch_add(1);
+		push_task(Task(run_closure, make_closure(std::forward<Func>(func)), counter.get(), 0, 1), desc);
+		notify_pushed(1, desc);
+	}
+
+	template<typename Func>
+	CounterHandle Multitasker::enqueue_after(std::chrono::nanoseconds delay, Func&& func, TaskDesc desc)
+	{
+		return enqueue_after(delay, run_closure, make_closure(std::forward<Func>(func)), desc);
+	}
+
+	template<typename Func>
+	TimerHandle Multitasker::enqueue_periodic(std::chrono::nanoseconds period, Func&& func, TaskDesc desc)
+	{
+		TaskClosure* closure = make_closure(std::forward<Func>(func));
+		return schedule_periodic(period, Task(run_closure_in_place, closure, nullptr, 0, 1), closure, desc);
+	}
+
+	inline void Multitasker::notify_pushed(uint32_t count, TaskDesc desc)
+	{
+		// Parked workers are not individually addressable : worker 0 is only sure to wake if they all do
+		if (desc.affinity == TaskAffinity::main_thread)
+			_work_available.notify_all();
+		else
+			_work_available.notify(count);
+	}
+
 }
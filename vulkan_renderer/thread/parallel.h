@@ -0,0 +1,263 @@
+#pragma once
+#include <thread/multitasker.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+Parallel algorithms on top of the Multitasker.
+
+Ranges are split lazily (lazy binary splitting) : a task runs its range grain by grain and only splits the remaining
+half off as a new task when its worker's deque is empty, i.e. when an idle worker could steal it. A busy machine
+pays for a handful of tasks, an idle one gets work spread over all workers.
+
+The calling fiber runs part of the range itself then waits with wait_for : these can be called from inside tasks (the
+fiber parks, its worker keeps running other tasks, and it may resume on another worker), from worker 0's main fiber,
+which always resumes on worker 0, and from non-worker threads, which push the split off tasks to the shared queues
+and block in wait_for until they are done.
+*/
+
+namespace kth
+{
+
+	namespace detail
+	{
+		template<typename RangeBody>
+		struct ParallelRangeContext
+		{
+			Multitasker* tasker;
+			const RangeBody* body;
+			CounterHandle counter;
+			uint32_t grain;
+		};
+
+		template<typename RangeBody>
+		TASK_FUNC(parallel_range_task);
+
+		template<typename RangeBody>
+		void run_parallel_range(ParallelRangeContext<RangeBody>& context, uint32_t begin, uint32_t end)
+		{
+			while (begin < end)
+			{
+				if (end - begin > context.grain && context.tasker->local_task_count() == 0)
+				{
+					uint32_t middle = begin + (end - begin) / 2;
+					context.tasker->enqueue(parallel_range_task<RangeBody>, &context, middle, end, context.counter);
+					end = middle;
+					continue;
+				}
+
+				uint32_t chunk_end = end - begin > context.grain ? begin + context.grain : end;
+				(*context.body)(begin, chunk_end);
+				begin = chunk_end;
+			}
+		}
+
+		// The split range travels in bundle_index / bundle_size
+		template<typename RangeBody>
+		TASK_FUNC(parallel_range_task)
+		{
+			run_parallel_range(*static_cast<ParallelRangeContext<RangeBody>*>(user_args), bundle_index, bundle_size);
+		}
+
+		inline uint32_t default_grain(const Multitasker& tasker, uint32_t count)
+		{
+			return std::max(1u, count / (tasker.worker_count() * 16));
+		}
+
+		// Fixed blocks for the multi pass algorithms (scan, sort) whose passes must agree on the partition
+		inline uint32_t block_count(const Multitasker& tasker, uint32_t count, uint32_t min_block_size)
+		{
+			uint32_t blocks = std::min(tasker.worker_count() * 4, std::max(1u, count / min_block_size));
+			return std::max(1u, std::min(blocks, count));
+		}
+	}
+
+	// body(begin, end) over sub ranges of [begin, end)
+	template<typename RangeBody>
+	void parallel_for_range(Multitasker& tasker, uint32_t begin, uint32_t end, const RangeBody& body, uint32_t grain = 0)
+	{
+		if (begin >= end) return;
+		if (grain == 0)
+			grain = detail::default_grain(tasker, end - begin);
+
+		detail::ParallelRangeContext<RangeBody> context{ &tasker, &body, Multitasker::acquire_counter(0), grain };
+		// The counter only counts the split off tasks, the caller's own part is done when this returns
+		detail::run_parallel_range(context, begin, end);
+		tasker.wait_for(context.counter, 0);
+		Multitasker::release_counter(context.counter);
+	}
+
+	// body(i) for every i in [begin, end)
+	template<typename Body>
+	void parallel_for(Multitasker& tasker, uint32_t begin, uint32_t end, const Body& body, uint32_t grain = 0)
+	{
+		auto range_body = [&body](uint32_t range_begin, uint32_t range_end)
+		{
+			for (uint32_t i = range_begin; i < range_end; ++i)
+				body(i);
+		};
+		parallel_for_range(tasker, begin, end, range_body, grain);
+	}
+
+	// combine(identity, map(begin), ..., map(end - 1)), combine must be associative and commutative
+	template<typename T, typename Map, typename Combine>
+	T parallel_reduce(Multitasker& tasker, uint32_t begin, uint32_t end, const T& identity, const Map& map, const Combine& combine, uint32_t grain = 0)
+	{
+		// One partial per worker (+1 for non-worker callers), padded so workers do not share cache lines
+		struct Partial
+		{
+			T value;
+			char padding[64];
+		};
+		const uint32_t worker_count = tasker.worker_count();
+		std::vector<Partial> partials(worker_count + 1, Partial{ identity, {} });
+
+		auto range_body = [&](uint32_t range_begin, uint32_t range_end)
+		{
+			T value = map(range_begin);
+			for (uint32_t i = range_begin + 1; i < range_end; ++i)
+				value = combine(value, map(i));
+
+			// No suspension point between reading the slot and writing it back : fibers of one worker never interleave here
+			uint32_t slot = std::min(Multitasker::get_current_thread_id(), worker_count);
+			partials[slot].value = combine(partials[slot].value, value);
+		};
+		parallel_for_range(tasker, begin, end, range_body, grain);
+
+		T result = identity;
+		for (auto& partial : partials)
+			result = combine(result, partial.value);
+		return result;
+	}
+
+	// output[i] = init op input[0] op ... op input[i - 1], returns init op all inputs. input and output may alias.
+	template<typename T, typename Op>
+	T parallel_exclusive_scan(Multitasker& tasker, const T* input, T* output, uint32_t count, const T& init, const Op& op)
+	{
+		if (count == 0) return init;
+
+		uint32_t blocks = detail::block_count(tasker, count, 1024);
+		uint32_t block_size = (count + blocks - 1) / blocks;
+		blocks = (count + block_size - 1) / block_size;
+
+		std::vector<T> block_offsets(blocks);
+		parallel_for(tasker, 0, blocks, [&](uint32_t block)
+		{
+			uint32_t first = block * block_size;
+			uint32_t last = std::min(first + block_size, count);
+			T sum = input[first];
+			for (uint32_t i = first + 1; i < last; ++i)
+				sum = op(sum, input[i]);
+			block_offsets[block] = sum;
+		}, 1);
+
+		T running = init;
+		for (uint32_t block = 0; block < blocks; ++block)
+		{
+			T sum = block_offsets[block];
+			block_offsets[block] = running;
+			running = op(running, sum);
+		}
+
+		parallel_for(tasker, 0, blocks, [&](uint32_t block)
+		{
+			uint32_t first = block * block_size;
+			uint32_t last = std::min(first + block_size, count);
+			T value = block_offsets[block];
+			for (uint32_t i = first; i < last; ++i)
+			{
+				T next = op(value, input[i]);
+				output[i] = value;
+				value = next;
+			}
+		}, 1);
+
+		return running;
+	}
+
+	// Stable LSD radix sort on key(element), an integer. Digits every key shares are skipped.
+	template<typename T, typename KeyFunc>
+	void parallel_sort(Multitasker& tasker, T* data, uint32_t count, const KeyFunc& key)
+	{
+		typedef typename std::decay<decltype(key(*data))>::type Key;
+		static_assert(std::is_integral<Key>::value, "parallel_sort radix sorts integer keys");
+		typedef typename std::make_unsigned<Key>::type UnsignedKey;
+
+		// Flipping the sign bit orders signed keys as unsigned ones
+		const UnsignedKey sign_flip = std::is_signed<Key>::value ? UnsignedKey(UnsignedKey(1) << (sizeof(Key) * 8 - 1)) : UnsignedKey(0);
+		auto radix_key = [&](const T& element) { return UnsignedKey(UnsignedKey(key(element)) ^ sign_flip); };
+
+		if (count < 4096)
+		{
+			std::stable_sort(data, data + count, [&](const T& a, const T& b) { return radix_key(a) < radix_key(b); });
+			return;
+		}
+
+		const uint32_t radix = 256;
+		uint32_t blocks = detail::block_count(tasker, count, 4096);
+		uint32_t block_size = (count + blocks - 1) / blocks;
+		blocks = (count + block_size - 1) / block_size;
+
+		std::vector<T> scratch(count);
+		std::vector<uint32_t> offsets(blocks * radix);
+		T* source = data;
+		T* destination = scratch.data();
+
+		for (uint32_t shift = 0; shift < sizeof(Key) * 8; shift += 8)
+		{
+			parallel_for(tasker, 0, blocks, [&](uint32_t block)
+			{
+				uint32_t* histogram = &offsets[block * radix];
+				std::fill(histogram, histogram + radix, 0u);
+				uint32_t last = std::min((block + 1) * block_size, count);
+				for (uint32_t i = block * block_size; i < last; ++i)
+					++histogram[(radix_key(source[i]) >> shift) & (radix - 1)];
+			}, 1);
+
+			// Digit major, block minor : each block scatters its elements right after the previous block's same digit
+			uint32_t offset = 0;
+			bool single_digit = false;
+			for (uint32_t digit = 0; digit < radix; ++digit)
+			{
+				uint32_t digit_count = 0;
+				for (uint32_t block = 0; block < blocks; ++block)
+				{
+					uint32_t block_digit_count = offsets[block * radix + digit];
+					offsets[block * radix + digit] = offset;
+					offset += block_digit_count;
+					digit_count += block_digit_count;
+				}
+				single_digit |= digit_count == count;
+			}
+			if (single_digit) continue;
+
+			parallel_for(tasker, 0, blocks, [&](uint32_t block)
+			{
+				uint32_t* block_offsets = &offsets[block * radix];
+				uint32_t last = std::min((block + 1) * block_size, count);
+				for (uint32_t i = block * block_size; i < last; ++i)
+					destination[block_offsets[(radix_key(source[i]) >> shift) & (radix - 1)]++] = std::move(source[i]);
+			}, 1);
+			std::swap(source, destination);
+		}
+
+		if (source != data)
+		{
+			parallel_for_range(tasker, 0, count, [&](uint32_t begin, uint32_t end)
+			{
+				std::move(source + begin, source + end, data + begin);
+			});
+		}
+	}
+
+	template<typename T>
+	void parallel_sort(Multitasker& tasker, T* data, uint32_t count)
+	{
+		parallel_sort(tasker, data, count, [](const T& element) { return element; });
+	}
+
+}
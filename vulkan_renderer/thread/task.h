@@ -0,0 +1,280 @@
+#pragma once
+#include <thread/multitasker.h>
+
+/*
+kth::task<T> : lazily started coroutine scheduled on the Multitasker workers.
+
+co_await on a task starts it on the awaiting thread and resumes the awaiter when it completes (symmetric transfer, no
+stack growth). Suspended coroutines only keep their heap frame : waiting on a counter or a fence does not hold a
+pooled fiber, unlike Multitasker::wait_for.
+
+	kth::task<image> load(kth::Multitasker& tasker, const char* path)
+	{
+		auto bytes = co_await read_file(tasker, path);
+		image decoded = decode(bytes);
+		co_await kth::schedule(tasker, kth::TaskDesc(kth::TaskPriority::normal, kth::TaskAffinity::main_thread));
+		co_await kth::poll_until(tasker, [&] { return device.getFenceStatus(upload_fence) == vk::Result::eSuccess; });
+		co_return decoded;
+	}
+
+Needs C++20 coroutines : with an older toolset (v140) KTH_HAS_COROUTINES is 0 and nothing below is declared. The
+CMake build compiles and runs tests/task_test.cpp as C++20.
+*/
+
+#if defined(__has_include)
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine)
+#define KTH_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifndef KTH_HAS_COROUTINES
+#define KTH_HAS_COROUTINES 0
+#endif
+
+#if KTH_HAS_COROUTINES
+
+#include <cassert>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace kth
+{
+
+	template<typename T = void>
+	class task;
+
+	namespace detail
+	{
+		inline TASK_FUNC(resume_coroutine)
+		{
+			std::coroutine_handle<>::from_address(user_args).resume();
+		}
+
+		struct TaskFinalAwaiter
+		{
+			bool await_ready() noexcept { return false; }
+
+			template<typename Promise>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+			{
+				std::coroutine_handle<> continuation = handle.promise().continuation;
+				return continuation ? continuation : std::noop_coroutine();
+			}
+
+			void await_resume() noexcept {}
+		};
+
+		struct TaskPromiseBase
+		{
+			std::suspend_always initial_suspend() noexcept { return {}; }
+			TaskFinalAwaiter final_suspend() noexcept { return {}; }
+			void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+			std::coroutine_handle<> continuation;
+			std::exception_ptr exception;
+		};
+
+		template<typename T>
+		struct TaskPromise : TaskPromiseBase
+		{
+			task<T> get_return_object() noexcept;
+
+			template<typename U>
+			void return_value(U&& result) { value.emplace(std::forward<U>(result)); }
+
+			T result()
+			{
+				if (exception) std::rethrow_exception(exception);
+				return std::move(*value);
+			}
+
+			std::optional<T> value;
+		};
+
+		template<>
+		struct TaskPromise<void> : TaskPromiseBase
+		{
+			task<void> get_return_object() noexcept;
+
+			void return_void() noexcept {}
+
+			void result()
+			{
+				if (exception) std::rethrow_exception(exception);
+			}
+		};
+	}
+
+	template<typename T>
+	class task
+	{
+	public:
+		typedef detail::TaskPromise<T> promise_type;
+
+		task() : _handle(nullptr) {}
+		explicit task(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+		task(task&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+		task& operator=(task&& other) noexcept
+		{
+			if (this != &other)
+			{
+				if (_handle) _handle.destroy();
+				_handle = std::exchange(other._handle, nullptr);
+			}
+			return *this;
+		}
+		~task() { if (_handle) _handle.destroy(); }
+
+		task(const task&) = delete;
+		task& operator=(const task&) = delete;
+
+		struct Awaiter
+		{
+			bool await_ready() noexcept { return handle.done(); }
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+			{
+				handle.promise().continuation = awaiting;
+				return handle;
+			}
+
+			T await_resume() { return handle.promise().result(); }
+
+			std::coroutine_handle<promise_type> handle;
+		};
+
+		// An empty task (default constructed or moved from) has no result to await
+		Awaiter operator co_await() & noexcept { assert(_handle && "co_await on an empty task"); return Awaiter{ _handle }; }
+		Awaiter operator co_await() && noexcept { assert(_handle && "co_await on an empty task"); return Awaiter{ _handle }; }
+
+	private:
+		std::coroutine_handle<promise_type> _handle;
+	};
+
+	namespace detail
+	{
+		template<typename T>
+		task<T> TaskPromise<T>::get_return_object() noexcept
+		{
+			return task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+		}
+
+		inline task<void> TaskPromise<void>::get_return_object() noexcept
+		{
+			return task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+		}
+
+		// Owns itself : starts suspended, frees its frame when it completes
+		struct DetachedTask
+		{
+			struct promise_type
+			{
+				DetachedTask get_return_object() noexcept { return DetachedTask{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+				std::suspend_always initial_suspend() noexcept { return {}; }
+				std::suspend_never final_suspend() noexcept { return {}; }
+				void return_void() noexcept {}
+				void unhandled_exception() noexcept { std::terminate(); }
+			};
+
+			std::coroutine_handle<promise_type> handle;
+		};
+
+		inline DetachedTask run_spawned(Multitasker& tasker, task<void> root, CounterHandle counter)
+		{
+			co_await root;
+			tasker.signal(counter);
+		}
+	}
+
+	// Starts root as a task, the counter reaches zero once it completed. An exception escaping root terminates.
+	inline CounterHandle spawn(Multitasker& tasker, task<void> root, TaskDesc desc = TaskDesc())
+	{
+		CounterHandle counter = Multitasker::acquire_counter(1);
+		detail::DetachedTask detached = detail::run_spawned(tasker, std::move(root), counter);
+		tasker.enqueue_detached(detail::resume_coroutine, detached.handle.address(), desc);
+		return counter;
+	}
+
+	// co_await schedule(tasker, desc) : the coroutine continues as a new task, with desc's priority and affinity
+	struct ScheduleAwaiter
+	{
+		bool await_ready() noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> handle) { tasker->enqueue_detached(detail::resume_coroutine, handle.address(), desc); }
+		void await_resume() noexcept {}
+
+		Multitasker* tasker;
+		TaskDesc desc;
+	};
+
+	inline ScheduleAwaiter schedule(Multitasker& tasker, TaskDesc desc = TaskDesc())
+	{
+		return ScheduleAwaiter{ &tasker, desc };
+	}
+
+	// co_await wait_for(tasker, counter, value) : resumes as a new task once counter <= value
+	struct CounterAwaiter
+	{
+		bool await_ready() { return counter.load() <= value; }
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			waiting_task.continuation = detail::resume_coroutine;
+			waiting_task.continuation_args = handle.address();
+			tasker->wait_for_async(counter, value, &waiting_task);
+		}
+
+		void await_resume() noexcept {}
+
+		Multitasker* tasker;
+		CounterHandle counter;
+		int value;
+		// In the coroutine frame, alive until the coroutine is resumed
+		WaitingTask waiting_task;
+	};
+
+	inline CounterAwaiter wait_for(Multitasker& tasker, CounterHandle counter, int value = 0)
+	{
+		return CounterAwaiter{ &tasker, counter, value, WaitingTask() };
+	}
+
+	// co_await poll_until(tasker, ready) : for completions nothing signals, like GPU fences. ready() is polled from
+	// low priority timer tasks every interval (rounded up to the 1 ms timer tick) : workers park in between.
+	template<typename Ready>
+	struct PollAwaiter
+	{
+		bool await_ready() { return ready(); }
+
+		void await_suspend(std::coroutine_handle<> handle)
+		{
+			suspended = handle;
+			tasker->enqueue_after_detached(interval, poll_task, this);
+		}
+
+		void await_resume() noexcept {}
+
+		static TASK_FUNC(poll_task)
+		{
+			PollAwaiter* awaiter = static_cast<PollAwaiter*>(user_args);
+			if (awaiter->ready())
+				awaiter->suspended.resume();
+			else
+				awaiter->tasker->enqueue_after_detached(awaiter->interval, poll_task, awaiter);
+		}
+
+		Multitasker* tasker;
+		Ready ready;
+		std::chrono::nanoseconds interval;
+		std::coroutine_handle<> suspended;
+	};
+
+	template<typename Ready>
+	PollAwaiter<Ready> poll_until(Multitasker& tasker, Ready ready, std::chrono::nanoseconds interval = std::chrono::milliseconds(1))
+	{
+		return PollAwaiter<Ready>{ &tasker, std::move(ready), interval, nullptr };
+	}
+
+}
+
+#endif
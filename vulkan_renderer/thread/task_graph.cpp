@@ -0,0 +1,119 @@
+#include <thread/task_graph.h>
+
+#include <stdexcept>
+
+namespace kth
+{
+
+	TaskGraph::NodeId TaskGraph::add_node(TASK_FUNC_PTR(func), void* user_args_array, uint32_t user_args_stride, uint32_t bundle_size, TaskDesc desc)
+	{
+		std::unique_ptr<Node> node(new Node);
+		node->function = func;
+		node->user_args_array = user_args_array;
+		node->user_args_stride = user_args_stride;
+		node->bundle_size = bundle_size;
+		node->desc = desc;
+		node->graph = this;
+
+		_nodes.push_back(std::move(node));
+		_validated = false;
+		return (NodeId)(_nodes.size() - 1);
+	}
+
+	void TaskGraph::add_edge(NodeId before, NodeId after)
+	{
+		_nodes[before]->successors.push_back(after);
+		++_nodes[after]->predecessor_count;
+		_validated = false;
+	}
+
+	CounterHandle TaskGraph::run()
+	{
+		if (!_validated)
+			validate();
+
+		// Every element of every node decrements the counter once : it only reaches zero after the last one
+		uint32_t element_count = 0;
+		for (auto& node : _nodes)
+		{
+			node->pending_predecessors.store(node->predecessor_count, std::memory_order_relaxed);
+			node->pending_elements.store(node->bundle_size, std::memory_order_relaxed);
+			element_count += node->bundle_size;
+		}
+		_counter = Multitasker::acquire_counter((int)element_count);
+
+		// Roots are collected first : a root can finish and launch its successors while the loop is still running
+		std::vector<Node*> roots;
+		for (auto& node : _nodes)
+		{
+			if (node->predecessor_count == 0)
+				roots.push_back(node.get());
+		}
+		for (Node* root : roots)
+			launch(*root);
+
+		return _counter;
+	}
+
+	void TaskGraph::launch(Node& node)
+	{
+		if (node.bundle_size == 0)
+		{
+			complete(node);
+			return;
+		}
+		// Stride 0 : every element gets the node, node_task finds its own user_args from the element index
+		_tasker->push_bundle(node_task, &node, 0, _counter.get(), node.bundle_size, node.desc);
+	}
+
+	void TaskGraph::complete(Node& node)
+	{
+		for (NodeId successor_id : node.successors)
+		{
+			Node& successor = *_nodes[successor_id];
+			if (successor.pending_predecessors.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				launch(successor);
+		}
+	}
+
+	TASK_FUNC(TaskGraph::node_task)
+	{
+		Node& node = *static_cast<Node*>(user_args);
+		node.function(static_cast<char*>(node.user_args_array) + (size_t)bundle_index * node.user_args_stride, bundle_index, bundle_size);
+
+		// Successors are pushed before this element decrements the graph counter, which can then not reach zero early
+		if (node.pending_elements.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			node.graph->complete(node);
+	}
+
+	void TaskGraph::validate()
+	{
+		// Kahn's algorithm : nodes on a cycle are never released and would hang whoever waits on the graph
+		std::vector<uint32_t> pending(_nodes.size());
+		std::vector<NodeId> ready;
+		for (NodeId i = 0; i < _nodes.size(); ++i)
+		{
+			pending[i] = _nodes[i]->predecessor_count;
+			if (pending[i] == 0)
+				ready.push_back(i);
+		}
+
+		size_t visited = 0;
+		while (!ready.empty())
+		{
+			NodeId id = ready.back();
+			ready.pop_back();
+			++visited;
+			for (NodeId successor : _nodes[id]->successors)
+			{
+				if (--pending[successor] == 0)
+					ready.push_back(successor);
+			}
+		}
+
+		if (visited != _nodes.size())
+			throw std::logic_error("TaskGraph : the edges form a cycle");
+		_validated = true;
+	}
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <thread/multitasker.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/*
+Task graph : nodes are tasks or bundles, edges order them. A finishing node enqueues the successors it was the last
+predecessor of, on its own worker, so nothing in the graph waits on a counter or parks a fiber. Only whoever runs the
+graph waits, once, on the counter returned by run.
+
+The graph is built once and run again every frame : run resets the dependency counts, user_args are read at execution.
+*/
+
+namespace kth
+{
+
+	class TaskGraph
+	{
+	public:
+		typedef uint32_t NodeId;
+
+		explicit TaskGraph(Multitasker& tasker) : _tasker(&tasker), _validated(false) {}
+
+		TaskGraph(const TaskGraph&) = delete;
+		TaskGraph& operator=(const TaskGraph&) = delete;
+
+		NodeId add(TASK_FUNC_PTR(func), void* user_args, TaskDesc desc = TaskDesc());
+		template<typename T>
+		NodeId add(TASK_FUNC_PTR(func), T* user_args_array, uint32_t n, TaskDesc desc = TaskDesc());
+
+		// after starts once before (all of its elements for a bundle) ran
+		void add_edge(NodeId before, NodeId after);
+
+		// Starts the nodes without predecessors. The counter reaches zero once every node ran, release it after the wait.
+		// Throws std::logic_error if the edges form a cycle. Must not be called again before the previous run completed.
+		CounterHandle run();
+
+	private:
+
+		struct Node
+		{
+			TASK_FUNC_PTR(function) = nullptr;
+			void* user_args_array = nullptr;
+			uint32_t user_args_stride = 0;
+			uint32_t bundle_size = 1;
+			TaskDesc desc;
+
+			std::vector<NodeId> successors;
+			uint32_t predecessor_count = 0;
+
+			std::atomic<uint32_t> pending_predecessors{ 0 };
+			std::atomic<uint32_t> pending_elements{ 0 };
+			TaskGraph* graph = nullptr;
+		};
+
+		static TASK_FUNC(node_task);
+
+		NodeId add_node(TASK_FUNC_PTR(func), void* user_args_array, uint32_t user_args_stride, uint32_t bundle_size, TaskDesc desc);
+		void launch(Node& node);
+		void complete(Node& node);
+		void validate();
+
+		Multitasker* _tasker;
+		// unique_ptr : running tasks hold Node pointers, and Node is not movable anyway (atomics)
+		std::vector<std::unique_ptr<Node>> _nodes;
+		CounterHandle _counter;
+		bool _validated;
+	};
+
+	inline TaskGraph::NodeId TaskGraph::add(TASK_FUNC_PTR(func), void* user_args, TaskDesc desc)
+	{
+		return add_node(func, user_args, 0, 1, desc);
+	}
+
+	template<typename T>
+	TaskGraph::NodeId TaskGraph::add(TASK_FUNC_PTR(func), T* user_args_array, uint32_t n, TaskDesc desc)
+	{
+		return add_node(func, user_args_array, sizeof(T), n, desc);
+	}
+
+}
@@ -1,16 +1,64 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 namespace std
 {
 	namespace this_thread
 	{
+		// Pins the calling thread to one logical processor (LogicalProcessor::id)
 		void set_affinity(uint32_t core);
+		// Lets the calling thread run on every processor of the topology again : undoes a set_affinity inherited from its creator
+		void clear_affinity();
 	}
 }
 
 namespace kth
 {
+	struct LogicalProcessor
+	{
+		// What set_affinity takes
+		uint32_t id = 0;
+		// Physical core index, shared by SMT siblings
+		uint32_t core = 0;
+		// 0 for the first hardware thread of its core
+		uint32_t smt_index = 0;
+		uint32_t numa_node = 0;
+		// Hybrid CPUs : E-core / little core
+		bool efficiency_core = false;
+	};
+
+	struct CpuTopology
+	{
+		// Only the processors this process may run on
+		std::vector<LogicalProcessor> processors;
+		uint32_t core_count = 0;
+		uint32_t numa_node_count = 1;
+	};
+
+	// Queried once, empty if the platform does not expose it
+	const CpuTopology& get_cpu_topology();
+
 	uint32_t get_processor_count();
-}
\ No newline at end of file
+
+	// Blocks while *address == expected, at most about timeout_ns. Can return spuriously.
+	void futex_wait(std::atomic<uint32_t>* address, uint32_t expected, uint64_t timeout_ns = ~0ull);
+	// Wakes up to count threads blocked on address
+	void futex_wake(std::atomic<uint32_t>* address, uint32_t count);
+	void futex_wake_all(std::atomic<uint32_t>* address);
+
+	inline void cpu_pause()
+	{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+		_mm_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+}
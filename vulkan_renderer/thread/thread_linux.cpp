@@ -0,0 +1,210 @@
+#include <thread/thread.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+
+namespace
+{
+	const char* cpu_sysfs_path = "/sys/devices/system/cpu/";
+
+	bool read_line(const std::string& path, std::string& line)
+	{
+		std::ifstream file(path);
+		return file && std::getline(file, line);
+	}
+
+	bool read_uint(const std::string& path, uint32_t& value)
+	{
+		std::string line;
+		if (!read_line(path, line)) return false;
+		std::istringstream stream(line);
+		return (bool)(stream >> value);
+	}
+
+	// "0-3,8,10-11" as used by cpu/online, node*/cpulist, cpu_core/cpus
+	std::vector<uint32_t> parse_cpu_list(const std::string& list)
+	{
+		std::vector<uint32_t> cpus;
+		std::istringstream stream(list);
+		std::string range;
+		while (std::getline(stream, range, ','))
+		{
+			uint32_t first = 0, last = 0;
+			char dash = 0;
+			std::istringstream range_stream(range);
+			if (!(range_stream >> first)) continue;
+			last = (range_stream >> dash >> last) && dash == '-' ? last : first;
+			for (uint32_t cpu = first; cpu <= last; ++cpu)
+				cpus.push_back(cpu);
+		}
+		return cpus;
+	}
+
+	kth::CpuTopology query_cpu_topology()
+	{
+		kth::CpuTopology topology;
+
+		std::string online;
+		if (!read_line(std::string(cpu_sysfs_path) + "online", online)) return topology;
+
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		bool has_allowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+		// Intel hybrid CPUs list their P-cores here, ARM big.LITTLE exposes a per cpu capacity instead
+		std::vector<uint32_t> performance_cpus;
+		std::string performance_list;
+		if (read_line("/sys/devices/cpu_core/cpus", performance_list))
+			performance_cpus = parse_cpu_list(performance_list);
+
+		// No node directory without NUMA support : everything stays on node 0
+		std::map<uint32_t, uint32_t> cpu_nodes;
+		std::string online_nodes;
+		if (read_line("/sys/devices/system/node/online", online_nodes))
+		{
+			for (uint32_t node : parse_cpu_list(online_nodes))
+			{
+				std::string node_cpus;
+				if (!read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", node_cpus)) continue;
+				for (uint32_t cpu : parse_cpu_list(node_cpus))
+					cpu_nodes[cpu] = node;
+			}
+		}
+
+		std::map<std::pair<uint32_t, uint32_t>, uint32_t> core_indices;
+		std::map<uint32_t, uint32_t> core_thread_counts;
+		std::map<uint32_t, uint32_t> capacities;
+		uint32_t max_capacity = 0;
+		std::vector<uint32_t> used_nodes;
+
+		for (uint32_t cpu : parse_cpu_list(online))
+		{
+			if (has_allowed && cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &allowed)) continue;
+
+			std::string cpu_path = std::string(cpu_sysfs_path) + "cpu" + std::to_string(cpu) + "/";
+			uint32_t package_id = 0, core_id = cpu;
+			read_uint(cpu_path + "topology/physical_package_id", package_id);
+			read_uint(cpu_path + "topology/core_id", core_id);
+
+			kth::LogicalProcessor processor;
+			processor.id = cpu;
+
+			auto core = core_indices.emplace(std::make_pair(package_id, core_id), (uint32_t)core_indices.size()).first;
+			processor.core = core->second;
+			// online is sorted : siblings are numbered in logical processor order
+			processor.smt_index = core_thread_counts[processor.core]++;
+
+			auto node = cpu_nodes.find(cpu);
+			processor.numa_node = node != cpu_nodes.end() ? node->second : 0;
+			if (std::find(used_nodes.begin(), used_nodes.end(), processor.numa_node) == used_nodes.end())
+				used_nodes.push_back(processor.numa_node);
+
+			uint32_t capacity = 0;
+			if (read_uint(cpu_path + "cpu_capacity", capacity))
+			{
+				capacities[cpu] = capacity;
+				max_capacity = std::max(max_capacity, capacity);
+			}
+
+			if (!performance_cpus.empty())
+				processor.efficiency_core = std::find(performance_cpus.begin(), performance_cpus.end(), cpu) == performance_cpus.end();
+
+			topology.processors.push_back(processor);
+		}
+
+		if (performance_cpus.empty())
+		{
+			for (auto& processor : topology.processors)
+			{
+				auto capacity = capacities.find(processor.id);
+				processor.efficiency_core = capacity != capacities.end() && capacity->second < max_capacity;
+			}
+		}
+
+		topology.core_count = (uint32_t)core_indices.size();
+		topology.numa_node_count = std::max(1u, (uint32_t)used_nodes.size());
+		return topology;
+	}
+}
+
+namespace std
+{
+	namespace this_thread
+	{
+		void set_affinity(uint32_t core)
+		{
+			// Dynamically sized : logical processor ids can go past CPU_SETSIZE
+			cpu_set_t* set = CPU_ALLOC(core + 1);
+			size_t size = CPU_ALLOC_SIZE(core + 1);
+			CPU_ZERO_S(size, set);
+			CPU_SET_S(core, size, set);
+			pthread_setaffinity_np(pthread_self(), size, set);
+			CPU_FREE(set);
+		}
+
+		void clear_affinity()
+		{
+			const kth::CpuTopology& topology = kth::get_cpu_topology();
+			if (topology.processors.empty()) return;
+
+			uint32_t count = 0;
+			for (auto& processor : topology.processors)
+				count = std::max(count, processor.id + 1);
+			cpu_set_t* set = CPU_ALLOC(count);
+			size_t size = CPU_ALLOC_SIZE(count);
+			CPU_ZERO_S(size, set);
+			for (auto& processor : topology.processors)
+				CPU_SET_S(processor.id, size, set);
+			pthread_setaffinity_np(pthread_self(), size, set);
+			CPU_FREE(set);
+		}
+	}
+}
+
+namespace kth
+{
+	const CpuTopology& get_cpu_topology()
+	{
+		static const CpuTopology topology = query_cpu_topology();
+		return topology;
+	}
+
+	uint32_t get_processor_count()
+	{
+		const CpuTopology& topology = get_cpu_topology();
+		if (!topology.processors.empty())
+			return (uint32_t)topology.processors.size();
+		long count = sysconf(_SC_NPROCESSORS_ONLN);
+		return count > 0 ? (uint32_t)count : 1;
+	}
+
+	void futex_wait(std::atomic<uint32_t>* address, uint32_t expected, uint64_t timeout_ns)
+	{
+		timespec timeout;
+		timeout.tv_sec = (time_t)(timeout_ns / 1000000000);
+		timeout.tv_nsec = (long)(timeout_ns % 1000000000);
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), FUTEX_WAIT_PRIVATE, expected, timeout_ns == ~0ull ? nullptr : &timeout, nullptr, 0);
+	}
+
+	void futex_wake(std::atomic<uint32_t>* address, uint32_t count)
+	{
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), FUTEX_WAKE_PRIVATE, count > INT_MAX ? INT_MAX : (int)count, nullptr, nullptr, 0);
+	}
+
+	void futex_wake_all(std::atomic<uint32_t>* address)
+	{
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+	}
+}
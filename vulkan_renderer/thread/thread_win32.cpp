@@ -1,8 +1,97 @@
 #include <thread/thread.h>
 
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 #include <windows.h>
+#include <algorithm>
 #include <cstdint>
+#include <vector>
+
+// WaitOnAddress / WakeByAddress
+#pragma comment(lib, "Synchronization.lib")
+
+/*
+Logical processor ids are group * 64 + bit : past 64 logical processors Windows splits them in processor groups,
+an affinity mask only covers one group.
+*/
+
+namespace
+{
+	const uint32_t processors_per_group = sizeof(KAFFINITY) * 8;
+
+	std::vector<char> query_processor_information(LOGICAL_PROCESSOR_RELATIONSHIP relationship)
+	{
+		DWORD size = 0;
+		GetLogicalProcessorInformationEx(relationship, nullptr, &size);
+		std::vector<char> buffer(size);
+		if (size == 0 || !GetLogicalProcessorInformationEx(relationship, reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data()), &size))
+			buffer.clear();
+		return buffer;
+	}
+
+	template<typename Func>
+	void for_each_information(const std::vector<char>& buffer, Func func)
+	{
+		for (size_t offset = 0; offset < buffer.size();)
+		{
+			auto* information = reinterpret_cast<const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*>(buffer.data() + offset);
+			func(*information);
+			offset += information->Size;
+		}
+	}
+
+	kth::CpuTopology query_cpu_topology()
+	{
+		kth::CpuTopology topology;
+
+		std::vector<char> cores = query_processor_information(RelationProcessorCore);
+		std::vector<char> nodes = query_processor_information(RelationNumaNode);
+
+		// Hybrid CPUs : higher efficiency classes are the performance cores. The Windows 8.1 SDK still calls
+		// EfficiencyClass Reserved[0], older Windows versions leave it at 0 everywhere.
+		BYTE max_efficiency_class = 0;
+		for_each_information(cores, [&](const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& information)
+		{
+			max_efficiency_class = std::max(max_efficiency_class, information.Processor.Reserved[0]);
+		});
+
+		for_each_information(cores, [&](const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& information)
+		{
+			uint32_t smt_index = 0;
+			for (WORD group = 0; group < information.Processor.GroupCount; ++group)
+			{
+				const GROUP_AFFINITY& affinity = information.Processor.GroupMask[group];
+				for (uint32_t bit = 0; bit < processors_per_group; ++bit)
+				{
+					if (!(affinity.Mask & (KAFFINITY(1) << bit))) continue;
+
+					kth::LogicalProcessor processor;
+					processor.id = affinity.Group * processors_per_group + bit;
+					processor.core = topology.core_count;
+					processor.smt_index = smt_index++;
+					processor.efficiency_core = information.Processor.Reserved[0] < max_efficiency_class;
+					topology.processors.push_back(processor);
+				}
+			}
+			++topology.core_count;
+		});
+
+		uint32_t node_count = 0;
+		for_each_information(nodes, [&](const SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX& information)
+		{
+			const GROUP_AFFINITY& affinity = information.NumaNode.GroupMask;
+			for (auto& processor : topology.processors)
+			{
+				if (processor.id / processors_per_group == affinity.Group && (affinity.Mask & (KAFFINITY(1) << (processor.id % processors_per_group))))
+					processor.numa_node = information.NumaNode.NodeNumber;
+			}
+			++node_count;
+		});
+		topology.numa_node_count = std::max(1u, node_count);
+
+		return topology;
+	}
+}
 
 namespace std
 {
@@ -10,7 +99,18 @@ namespace std
 	{
 		void set_affinity(uint32_t core)
 		{
-			SetThreadAffinityMask(GetCurrentThread(), 1<<core);
+			GROUP_AFFINITY affinity = {};
+			affinity.Group = (WORD)(core / processors_per_group);
+			affinity.Mask = KAFFINITY(1) << (core % processors_per_group);
+			SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr);
+		}
+
+		void clear_affinity()
+		{
+			// The process mask only covers its primary group : threads are created there
+			DWORD_PTR process_mask = 0, system_mask = 0;
+			if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) && process_mask)
+				SetThreadAffinityMask(GetCurrentThread(), process_mask);
 		}
 	}
 }
@@ -18,8 +118,34 @@ namespace std
 
 namespace kth
 {
+	const CpuTopology& get_cpu_topology()
+	{
+		static const CpuTopology topology = query_cpu_topology();
+		return topology;
+	}
+
 	uint32_t get_processor_count()
 	{
 		return GetMaximumProcessorCount(ALL_PROCESSOR_GROUPS);
 	}
-}
\ No newline at end of file
+
+	void futex_wait(std::atomic<uint32_t>* address, uint32_t expected, uint64_t timeout_ns)
+	{
+		// Rounded up to the next millisecond, a timeout must not return early
+		DWORD timeout_ms = INFINITE;
+		if (timeout_ns != ~0ull)
+			timeout_ms = (DWORD)std::min<uint64_t>((timeout_ns + 999999) / 1000000, INFINITE - 1);
+		WaitOnAddress(address, &expected, sizeof(uint32_t), timeout_ms);
+	}
+
+	void futex_wake(std::atomic<uint32_t>* address, uint32_t count)
+	{
+		for (uint32_t i = 0; i < count; ++i)
+			WakeByAddressSingle(address);
+	}
+
+	void futex_wake_all(std::atomic<uint32_t>* address)
+	{
+		WakeByAddressAll(address);
+	}
+}
@@ -0,0 +1,93 @@
+#include <thread/timer_wheel.h>
+
+namespace kth
+{
+
+	TimerWheel::TimerWheel(uint64_t origin_ns) : _origin(origin_ns), _current_tick(0), _size(0)
+	{
+		for (auto& slot : _slots)
+			slot = nullptr;
+	}
+
+	void TimerWheel::insert(TimerNode* timer, uint64_t deadline_ns)
+	{
+		// Rounded up : a timer never expires before its deadline
+		uint64_t tick = deadline_ns > _origin ? (deadline_ns - _origin + tick_ns - 1) / tick_ns : 0;
+		if (tick < _current_tick)
+			tick = _current_tick;
+
+		TimerNode*& slot = _slots[tick % slot_count];
+		timer->deadline_tick = tick;
+		timer->next = slot;
+		slot = timer;
+		++_size;
+	}
+
+	TimerNode* TimerWheel::advance(uint64_t time_ns)
+	{
+		if (time_ns < _origin) return nullptr;
+		uint64_t target_tick = (time_ns - _origin) / tick_ns;
+		if (target_tick < _current_tick || _size == 0)
+		{
+			if (target_tick >= _current_tick)
+				_current_tick = target_tick + 1;
+			return nullptr;
+		}
+
+		// Past one turn every slot gets visited once, however long the wheel was not advanced
+		uint64_t last_tick = target_tick;
+		if (last_tick - _current_tick >= slot_count)
+			last_tick = _current_tick + slot_count - 1;
+
+		TimerNode* expired = nullptr;
+		for (uint64_t tick = _current_tick; tick <= last_tick && _size > 0; ++tick)
+		{
+			TimerNode** link = &_slots[tick % slot_count];
+			while (*link)
+			{
+				TimerNode* timer = *link;
+				if (timer->deadline_tick <= target_tick)
+				{
+					*link = timer->next;
+					timer->next = expired;
+					expired = timer;
+					--_size;
+				}
+				else
+				{
+					link = &timer->next;
+				}
+			}
+		}
+		_current_tick = target_tick + 1;
+		return expired;
+	}
+
+	uint64_t TimerWheel::next_deadline() const
+	{
+		if (_size == 0) return no_deadline;
+
+		uint64_t earliest = no_deadline;
+		for (uint32_t distance = 0; distance < slot_count; ++distance)
+		{
+			// Timers of a later slot in this turn can not be earlier
+			if (earliest <= _current_tick + distance)
+				break;
+			for (const TimerNode* timer = _slots[(_current_tick + distance) % slot_count]; timer; timer = timer->next)
+			{
+				if (timer->deadline_tick < earliest)
+					earliest = timer->deadline_tick;
+			}
+		}
+		return _origin + earliest * tick_ns;
+	}
+
+	uint64_t TimerWheel::next_period_deadline(uint64_t deadline_ns, uint64_t period_ns, uint64_t now_ns)
+	{
+		deadline_ns += period_ns;
+		if (deadline_ns <= now_ns)
+			deadline_ns = now_ns + period_ns;
+		return deadline_ns;
+	}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+
+/*
+Hashed timer wheel : slot_count slots of tick_ns each, a timer sits in the slot of its deadline tick and is skipped
+by the turns of the wheel before its own. Inserting and expiring are O(1), finding the next deadline scans at most
+one turn. Timers expire at tick granularity, never early.
+
+Not thread safe : the Multitasker locks it.
+*/
+
+namespace kth
+{
+
+	// Intrusive : the wheel does not own its timers
+	struct TimerNode
+	{
+		uint64_t deadline_tick = 0;
+		TimerNode* next = nullptr;
+	};
+
+	class TimerWheel
+	{
+	public:
+		static const uint64_t tick_ns = 1000000;
+		static const uint32_t slot_count = 256;
+		static const uint64_t no_deadline = ~0ull;
+
+		// Times are in nanoseconds from the same clock as origin_ns
+		explicit TimerWheel(uint64_t origin_ns);
+
+		TimerWheel(const TimerWheel&) = delete;
+		TimerWheel& operator=(const TimerWheel&) = delete;
+
+		// A deadline already passed expires on the next advance
+		void insert(TimerNode* timer, uint64_t deadline_ns);
+		// Unlinks the timers due at time_ns, returned as a list through TimerNode::next
+		TimerNode* advance(uint64_t time_ns);
+		// Earliest deadline, no_deadline if empty
+		uint64_t next_deadline() const;
+
+		uint32_t size() const { return _size; }
+
+		// Re-arms a periodic timer that expired at now_ns : stays on the period grid unless that fell a whole period behind
+		static uint64_t next_period_deadline(uint64_t deadline_ns, uint64_t period_ns, uint64_t now_ns);
+
+	private:
+		uint64_t _origin;
+		// Next tick advance has not processed yet
+		uint64_t _current_tick;
+		TimerNode* _slots[slot_count];
+		uint32_t _size;
+	};
+
+}
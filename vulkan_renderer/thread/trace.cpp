@@ -0,0 +1,240 @@
+#include <thread/trace.h>
+
+#include <algorithm>
+#include <fstream>
+
+namespace
+{
+	// Frame marks kept for frame_utilization, older ones are dropped
+	const size_t max_frame_marks = 1024;
+
+	void write_slice(std::ofstream& file, bool& first, const char* name, uint32_t worker_id, double begin, double end, const void* object)
+	{
+		file << (first ? "" : ",\n") << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << worker_id
+			<< ",\"ts\":" << begin << ",\"dur\":" << (end - begin);
+		if (object)
+			file << ",\"args\":{\"object\":\"" << object << "\"}";
+		file << "}";
+		first = false;
+	}
+}
+
+namespace kth
+{
+
+	Tracer::Tracer(uint32_t worker_count, uint32_t events_per_worker)
+		: _rings(new Ring[worker_count]), _worker_count(worker_count),
+		_start_timestamp(read_timestamp()), _start_time(std::chrono::steady_clock::now())
+	{
+		uint64_t capacity = 1;
+		while (capacity < events_per_worker)
+			capacity <<= 1;
+		_mask = capacity - 1;
+
+		for (uint32_t i = 0; i < worker_count; ++i)
+			_rings[i].records.reset(new TraceRecord[capacity]);
+	}
+
+	void Tracer::mark_frame()
+	{
+		std::lock_guard<std::mutex> lock(_frames_mutex);
+		if (_frame_marks.size() == max_frame_marks)
+			_frame_marks.erase(_frame_marks.begin());
+		_frame_marks.push_back(read_timestamp());
+	}
+
+	std::vector<TraceRecord> Tracer::snapshot(uint32_t worker_id) const
+	{
+		const Ring& ring = _rings[worker_id];
+		uint64_t count = ring.count.load(std::memory_order_acquire);
+		uint64_t first = count > _mask + 1 ? count - (_mask + 1) : 0;
+
+		std::vector<TraceRecord> records;
+		records.reserve((size_t)(count - first));
+		for (uint64_t i = first; i < count; ++i)
+			records.push_back(ring.records[i & _mask]);
+		return records;
+	}
+
+	double Tracer::ticks_per_microsecond() const
+	{
+		// Calibrated over the tracer's lifetime, against the steady clock
+		double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - _start_time).count();
+		uint64_t ticks = read_timestamp() - _start_timestamp;
+		return elapsed > 0.0 && ticks > 0 ? ticks / elapsed : 1.0;
+	}
+
+	bool Tracer::write_chrome_trace(const std::string& path) const
+	{
+		std::ofstream file(path);
+		if (!file) return false;
+
+		double tick_rate = ticks_per_microsecond();
+		auto to_microseconds = [&](uint64_t timestamp) { return (double)(int64_t)(timestamp - _start_timestamp) / tick_rate; };
+
+		file << "{\"traceEvents\":[\n";
+		bool first = true;
+		for (uint32_t worker_id = 0; worker_id < _worker_count; ++worker_id)
+		{
+			file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << worker_id
+				<< ",\"args\":{\"name\":\"worker " << worker_id << "\"}}";
+			first = false;
+
+			// A wrapped ring can start in the middle of a slice : ends without a begin are skipped
+			const char* slice_name = nullptr;
+			const void* slice_object = nullptr;
+			double slice_begin = 0.0, idle_begin = -1.0, park_begin = -1.0;
+			for (const TraceRecord& record : snapshot(worker_id))
+			{
+				double time = to_microseconds(record.timestamp);
+				switch (record.event)
+				{
+				case TraceEvent::task_begin:
+					slice_name = "task";
+					slice_object = record.object;
+					slice_begin = time;
+					file << ",\n{\"name\":\"queued tasks\",\"ph\":\"C\",\"pid\":0,\"tid\":" << worker_id << ",\"ts\":" << time
+						<< ",\"args\":{\"worker " << worker_id << "\":" << record.value << "}}";
+					break;
+				case TraceEvent::resume:
+					slice_name = "task (resumed)";
+					slice_object = nullptr;
+					slice_begin = time;
+					break;
+				case TraceEvent::task_end:
+				case TraceEvent::wait:
+					if (slice_name)
+						write_slice(file, first, slice_name, worker_id, slice_begin, time, slice_object);
+					slice_name = nullptr;
+					if (record.event == TraceEvent::wait)
+						file << ",\n{\"name\":\"wait\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << worker_id << ",\"ts\":" << time
+							<< ",\"args\":{\"object\":\"" << record.object << "\"}}";
+					break;
+				case TraceEvent::steal:
+					file << ",\n{\"name\":\"steal\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":" << worker_id << ",\"ts\":" << time
+						<< ",\"args\":{\"victim\":" << record.value << "}}";
+					break;
+				case TraceEvent::idle_begin:
+					idle_begin = time;
+					break;
+				case TraceEvent::idle_end:
+					if (idle_begin >= 0.0)
+						write_slice(file, first, "idle", worker_id, idle_begin, time, nullptr);
+					idle_begin = -1.0;
+					break;
+				case TraceEvent::park:
+					park_begin = time;
+					break;
+				case TraceEvent::unpark:
+					if (park_begin >= 0.0)
+						write_slice(file, first, "sleep", worker_id, park_begin, time, nullptr);
+					park_begin = -1.0;
+					break;
+				}
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_frames_mutex);
+			for (uint64_t mark : _frame_marks)
+				file << ",\n{\"name\":\"frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":" << to_microseconds(mark) << "}";
+		}
+
+		file << "\n]}\n";
+		return (bool)file;
+	}
+
+	std::vector<FrameUtilization> Tracer::frame_utilization() const
+	{
+		std::vector<uint64_t> marks;
+		{
+			std::lock_guard<std::mutex> lock(_frames_mutex);
+			marks = _frame_marks;
+		}
+		if (marks.size() < 2) return {};
+
+		std::vector<std::vector<TraceRecord>> records(_worker_count);
+		uint64_t covered_from = _start_timestamp;
+		for (uint32_t worker_id = 0; worker_id < _worker_count; ++worker_id)
+		{
+			records[worker_id] = snapshot(worker_id);
+			if (_rings[worker_id].count.load(std::memory_order_relaxed) > _mask + 1 && !records[worker_id].empty())
+				covered_from = std::max(covered_from, records[worker_id].front().timestamp);
+		}
+
+		// Frames whose events were partly overwritten are left out
+		size_t first_frame = std::lower_bound(marks.begin(), marks.end(), covered_from) - marks.begin();
+		if (first_frame + 1 >= marks.size()) return {};
+		marks.erase(marks.begin(), marks.begin() + first_frame);
+
+		size_t frame_count = marks.size() - 1;
+		double tick_rate = ticks_per_microsecond();
+		std::vector<FrameUtilization> frames(frame_count);
+		std::vector<std::vector<uint64_t>> idle_ticks(frame_count, std::vector<uint64_t>(_worker_count, 0));
+		for (size_t frame = 0; frame < frame_count; ++frame)
+		{
+			frames[frame].duration_ms = (marks[frame + 1] - marks[frame]) / tick_rate / 1000.0;
+			frames[frame].workers.resize(_worker_count);
+		}
+
+		// Index of the frame containing timestamp, frame_count if outside of all of them
+		auto frame_of = [&](uint64_t timestamp)
+		{
+			if (timestamp < marks.front() || timestamp >= marks.back()) return frame_count;
+			return (size_t)(std::upper_bound(marks.begin(), marks.end(), timestamp) - marks.begin()) - 1;
+		};
+
+		for (uint32_t worker_id = 0; worker_id < _worker_count; ++worker_id)
+		{
+			auto add_idle = [&](uint64_t begin, uint64_t end)
+			{
+				begin = std::max(begin, marks.front());
+				end = std::min(end, marks.back());
+				for (size_t frame = frame_of(begin); frame < frame_count && marks[frame] < end; ++frame)
+					idle_ticks[frame][worker_id] += std::min(end, marks[frame + 1]) - std::max(begin, marks[frame]);
+			};
+
+			uint64_t idle_begin = 0;
+			bool idle = false;
+			for (const TraceRecord& record : records[worker_id])
+			{
+				size_t frame = frame_of(record.timestamp);
+				WorkerUtilization* utilization = frame < frame_count ? &frames[frame].workers[worker_id] : nullptr;
+				switch (record.event)
+				{
+				case TraceEvent::task_begin:
+					if (utilization) ++utilization->tasks;
+					break;
+				case TraceEvent::resume:
+					if (utilization) ++utilization->fiber_switches;
+					break;
+				case TraceEvent::steal:
+					if (utilization) ++utilization->steals;
+					break;
+				case TraceEvent::idle_begin:
+					idle_begin = record.timestamp;
+					idle = true;
+					break;
+				case TraceEvent::idle_end:
+					if (idle)
+						add_idle(idle_begin, record.timestamp);
+					idle = false;
+					break;
+				default:
+					break;
+				}
+			}
+			// Still idle
+			if (idle)
+				add_idle(idle_begin, marks.back());
+
+			for (size_t frame = 0; frame < frame_count; ++frame)
+			{
+				double duration = (double)(marks[frame + 1] - marks[frame]);
+				frames[frame].workers[worker_id].busy_fraction = duration > 0.0 ? 1.0 - idle_ticks[frame][worker_id] / duration : 0.0;
+			}
+		}
+		return frames;
+	}
+
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Define KTH_TRACE=1 in the project to record scheduler events : off, the Multitasker has no tracer and no trace code
+#ifndef KTH_TRACE
+#define KTH_TRACE 0
+#endif
+
+/*
+Scheduler trace : each worker writes its events to its own ring buffer (the oldest are overwritten), timestamps are
+raw TSC ticks converted at export.
+
+	if (kth::Tracer* tracer = tasker.tracer()) tracer->mark_frame();		// once per frame
+	...
+	tracer->write_chrome_trace("trace.json");							// chrome://tracing or ui.perfetto.dev
+
+Exporting reads the rings while workers may still write them : export once the tasks of interest are done.
+*/
+
+namespace kth
+{
+
+	enum class TraceEvent : uint8_t
+	{
+		task_begin,		// object : task function, value : tasks in the worker's deques
+		task_end,
+		wait,			// The running task's fiber is switched out, object : counter or primitive waited on
+		resume,			// A waiting fiber continues its task on this worker
+		steal,			// value : victim worker
+		idle_begin,		// No task or ready fiber, spinning or parked
+		idle_end,
+		park,			// Idle worker's thread goes to sleep
+		unpark
+	};
+
+	struct TraceRecord
+	{
+		uint64_t timestamp;
+		const void* object;
+		uint32_t value;
+		TraceEvent event;
+	};
+
+	struct WorkerUtilization
+	{
+		// Time not idle over the frame
+		double busy_fraction = 0.0;
+		uint32_t tasks = 0;
+		uint32_t steals = 0;
+		uint32_t fiber_switches = 0;
+	};
+
+	struct FrameUtilization
+	{
+		double duration_ms = 0.0;
+		std::vector<WorkerUtilization> workers;
+	};
+
+	inline uint64_t read_timestamp()
+	{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	class Tracer
+	{
+	public:
+		// events_per_worker is rounded up to a power of two
+		Tracer(uint32_t worker_count, uint32_t events_per_worker);
+
+		Tracer(const Tracer&) = delete;
+		Tracer& operator=(const Tracer&) = delete;
+
+		// Worker thread worker_id only
+		void record(uint32_t worker_id, TraceEvent event, const void* object = nullptr, uint32_t value = 0)
+		{
+			Ring& ring = _rings[worker_id];
+			uint64_t index = ring.count.load(std::memory_order_relaxed);
+			ring.records[index & _mask] = TraceRecord{ read_timestamp(), object, value, event };
+			ring.count.store(index + 1, std::memory_order_release);
+		}
+
+		// Frame boundary, from the frame loop
+		void mark_frame();
+
+		bool write_chrome_trace(const std::string& path) const;
+		// Frames still fully covered by every worker's ring, oldest first
+		std::vector<FrameUtilization> frame_utilization() const;
+
+	private:
+		struct Ring
+		{
+			std::unique_ptr<TraceRecord[]> records;
+			std::atomic<uint64_t> count{ 0 };
+			char padding[64 - sizeof(std::unique_ptr<TraceRecord[]>) - sizeof(std::atomic<uint64_t>)];
+		};
+
+		// Records still in the ring, oldest first
+		std::vector<TraceRecord> snapshot(uint32_t worker_id) const;
+		double ticks_per_microsecond() const;
+
+		std::unique_ptr<Ring[]> _rings;
+		uint32_t _worker_count;
+		uint64_t _mask;
+
+		mutable std::mutex _frames_mutex;
+		std::vector<uint64_t> _frame_marks;
+
+		uint64_t _start_timestamp;
+		std::chrono::steady_clock::time_point _start_time;
+	};
+
+}
@@ -0,0 +1,195 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+/*
+Chase-Lev work stealing deque (Le, Pop, Cohen, Zappa Nardelli - "Correct and Efficient Work-Stealing for Weak Memory Models")
+
+owner thread : push / pop at the bottom (LIFO, keeps a task and its children hot in cache)
+other threads : steal at the top (FIFO, takes the oldest and usually biggest work first)
+
+The buffer grows when full ; old buffers can still be read by thieves so they are only freed with the deque.
+*/
+
+namespace kth
+{
+
+	template<typename T>
+	class WorkStealingDeque
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque elements are read racily by thieves and must be trivially copyable");
+
+	public:
+		explicit WorkStealingDeque(int64_t capacity = 256);
+		~WorkStealingDeque();
+
+		WorkStealingDeque(const WorkStealingDeque&) = delete;
+		WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+		// Owner only
+		void push(const T& item);
+		// Publishes all items at once : thieves see either none or all of them
+		void push_bulk(const T* items, size_t count);
+		bool pop(T& item);
+
+		// Any thread, false if empty or if another thread won the race for the top element
+		bool steal(T& item);
+
+		int64_t size() const { return _bottom.load(std::memory_order_relaxed) - _top.load(std::memory_order_relaxed); }
+
+	private:
+
+		// Items are stored as relaxed atomic words : a thief may read a slot the owner is overwriting, the CAS on top
+		// then discards what it read. Whole std::atomic<T> would not be lock-free for anything bigger than a pointer.
+		static const size_t words_per_item = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+		struct Buffer
+		{
+			explicit Buffer(int64_t capacity) : capacity(capacity), mask(capacity - 1), words(new std::atomic<uint64_t>[capacity * words_per_item]) {}
+			~Buffer() { delete[] words; }
+
+			T get(int64_t index) const
+			{
+				uint64_t item_words[words_per_item];
+				const std::atomic<uint64_t>* slot = words + (index & mask) * words_per_item;
+				for (size_t i = 0; i < words_per_item; ++i)
+					item_words[i] = slot[i].load(std::memory_order_relaxed);
+
+				T item;
+				memcpy(&item, item_words, sizeof(T));
+				return item;
+			}
+
+			void put(int64_t index, const T& item)
+			{
+				uint64_t item_words[words_per_item] = {};
+				memcpy(item_words, &item, sizeof(T));
+
+				std::atomic<uint64_t>* slot = words + (index & mask) * words_per_item;
+				for (size_t i = 0; i < words_per_item; ++i)
+					slot[i].store(item_words[i], std::memory_order_relaxed);
+			}
+
+			int64_t capacity;
+			int64_t mask;
+			std::atomic<uint64_t>* words;
+		};
+
+		Buffer* grow(Buffer* buffer, int64_t bottom, int64_t top);
+
+		// top is written by thieves, bottom by the owner : keep them on separate cache lines
+		alignas(64) std::atomic<int64_t> _top;
+		alignas(64) std::atomic<int64_t> _bottom;
+		alignas(64) std::atomic<Buffer*> _buffer;
+		std::vector<Buffer*> _retired_buffers;
+	};
+
+	template<typename T>
+	WorkStealingDeque<T>::WorkStealingDeque(int64_t capacity) : _top(0), _bottom(0)
+	{
+		// Capacity must be a power of two for the index mask
+		int64_t pow2_capacity = 1;
+		while (pow2_capacity < capacity) pow2_capacity <<= 1;
+		_buffer.store(new Buffer(pow2_capacity), std::memory_order_relaxed);
+	}
+
+	template<typename T>
+	WorkStealingDeque<T>::~WorkStealingDeque()
+	{
+		delete _buffer.load(std::memory_order_relaxed);
+		for (Buffer* buffer : _retired_buffers)
+			delete buffer;
+	}
+
+	template<typename T>
+	void WorkStealingDeque<T>::push(const T& item)
+	{
+		int64_t bottom = _bottom.load(std::memory_order_relaxed);
+		int64_t top = _top.load(std::memory_order_acquire);
+		Buffer* buffer = _buffer.load(std::memory_order_relaxed);
+
+		if (bottom - top > buffer->capacity - 1)
+			buffer = grow(buffer, bottom, top);
+
+		buffer->put(bottom, item);
+		std::atomic_thread_fence(std::memory_order_release);
+		_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+
+	template<typename T>
+	void WorkStealingDeque<T>::push_bulk(const T* items, size_t count)
+	{
+		int64_t bottom = _bottom.load(std::memory_order_relaxed);
+		int64_t top = _top.load(std::memory_order_acquire);
+		Buffer* buffer = _buffer.load(std::memory_order_relaxed);
+
+		while (bottom - top + (int64_t)count > buffer->capacity)
+			buffer = grow(buffer, bottom, top);
+
+		for (size_t i = 0; i < count; ++i)
+			buffer->put(bottom + (int64_t)i, items[i]);
+		std::atomic_thread_fence(std::memory_order_release);
+		_bottom.store(bottom + (int64_t)count, std::memory_order_relaxed);
+	}
+
+	template<typename T>
+	bool WorkStealingDeque<T>::pop(T& item)
+	{
+		int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+		Buffer* buffer = _buffer.load(std::memory_order_relaxed);
+		_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t top = _top.load(std::memory_order_relaxed);
+
+		if (top > bottom)
+		{
+			// Empty
+			_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		item = buffer->get(bottom);
+		if (top == bottom)
+		{
+			// Last element : race against thieves for it
+			bool won = _top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	template<typename T>
+	bool WorkStealingDeque<T>::steal(T& item)
+	{
+		int64_t top = _top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t bottom = _bottom.load(std::memory_order_acquire);
+
+		if (top >= bottom) return false;
+
+		Buffer* buffer = _buffer.load(std::memory_order_acquire);
+		T stolen = buffer->get(top);
+		if (!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return false;
+
+		item = stolen;
+		return true;
+	}
+
+	template<typename T>
+	typename WorkStealingDeque<T>::Buffer* WorkStealingDeque<T>::grow(Buffer* buffer, int64_t bottom, int64_t top)
+	{
+		Buffer* new_buffer = new Buffer(buffer->capacity * 2);
+		for (int64_t i = top; i < bottom; ++i)
+			new_buffer->put(i, buffer->get(i));
+
+		_retired_buffers.push_back(buffer);
+		_buffer.store(new_buffer, std::memory_order_release);
+		return new_buffer;
+	}
+
+}